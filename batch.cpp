@@ -0,0 +1,491 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cctype>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+#include "batch.h"
+#include "dataset.h"
+#include "reader.h"
+#include "model.h"
+#include "kdtree.h"
+#include "fit.h"
+#include "pool.h"
+#include "numa.h"
+#include "trace.h"
+#include "measure.h"
+
+// queries scored by one task
+static const size_t SCORE_CHUNK_ROWS = 256;
+
+typedef std::chrono::steady_clock Clock;
+
+const char* const PIPELINE_STAGE_NAMES[PIPELINE_STAGES] = {"parse", "normalize", "nn", "ecdf", "fit", "index", "score"};
+
+struct BatchDataset {
+    std::string name;
+    std::string file;
+    TableFormat format;
+    std::vector<ClassMember> rows;
+    double parseSeconds;
+    std::string error;
+};
+
+struct BatchConfig {
+    std::string name;
+    size_t k;
+    size_t leafSize;
+};
+
+struct BatchJob {
+    BatchDataset* dataset;
+    const BatchConfig* config;
+    size_t normalizeThreads;                   // 1 among the other jobs of a batch, all threads when profiled alone
+    Clock::time_point start;
+    Clock::time_point end;
+
+    Model model;
+    ModelView view;
+    KdTree tree;
+    std::vector<KdTree> replicas;              // with --numa replicate, a copy of the tree per node
+    std::vector<uint32_t> rowClasses;          // class of each dataset row
+    std::vector<uint32_t> modelRows;           // model row of each dataset row
+    std::vector<std::vector<double> > nearest; // per class: nearest other row of the class, by model row
+    std::vector<std::vector<double> > curves;
+    std::vector<CurveFit> fits;
+    std::atomic<size_t> classesLeft;
+    std::atomic<size_t> chunksLeft;
+
+    // seconds spent in each stage; per class and per chunk slots are summed at the end
+    double normalizeSeconds;
+    double indexSeconds;
+    std::vector<double> nnSeconds, ecdfSeconds, fitSeconds, scoreSeconds;
+    std::vector<size_t> correct;               // per chunk: rows whose k-NN vote, without themselves, is their own class
+    std::vector<double> ownPValues;            // per chunk: sum of the own-class p-values of the nearest other row
+};
+
+static double sum(const std::vector<double>& values) {
+    double total = 0.0;
+    for (double value : values) {
+        total += value;
+    }
+    return total;
+}
+
+// whitespace separated words, "double quoted" words may hold spaces
+static std::vector<std::string> splitWords(const std::string& line) {
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < line.size()) {
+        if (isspace(static_cast<unsigned char>(line[i]))) {
+            ++i;
+        } else if (line[i] == '#') {
+            break;
+        } else if (line[i] == '"') {
+            size_t close = line.find('"', i + 1);
+            close = close == std::string::npos ? line.size() : close;
+            words.push_back(line.substr(i + 1, close - i - 1));
+            i = close + 1;
+        } else {
+            size_t end = i;
+            while (end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) {
+                ++end;
+            }
+            words.push_back(line.substr(i, end - i));
+            i = end;
+        }
+    }
+    return words;
+}
+
+static bool readSpec(const std::string& specFile, std::vector<std::unique_ptr<BatchDataset> >& datasets,
+                     std::vector<BatchConfig>& configs) {
+    std::ifstream file(specFile);
+    if (!file.is_open()) {
+        fprintf(stderr, "Could not open %s\n", specFile.c_str());
+        return false;
+    }
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        std::vector<std::string> words = splitWords(line);
+        if (words.empty()) {
+            continue;
+        }
+        bool valid = false;
+        if (words[0] == "dataset" && words.size() >= 3) {
+            std::unique_ptr<BatchDataset> dataset(new BatchDataset());
+            dataset->name = words[1];
+            dataset->file = words[2];
+            dataset->parseSeconds = 0;
+            valid = true;
+            for (size_t i = 3; valid && i < words.size(); i += 2) {
+                valid = i + 1 < words.size() && parseTableOption(words[i], words[i + 1].c_str(), dataset->format);
+            }
+            datasets.push_back(std::move(dataset));
+        } else if (words[0] == "config" && words.size() >= 2) {
+            BatchConfig config = {words[1], 5, 8};
+            valid = true;
+            for (size_t i = 2; valid && i < words.size(); ++i) {
+                size_t equals = words[i].find('=');
+                std::string key = words[i].substr(0, equals);
+                if (equals == std::string::npos || (key != "k" && key != "leaf")) {
+                    valid = false;
+                    break;
+                }
+                size_t value;
+                valid = parseCount(words[i].substr(equals + 1), value);
+                if (valid) {
+                    (key == "k" ? config.k : config.leafSize) = value;
+                }
+            }
+            configs.push_back(config);
+        }
+        if (!valid) {
+            fprintf(stderr, "%s:%zu: cannot parse '%s'\n", specFile.c_str(), number, line.c_str());
+            return false;
+        }
+    }
+    if (configs.empty()) {
+        BatchConfig config = {"default", 5, 8};
+        configs.push_back(config);
+    }
+    return true;
+}
+
+// Leave-one-out scoring of the training rows: every row is a query, so the search asks
+// for k + 1 neighbors and drops the row itself, and the own-class p-value is that of the
+// distance to the nearest other row of the class, which the class stage already measured.
+static void scoreChunk(BatchJob& job, size_t chunk) {
+    TRACE_SPAN_ARG("task", "score chunk", chunk);
+    auto start = Clock::now();
+    size_t begin = chunk * SCORE_CHUNK_ROWS;
+    size_t end = std::min(job.dataset->rows.size(), begin + SCORE_CHUNK_ROWS);
+    size_t k = job.config->k + 1;
+    size_t count = end - begin, classCount = job.view.classCount, dim = job.view.dim;
+    std::vector<FusedScratch> scratch;
+    std::vector<double> queries(count * dim);     // the normalized rows, from the model
+    std::vector<Neighbor> neighbors(count * k);
+    std::vector<size_t> found(count);
+    for (size_t i = begin; i < end; ++i) {
+        const double* row = job.view.features + static_cast<size_t>(job.modelRows[i]) * dim;
+        std::copy(row, row + dim, queries.begin() + (i - begin) * dim);
+    }
+    const KdTree& tree = job.replicas.empty() ? job.tree : job.replicas[currentNode() % job.replicas.size()];
+    nearestNeighborsGroup(tree, queries.data(), count, k, scratch, neighbors.data(), found.data());
+    std::vector<size_t> votes(classCount);
+    for (size_t i = begin; i < end; ++i) {
+        // the neighbors without the row itself, or without the farthest if rows at distance 0 pushed it out
+        const Neighbor* nearest = &neighbors[(i - begin) * k];
+        size_t kept = found[i - begin];
+        size_t self = std::find_if(nearest, nearest + kept, [&](const Neighbor& n) { return n.row == job.modelRows[i]; }) -
+                      nearest;
+        self = std::min(self, kept - 1);
+        // the vote of fusedQuery: the most votes, ties to the class of the nearer neighbor
+        std::fill(votes.begin(), votes.end(), 0);
+        size_t vote = classCount;
+        for (size_t n = 0; n < kept; ++n) {
+            if (n != self) {
+                ++votes[nearest[n].classIndex];
+            }
+        }
+        for (size_t n = 0; n < kept; ++n) {
+            if (n != self && (vote == classCount || votes[nearest[n].classIndex] > votes[vote])) {
+                vote = nearest[n].classIndex;
+            }
+        }
+        uint32_t c = job.rowClasses[i];
+        job.correct[chunk] += vote == c;
+        double distance = job.nearest[c][job.modelRows[i] - job.view.classOffsets[c]];
+        job.ownPValues[chunk] += classPValue(job.view, c, distance);
+    }
+    job.scoreSeconds[chunk] = secondsSince(start);
+    if (--job.chunksLeft == 0) {
+        job.end = Clock::now();
+    }
+}
+
+static void placeKdTree(const KdTree& tree, size_t node) {
+    moveToNode(tree.nodes.data(), tree.nodes.size() * sizeof(KdNode), node);
+    moveToNode(tree.bounds.data(), tree.bounds.size() * sizeof(double), node);
+    moveToNode(tree.classMasks.data(), tree.classMasks.size() * sizeof(uint64_t), node);
+    moveToNode(tree.points.data(), tree.points.size() * sizeof(double), node);
+    moveToNode(tree.rows.data(), tree.rows.size() * sizeof(uint32_t), node);
+    moveToNode(tree.classes.data(), tree.classes.size() * sizeof(uint32_t), node);
+}
+
+// after the last class: assemble the model, build the index and queue the scoring chunks
+static void buildIndex(TaskPool& pool, BatchJob& job) {
+    auto start = Clock::now();
+    for (size_t c = 0; c < job.curves.size(); ++c) {
+        addClassCurve(job.model, job.curves[c], job.fits[c]);
+    }
+    job.view = viewOf(job.model);
+    job.tree = buildKdTree(job.view, job.config->leafSize);
+    size_t nodes = numaNodeCount();
+    if ((numaPolicy & NUMA_REPLICATE) && nodes > 1) {
+        job.replicas.assign(nodes, job.tree);
+        for (size_t node = 0; node < nodes; ++node) {
+            placeKdTree(job.replicas[node], node);
+        }
+    }
+    job.indexSeconds = secondsSince(start);
+
+    // the chunks are spread over the nodes in row order, as the classes are
+    size_t chunks = (job.dataset->rows.size() + SCORE_CHUNK_ROWS - 1) / SCORE_CHUNK_ROWS;
+    job.scoreSeconds.assign(chunks, 0.0);
+    job.correct.assign(chunks, 0);
+    job.ownPValues.assign(chunks, 0.0);
+    job.chunksLeft = chunks;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        pool.submit([&job, chunk] { scoreChunk(job, chunk); }, chunk * nodes / chunks);
+    }
+}
+
+static void trainClass(TaskPool& pool, BatchJob& job, size_t c) {
+    auto start = Clock::now();
+    job.nearest[c] = classNearestDistances(job.model, c);
+    job.nnSeconds[c] = secondsSince(start);
+
+    start = Clock::now();
+    job.curves[c] = classCurve(job.nearest[c], NN_DISTANCE_CUTOFF);
+    job.ecdfSeconds[c] = secondsSince(start);
+
+    start = Clock::now();
+    job.fits[c] = fitClassCurve(job.curves[c], job.model.classNames[c]);
+    job.fitSeconds[c] = secondsSince(start);
+
+    if (--job.classesLeft == 0) {
+        buildIndex(pool, job);
+    }
+}
+
+static void normalizeJob(TaskPool& pool, BatchJob& job) {
+    job.start = Clock::now();
+    job.model = normalizeModel(job.dataset->rows, job.normalizeThreads);
+    size_t classCount = job.model.classNames.size();
+    job.model.curveOffsets.push_back(0);
+    std::vector<uint64_t> nextRow(job.model.classOffsets.begin(), job.model.classOffsets.end() - 1);
+    for (const auto& row : job.dataset->rows) {
+        size_t c = std::find(job.model.classNames.begin(), job.model.classNames.end(), row.name) - job.model.classNames.begin();
+        job.rowClasses.push_back(static_cast<uint32_t>(c));
+        job.modelRows.push_back(static_cast<uint32_t>(nextRow[c]++));   // normalizeModel keeps the order within a class
+    }
+    job.normalizeSeconds = secondsSince(job.start);
+
+    job.nearest.resize(classCount);
+    job.curves.resize(classCount);
+    job.fits.resize(classCount);
+    job.nnSeconds.assign(classCount, 0.0);
+    job.ecdfSeconds.assign(classCount, 0.0);
+    job.fitSeconds.assign(classCount, 0.0);
+    job.classesLeft = classCount;
+    for (size_t c = 0; c < classCount; ++c) {
+        pool.submit([&pool, &job, c] { trainClass(pool, job, c); }, classNode(job.model.classOffsets.data(), classCount, c));
+    }
+}
+
+// the jobs of a dataset once its rows are read
+static void datasetRead(TaskPool& pool, BatchDataset& dataset, const std::vector<BatchJob*>& jobs) {
+    if (dataset.rows.empty()) {
+        dataset.error = "no rows";
+        return;
+    }
+    for (const auto& row : dataset.rows) {
+        if (row.features.size() != dataset.rows[0].features.size()) {
+            dataset.error = "inconsistent feature size";
+            return;
+        }
+    }
+    for (BatchJob* job : jobs) {
+        pool.submit([&pool, job] { normalizeJob(pool, *job); });
+    }
+}
+
+static void parseDataset(TaskPool& pool, BatchDataset& dataset, const std::vector<BatchJob*>& jobs) {
+    auto start = Clock::now();
+    dataset.rows = readTable(dataset.file, dataset.format);
+    dataset.parseSeconds = secondsSince(start);
+    datasetRead(pool, dataset, jobs);
+}
+
+static std::string jsonString(const std::string& value) {
+    std::string quoted = "\"";
+    for (char ch : value) {
+        if (ch == '"' || ch == '\\') {
+            quoted += '\\';
+            quoted += ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+            quoted += escaped;
+        } else {
+            quoted += ch;
+        }
+    }
+    return quoted + "\"";
+}
+
+static void writeJob(FILE* out, const BatchJob& job) {
+    const BatchDataset& dataset = *job.dataset;
+    fprintf(out, "    {\"dataset\": %s, \"file\": %s, \"config\": %s, \"k\": %zu, \"leaf\": %zu",
+            jsonString(dataset.name).c_str(), jsonString(dataset.file).c_str(), jsonString(job.config->name).c_str(),
+            job.config->k, job.config->leafSize);
+    if (!dataset.error.empty()) {
+        fprintf(out, ", \"error\": %s}", jsonString(dataset.error).c_str());
+        return;
+    }
+    size_t rows = dataset.rows.size();
+    size_t correct = 0;
+    for (size_t value : job.correct) {
+        correct += value;
+    }
+    fprintf(out, ", \"rows\": %zu, \"features\": %zu, \"classes\": %zu,\n", rows, job.model.dim, job.model.classNames.size());
+    fprintf(out, "     \"stages_ms\": {\"parse\": %.3f, \"normalize\": %.3f, \"nn\": %.3f, \"ecdf\": %.3f, \"fit\": %.3f, "
+                 "\"index\": %.3f, \"score\": %.3f}, \"wall_ms\": %.3f,\n",
+            dataset.parseSeconds * 1e3, job.normalizeSeconds * 1e3, sum(job.nnSeconds) * 1e3, sum(job.ecdfSeconds) * 1e3,
+            sum(job.fitSeconds) * 1e3, job.indexSeconds * 1e3, sum(job.scoreSeconds) * 1e3,
+            std::chrono::duration<double>(job.end - job.start).count() * 1e3);
+    fprintf(out, "     \"accuracy\": %.6f, \"mean_own_p\": %.6f,\n", static_cast<double>(correct) / rows, sum(job.ownPValues) / rows);
+    fprintf(out, "     \"class_fits\": [");
+    size_t familyCount;
+    const SigmoidFamily* families = sigmoidFamilies(familyCount);
+    for (size_t c = 0; c < job.fits.size(); ++c) {
+        const CurveFit& fit = job.fits[c];
+        fprintf(out, "%s{\"class\": %s, \"curve\": %zu, \"family\": %s, \"c\": %.9g, \"a\": %.9g}", c > 0 ? ", " : "",
+                jsonString(job.model.classNames[c]).c_str(), job.curves[c].size(),
+                fit.family >= 0 ? jsonString(families[fit.family].name).c_str() : "null", fit.c, fit.a);
+    }
+    fprintf(out, "]}");
+}
+
+static void runJobs(const std::vector<std::unique_ptr<BatchDataset> >& datasets,
+                    const std::vector<std::vector<BatchJob*> >& datasetJobs, size_t threads) {
+    TaskPool pool(threads);
+    std::vector<std::string> files;
+    std::vector<TableFormat> formats;
+    for (const auto& dataset : datasets) {
+        files.push_back(dataset->file);
+        formats.push_back(dataset->format);
+    }
+    if (useBlockReader(files)) {
+        // every table through one block reader, each dataset's jobs started as soon as its file is complete
+        auto start = Clock::now();
+        readTables(files, formats, ReaderOptions(), [&](size_t d, std::vector<ClassMember>& rows) {
+            datasets[d]->rows.swap(rows);
+            datasets[d]->parseSeconds = secondsSince(start);
+            datasetRead(pool, *datasets[d], datasetJobs[d]);
+        });
+        pool.wait();
+        return;
+    }
+    for (size_t d = 0; d < datasets.size(); ++d) {
+        BatchDataset* dataset = datasets[d].get();
+        const std::vector<BatchJob*>* waiting = &datasetJobs[d];
+        pool.submit([&pool, dataset, waiting] { parseDataset(pool, *dataset, *waiting); });
+    }
+    pool.wait();
+}
+
+int runBatch(const std::string& specFile, size_t threads, const std::string& outputFile) {
+    std::vector<std::unique_ptr<BatchDataset> > datasets;
+    std::vector<BatchConfig> configs;
+    if (!readSpec(specFile, datasets, configs)) {
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<BatchJob> > jobs;
+    std::vector<std::vector<BatchJob*> > datasetJobs(datasets.size());
+    for (size_t d = 0; d < datasets.size(); ++d) {
+        for (const auto& config : configs) {
+            jobs.push_back(std::unique_ptr<BatchJob>(new BatchJob()));
+            jobs.back()->dataset = datasets[d].get();
+            jobs.back()->config = &config;
+            jobs.back()->normalizeThreads = 1;
+            datasetJobs[d].push_back(jobs.back().get());
+        }
+    }
+
+    auto start = Clock::now();
+    runJobs(datasets, datasetJobs, threads);
+    double wallSeconds = secondsSince(start);
+
+    FILE* out = fopen(outputFile.c_str(), "w");
+    if (!out) {
+        perror(outputFile.c_str());
+        return 1;
+    }
+    fprintf(out, "{\"spec\": %s, \"threads\": %zu, \"wall_ms\": %.3f,\n  \"jobs\": [\n", jsonString(specFile).c_str(), threads,
+            wallSeconds * 1e3);
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        writeJob(out, *jobs[j]);
+        fprintf(out, j + 1 < jobs.size() ? ",\n" : "\n");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+
+    int failed = 0;
+    for (const auto& job : jobs) {
+        if (!job->dataset->error.empty()) {
+            printf("%s / %s: %s\n", job->dataset->name.c_str(), job->config->name.c_str(), job->dataset->error.c_str());
+            failed = 1;
+        } else {
+            printf("%s / %s: %zu rows, %.3f ms\n", job->dataset->name.c_str(), job->config->name.c_str(),
+                   job->dataset->rows.size(), std::chrono::duration<double>(job->end - job->start).count() * 1e3);
+        }
+    }
+    printf("%zu jobs on %zu threads in %.3f ms, results in %s\n", jobs.size(), threads, wallSeconds * 1e3, outputFile.c_str());
+    return failed;
+}
+
+bool profilePipeline(const std::string& file, const TableFormat& format, size_t k, size_t leafSize, size_t threads,
+                     PipelineProfile& profile) {
+    std::vector<std::unique_ptr<BatchDataset> > datasets;
+    datasets.push_back(std::unique_ptr<BatchDataset>(new BatchDataset()));
+    BatchDataset& dataset = *datasets[0];
+    dataset.name = file;
+    dataset.file = file;
+    dataset.format = format;
+    dataset.parseSeconds = 0;
+    BatchConfig config = {"profile", std::max<size_t>(1, k), std::max<size_t>(1, leafSize)};
+    std::unique_ptr<BatchJob> job(new BatchJob());
+    job->dataset = &dataset;
+    job->config = &config;
+    job->normalizeThreads = threads;
+    std::vector<std::vector<BatchJob*> > datasetJobs(1, std::vector<BatchJob*>(1, job.get()));
+
+    auto start = Clock::now();
+    runJobs(datasets, datasetJobs, threads);
+    profile.wallSeconds = secondsSince(start);
+    if (!dataset.error.empty()) {
+        fprintf(stderr, "%s: %s\n", file.c_str(), dataset.error.c_str());
+        return false;
+    }
+
+    profile.rows = dataset.rows.size();
+    profile.classes = job->model.classNames.size();
+    profile.pairs = 0;
+    for (size_t c = 0; c < profile.classes; ++c) {
+        double size = static_cast<double>(job->model.classOffsets[c + 1] - job->model.classOffsets[c]);
+        profile.pairs += size * (size - 1);
+    }
+    const std::vector<double> tasks[PIPELINE_STAGES] = {
+        std::vector<double>(1, dataset.parseSeconds), std::vector<double>(1, job->normalizeSeconds), job->nnSeconds,
+        job->ecdfSeconds, job->fitSeconds, std::vector<double>(1, job->indexSeconds), job->scoreSeconds};
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        profile.stageBusy[stage] = sum(tasks[stage]);
+        profile.stageLongest[stage] = tasks[stage].empty() ? 0.0 : *std::max_element(tasks[stage].begin(), tasks[stage].end());
+        profile.stageTasks[stage] = tasks[stage].size();
+    }
+    size_t correct = 0;
+    for (size_t value : job->correct) {
+        correct += value;
+    }
+    profile.accuracy = static_cast<double>(correct) / profile.rows;
+    return true;
+}
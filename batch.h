@@ -0,0 +1,43 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+#include "dataset.h"
+
+// Run every dataset x configuration job of a job-spec file in one process. The
+// spec has one entry per line ('#' starts a comment, quote paths with spaces):
+//
+//   dataset <name> <file> [--delimiter c] [--label-column i] [--skip-column i]...
+//   config <name> [k=<neighbors>] [leaf=<kd-tree leaf size>]
+//
+// Each dataset is parsed once. The stages of all jobs (normalize, per-class NN,
+// ECDF and fit, index build, scoring chunks) are tasks of one work-stealing pool,
+// so jobs run interleaved, and the per-stage timings and results of every job are
+// written to one JSON file.
+int runBatch(const std::string& specFile, size_t threads, const std::string& outputFile);
+
+enum PipelineStage { STAGE_PARSE, STAGE_NORMALIZE, STAGE_NN, STAGE_ECDF, STAGE_FIT, STAGE_INDEX, STAGE_SCORE, PIPELINE_STAGES };
+
+extern const char* const PIPELINE_STAGE_NAMES[PIPELINE_STAGES];
+
+// One job of the batch pipeline with per-stage timings. Stages of different classes
+// overlap in time, so a stage is described by its tasks: their summed time, the
+// longest one and their number (one per class for nn, ecdf and fit, one per chunk
+// of rows for score, a single task otherwise).
+struct PipelineProfile {
+    size_t rows;
+    size_t classes;
+    double pairs;                  // point pairs of the per-class nearest neighbor search
+    double wallSeconds;
+    double stageBusy[PIPELINE_STAGES];
+    double stageLongest[PIPELINE_STAGES];
+    size_t stageTasks[PIPELINE_STAGES];
+    double accuracy;
+};
+
+// parse, train and score file on threads threads; false if the table cannot be used
+bool profilePipeline(const std::string& file, const TableFormat& format, size_t k, size_t leafSize, size_t threads,
+                     PipelineProfile& profile);
+
+#endif
@@ -0,0 +1,9 @@
+# datasets x configurations for ./cpv --batch batch.spec
+dataset iris iris.data
+dataset glass "test datasets/glass identification/glass.data" --skip-column 0
+dataset wine-red "test datasets/wine quality/winequality-red.csv"
+dataset wine-white "test datasets/wine quality/winequality-white.csv"
+
+config k1 k=1
+config k5 k=5
+config k15 k=15 leaf=16
@@ -0,0 +1,493 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <ctime>
+#include <unistd.h>
+
+#include "statistics.h"
+
+#include "dataset.h"
+#include "process.h"
+#include "fit.h"
+#include "stream.h"
+#include "measure.h"
+
+// Microbenchmarks of every pipeline stage on the bundled datasets and on copies
+// scaled up by jittered repetition. Each benchmark runs a few warmup rounds and
+// then a number of timed repetitions; the median and the median absolute
+// deviation of the repetitions are reported on stdout and as JSON lines.
+//
+// A run can be saved as a baseline and later runs compared with it: a benchmark
+// regressed if the Mann-Whitney U test says its repetitions are slower than the
+// baseline's at level --alpha and the medians differ by more than its noise
+// threshold, the larger of --threshold and three relative MADs of either run.
+// The comparison exits with status 2 if any benchmark regressed.
+
+// bumped when the meaning or layout of a baseline changes; other versions are refused
+static const int BASELINE_VERSION = 1;
+
+// relative median absolute deviations a change must exceed to count
+static const double NOISE_MADS = 3.0;
+
+// the smallest sample ALGLIB's mannwhitneyutest accepts
+static const size_t MIN_TEST_SAMPLES = 5;
+
+struct BenchOptions {
+    size_t warmup;
+    size_t repetitions;
+    std::vector<size_t> scales;
+    size_t maxRows;          // variants with more rows skip the quadratic nearest neighbor benchmarks
+    std::string filter;      // only benchmarks whose name contains it
+    std::string output;
+    std::string saveBaseline;
+    std::string compareBaseline;
+    double threshold;        // smallest relative change of the median that counts
+    double alpha;            // significance level of the Mann-Whitney test
+
+    BenchOptions() : warmup(1), repetitions(7), maxRows(20000), output("bench-results.json"), threshold(0.05), alpha(0.01) {}
+};
+
+struct BenchResult {
+    std::string dataset;
+    std::string benchmark;
+    size_t rows;
+    size_t items;
+    std::vector<double> samples;   // milliseconds per repetition
+};
+
+struct BenchDataset {
+    std::string name;
+    std::vector<ClassMember> rows;
+    std::function<size_t()> nativeParse;   // the dataset's own reader on the original file, rows read
+};
+
+static double medianDeviation(const std::vector<double>& values) {
+    double middle = median(values);
+    std::vector<double> deviations;
+    for (double value : values) {
+        deviations.push_back(std::fabs(value - middle));
+    }
+    return median(deviations);
+}
+
+static void writeSamples(FILE* out, const std::vector<double>& samples) {
+    fprintf(out, "[");
+    for (size_t i = 0; i < samples.size(); ++i) {
+        fprintf(out, "%s%.6f", i ? ", " : "", samples[i]);
+    }
+    fprintf(out, "]");
+}
+
+class BenchRunner {
+public:
+    BenchRunner(const BenchOptions& options, FILE* out) : options(options), out(out) {}
+
+    // time body, which processes items items per call
+    void run(const std::string& dataset, const std::string& benchmark, size_t rows, size_t items, std::function<void()> body) {
+        std::string name = dataset + "/" + benchmark;
+        if (name.find(options.filter) == std::string::npos) {
+            return;
+        }
+        for (size_t i = 0; i < options.warmup; ++i) {
+            body();
+        }
+        std::vector<double> seconds;
+        for (size_t i = 0; i < options.repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        double middle = median(seconds);
+        double mad = medianDeviation(seconds);
+        double fastest = *std::min_element(seconds.begin(), seconds.end());
+        BenchResult result = {dataset, benchmark, rows, items, std::vector<double>()};
+        for (double value : seconds) {
+            result.samples.push_back(value * 1e3);
+        }
+        results.push_back(result);
+
+        printf("%-22s %-22s %8zu %10zu %12.3f %10.3f %12.3f %10.1f\n", dataset.c_str(), benchmark.c_str(), rows, items,
+               middle * 1e3, mad * 1e3, fastest * 1e3, middle * 1e9 / std::max<size_t>(1, items));
+        fprintf(out, "{\"dataset\": \"%s\", \"benchmark\": \"%s\", \"rows\": %zu, \"items\": %zu, \"warmup\": %zu, "
+                     "\"repetitions\": %zu, \"median_ms\": %.6f, \"mad_ms\": %.6f, \"min_ms\": %.6f, \"ns_per_item\": %.3f, "
+                     "\"samples_ms\": ",
+                dataset.c_str(), benchmark.c_str(), rows, items, options.warmup, options.repetitions, middle * 1e3,
+                mad * 1e3, fastest * 1e3, middle * 1e9 / std::max<size_t>(1, items));
+        writeSamples(out, result.samples);
+        fprintf(out, "}\n");
+        fflush(out);
+    }
+
+    const std::vector<BenchResult>& completed() const { return results; }
+
+private:
+    const BenchOptions& options;
+    FILE* out;
+    std::vector<BenchResult> results;
+};
+
+// one header line, then one result per line, so readBaseline needs no JSON parser
+static bool saveBaseline(const std::string& filename, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        perror(filename.c_str());
+        return false;
+    }
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    fprintf(file, "{\"format\": \"cpv-bench-baseline\", \"version\": %d, \"created\": %lld, \"host\": \"%s\", "
+                  "\"warmup\": %zu, \"repetitions\": %zu, \"results\": [\n",
+            BASELINE_VERSION, static_cast<long long>(time(nullptr)), host, options.warmup, options.repetitions);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        fprintf(file, "{\"dataset\": \"%s\", \"benchmark\": \"%s\", \"rows\": %zu, \"items\": %zu, \"median_ms\": %.6f, "
+                      "\"mad_ms\": %.6f, \"samples_ms\": ",
+                result.dataset.c_str(), result.benchmark.c_str(), result.rows, result.items, median(result.samples),
+                medianDeviation(result.samples));
+        writeSamples(file, result.samples);
+        fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return true;
+}
+
+// the string value of key in a line written by saveBaseline, empty if absent
+static std::string stringField(const std::string& line, const std::string& key) {
+    std::string marker = "\"" + key + "\": \"";
+    size_t begin = line.find(marker);
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    begin += marker.size();
+    return line.substr(begin, line.find('"', begin) - begin);
+}
+
+static bool readBaseline(const std::string& filename, std::vector<BenchResult>& results) {
+    std::ifstream file(filename);
+    std::string line;
+    if (!std::getline(file, line) || stringField(line, "format") != "cpv-bench-baseline") {
+        fprintf(stderr, "%s: not a cpv-bench baseline\n", filename.c_str());
+        return false;
+    }
+    size_t version = line.find("\"version\": ");
+    int found = version == std::string::npos ? 0 : atoi(line.c_str() + version + 11);
+    if (found != BASELINE_VERSION) {
+        fprintf(stderr, "%s: baseline version %d, this cpv_bench reads version %d; save a new baseline\n", filename.c_str(),
+                found, BASELINE_VERSION);
+        return false;
+    }
+    while (std::getline(file, line)) {
+        size_t samples = line.find("\"samples_ms\": [");
+        if (samples == std::string::npos) {
+            continue;
+        }
+        BenchResult result;
+        result.dataset = stringField(line, "dataset");
+        result.benchmark = stringField(line, "benchmark");
+        result.rows = result.items = 0;
+        const char* cursor = line.c_str() + samples + 15;
+        while (*cursor && *cursor != ']') {
+            char* end;
+            double value = strtod(cursor, &end);
+            if (end == cursor) {
+                break;
+            }
+            result.samples.push_back(value);
+            cursor = end;
+            while (*cursor == ',' || *cursor == ' ') {
+                ++cursor;
+            }
+        }
+        if (!result.samples.empty()) {
+            results.push_back(result);
+        }
+    }
+    return true;
+}
+
+// number of regressions; every benchmark of the run is listed with its verdict
+static size_t compareBaseline(const BenchOptions& options, const std::vector<BenchResult>& baseline,
+                              const std::vector<BenchResult>& current) {
+    printf("\ncomparison with %s (alpha %g, threshold %.1f%%, noise %.0f MADs)\n", options.compareBaseline.c_str(),
+           options.alpha, options.threshold * 100, NOISE_MADS);
+    printf("%-22s %-22s %12s %12s %9s %9s %9s  %s\n", "dataset", "benchmark", "base(ms)", "now(ms)", "change", "noise",
+           "p", "verdict");
+    size_t regressions = 0, matched = 0;
+    for (const auto& result : current) {
+        const BenchResult* base = nullptr;
+        for (const auto& candidate : baseline) {
+            if (candidate.dataset == result.dataset && candidate.benchmark == result.benchmark) {
+                base = &candidate;
+            }
+        }
+        if (!base) {
+            printf("%-22s %-22s %12s %12.3f %9s %9s %9s  new\n", result.dataset.c_str(), result.benchmark.c_str(), "-",
+                   median(result.samples), "-", "-", "-");
+            continue;
+        }
+        ++matched;
+        double before = median(base->samples), now = median(result.samples);
+        double change = before > 0 ? now / before - 1 : 0;
+        double noise = options.threshold;
+        if (before > 0 && now > 0) {
+            noise = std::max(noise, NOISE_MADS * std::max(medianDeviation(base->samples) / before, medianDeviation(result.samples) / now));
+        }
+        const char* verdict = "same";
+        double p = 1;
+        if (result.samples.size() < MIN_TEST_SAMPLES || base->samples.size() < MIN_TEST_SAMPLES) {
+            verdict = "too few repetitions to test";
+        } else {
+            // right tail: the null hypothesis is that the current median is at most the baseline's
+            alglib::real_1d_array x, y;
+            x.setcontent(result.samples.size(), result.samples.data());
+            y.setcontent(base->samples.size(), base->samples.data());
+            double bothTails, leftTail, rightTail;
+            alglib::mannwhitneyutest(x, x.length(), y, y.length(), bothTails, leftTail, rightTail);
+            if (change > noise && rightTail < options.alpha) {
+                verdict = "REGRESSION";
+                p = rightTail;
+                ++regressions;
+            } else if (change < -noise && leftTail < options.alpha) {
+                verdict = "improved";
+                p = leftTail;
+            } else {
+                p = bothTails;
+            }
+        }
+        printf("%-22s %-22s %12.3f %12.3f %+8.1f%% %8.1f%% %9.4f  %s\n", result.dataset.c_str(), result.benchmark.c_str(),
+               before, now, change * 100, noise * 100, p, verdict);
+    }
+    printf("%zu benchmarks compared, %zu regressions, %zu in the baseline not run\n", matched, regressions,
+           baseline.size() - std::min(baseline.size(), matched));
+    return regressions;
+}
+
+// AirQualityUCI.csv has no class column: the month is the class, features missing
+// in most rows are dropped, then the rows still missing a value
+static std::vector<ClassMember> readAirQuality(const std::string& filename) {
+    std::ifstream file(filename);
+    std::vector<StreamRow> rows;
+    StreamRow row;
+    while (readAirQualityRow(file, row)) {
+        rows.push_back(row);
+    }
+    std::vector<ClassMember> dataset;
+    if (rows.empty()) {
+        return dataset;
+    }
+    std::vector<size_t> keep;
+    for (size_t f = 0; f < rows[0].features.size(); ++f) {
+        size_t missing = 0;
+        for (const auto& r : rows) {
+            missing += f >= r.features.size() || std::isnan(r.features[f]);
+        }
+        if (missing * 2 < rows.size()) {
+            keep.push_back(f);
+        }
+    }
+    for (const auto& r : rows) {
+        ClassMember member;
+        for (size_t f : keep) {
+            if (f >= r.features.size() || std::isnan(r.features[f])) {
+                break;
+            }
+            member.features.push_back(r.features[f]);
+        }
+        if (member.features.size() == keep.size()) {
+            member.name = "month " + r.label.substr(3, 2);
+            dataset.push_back(member);
+        }
+    }
+    return dataset;
+}
+
+// the rows in the format readDataset reads: comma separated features, then the class
+static void writeIrisFormat(const std::vector<ClassMember>& rows, const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    for (const auto& row : rows) {
+        for (double value : row.features) {
+            fprintf(file, "%.17g,", value);
+        }
+        fprintf(file, "%s\n", row.name.c_str());
+    }
+    fclose(file);
+}
+
+static void benchDataset(BenchRunner& runner, const BenchOptions& options, const BenchDataset& dataset, size_t scale) {
+    std::vector<ClassMember> rows = jitteredCopies(dataset.rows, scale);
+    std::string name = dataset.name + (scale > 1 ? " x" + std::to_string(scale) : "");
+    size_t n = rows.size();
+
+    if (scale == 1) {
+        runner.run(name, "native parser", n, n, [&] { dataset.nativeParse(); });
+    }
+    char temporary[] = "/tmp/cpv-bench-XXXXXX";
+    int fd = mkstemp(temporary);
+    if (fd >= 0) {
+        close(fd);
+        writeIrisFormat(rows, temporary);
+        runner.run(name, "readDataset", n, n, [&] { readDataset(temporary); });
+        unlink(temporary);
+    }
+
+    std::vector<ClassMember> normalized = rows;
+    runner.run(name, "normalizeFeatures", n, n, [&] {
+        normalized = rows;
+        normalizeFeatures(normalized);
+    });
+
+    // consecutive row pairs, enough calls to be well above the timer resolution
+    size_t calls = std::max<size_t>(n, 100000);
+    double checksum = 0;
+    runner.run(name, "euclideanDistance", n, calls, [&] {
+        for (size_t i = 0; i < calls; ++i) {
+            checksum += euclideanDistance(normalized[i % n].features, normalized[(i + 1) % n].features);
+        }
+    });
+
+    if (n > options.maxRows) {
+        printf("%-22s skipping nearest neighbors and fits: %zu rows > --max-rows %zu\n", name.c_str(), n, options.maxRows);
+        return;
+    }
+    std::vector<double> distances;
+    runner.run(name, "computeNNDistances", n, n, [&] { distances = computeNearestNeighborDistances(normalized); });
+
+    std::vector<double> sorted;
+    runner.run(name, "sort/unique", n, distances.size(), [&] {
+        sorted = distances;
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    });
+
+    // every family fitted on its own from the default start values
+    std::vector<double> y = ecdfValues(sorted.size());
+    size_t familyCount;
+    const SigmoidFamily* families = sigmoidFamilies(familyCount);
+    for (size_t i = 0; sorted.size() >= 2 && i < familyCount; ++i) {
+        runner.run(name, std::string("lsfit ") + families[i].key, n, sorted.size(), [&] {
+            try {
+                fitAllFamilies(sorted, y, 1u << i);
+            } catch (alglib::ap_error alglib_exception) {
+                // the timing of a failed fit is still the cost of the attempt
+            }
+        });
+    }
+    if (checksum < 0) {
+        printf("%g\n", checksum);  // keeps the distance loop from being optimized away
+    }
+}
+
+static std::vector<size_t> parseScales(const std::string& value) {
+    std::vector<size_t> scales;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        size_t end = value.find(',', begin);
+        end = end == std::string::npos ? value.size() : end;
+        scales.push_back(std::max(1ul, std::stoul(value.substr(begin, end - begin))));
+        begin = end + 1;
+    }
+    return scales;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--warmup") {
+            options.warmup = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            options.repetitions = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--scales") {
+            options.scales = parseScales(argv[++i]);
+        } else if (i + 1 < argc && arg == "--max-rows") {
+            options.maxRows = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (i + 1 < argc && arg == "--output") {
+            options.output = argv[++i];
+        } else if (i + 1 < argc && arg == "--save-baseline") {
+            options.saveBaseline = argv[++i];
+        } else if (i + 1 < argc && arg == "--compare") {
+            options.compareBaseline = argv[++i];
+        } else if (i + 1 < argc && arg == "--threshold") {
+            options.threshold = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--alpha") {
+            options.alpha = std::stod(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--warmup n] [--repetitions n] [--scales 1,4,...] [--max-rows n] [--filter text] [--output file]\n"
+                            "          [--save-baseline file] [--compare baseline [--threshold fraction] [--alpha p]]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::vector<BenchResult> baseline;
+    if (!options.compareBaseline.empty() && !readBaseline(options.compareBaseline, baseline)) {
+        return 1;
+    }
+    if (options.scales.empty()) {
+        options.scales.push_back(1);
+        options.scales.push_back(4);
+    }
+
+    TableFormat glassFormat;
+    glassFormat.skipColumns.push_back(0);
+    const std::string iris = "iris.data";
+    const std::string glass = "test datasets/glass identification/glass.data";
+    const std::string wineRed = "test datasets/wine quality/winequality-red.csv";
+    const std::string wineWhite = "test datasets/wine quality/winequality-white.csv";
+    const std::string airQuality = "test datasets/air quality/AirQualityUCI.csv";
+
+    std::vector<BenchDataset> datasets(5);
+    datasets[0].name = "iris";
+    datasets[0].nativeParse = [&] { return readDataset(iris).size(); };
+    datasets[1].name = "glass";
+    datasets[1].nativeParse = [&] { return readTable(glass, glassFormat).size(); };
+    datasets[2].name = "wine-red";
+    datasets[2].nativeParse = [&] { return readTable(wineRed, TableFormat()).size(); };
+    datasets[3].name = "wine-white";
+    datasets[3].nativeParse = [&] { return readTable(wineWhite, TableFormat()).size(); };
+    datasets[4].name = "air-quality";
+    datasets[4].nativeParse = [&] { return readAirQuality(airQuality).size(); };
+    datasets[0].rows = readDataset(iris);
+    datasets[1].rows = readTable(glass, glassFormat);
+    datasets[2].rows = readTable(wineRed, TableFormat());
+    datasets[3].rows = readTable(wineWhite, TableFormat());
+    datasets[4].rows = readAirQuality(airQuality);
+
+    FILE* out = fopen(options.output.c_str(), "w");
+    if (!out) {
+        perror(options.output.c_str());
+        return 1;
+    }
+    BenchRunner runner(options, out);
+    printf("%-22s %-22s %8s %10s %12s %10s %12s %10s\n", "dataset", "benchmark", "rows", "items", "median(ms)", "mad(ms)",
+           "min(ms)", "ns/item");
+    for (size_t scale : options.scales) {
+        for (const auto& dataset : datasets) {
+            if (dataset.rows.empty()) {
+                fprintf(stderr, "%s: no rows, skipped\n", dataset.name.c_str());
+                continue;
+            }
+            benchDataset(runner, options, dataset, scale);
+        }
+    }
+    fclose(out);
+    printf("results in %s\n", options.output.c_str());
+    if (!options.saveBaseline.empty()) {
+        if (!saveBaseline(options.saveBaseline, options, runner.completed())) {
+            return 1;
+        }
+        printf("baseline saved to %s\n", options.saveBaseline.c_str());
+    }
+    if (!options.compareBaseline.empty() && compareBaseline(options, baseline, runner.completed()) > 0) {
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+#include "calibrate.h"
+#include "dataset.h"
+#include "fit.h"
+#include "process.h"
+#include "measure.h"
+#include "parallel.h"
+#include "trace.h"
+
+static CalibrationSummary summarize(const std::vector<double>& pValues, size_t bins) {
+    CalibrationSummary summary;
+    std::vector<double> scored;
+    summary.histogram.assign(bins, 0);
+    for (double p : pValues) {
+        if (p == p) {
+            scored.push_back(p);
+            ++summary.histogram[std::min(bins - 1, static_cast<size_t>(p * bins))];
+        }
+    }
+    summary.ksStatistic = kolmogorovSmirnovUniform(scored, summary.ksPValue);
+    return summary;
+}
+
+CalibrationResult leaveOneOutCalibration(const ModelView& model, size_t threads, size_t bins) {
+    TRACE_SPAN("stage", "leaveOneOutCalibration");
+    ClassNeighbors neighbors = classNearestNeighbors(model, 2, threads);
+    size_t n = model.rows;
+    const double* first = &neighbors.distances[0];
+
+    // the curve of each class before any downdate, sorted unique distances up to the
+    // cutoff as classCurve builds it, with the number of rows at each distance
+    std::vector<double> curves;
+    std::vector<long> multiplicities;
+    std::vector<size_t> curveOffsets(1, 0);
+    for (size_t c = 0; c < model.classCount; ++c) {
+        std::vector<double> distances;
+        for (uint64_t i = model.classOffsets[c]; i < model.classOffsets[c + 1]; ++i) {
+            if (first[2 * i] <= NN_DISTANCE_CUTOFF) {
+                distances.push_back(first[2 * i]);
+            }
+        }
+        std::sort(distances.begin(), distances.end());
+        for (size_t i = 0; i < distances.size(); ++i) {
+            if (i == 0 || distances[i] != distances[i - 1]) {
+                curves.push_back(distances[i]);
+                multiplicities.push_back(0);
+            }
+            ++multiplicities.back();
+        }
+        curveOffsets.push_back(curves.size());
+    }
+
+    // rows whose nearest neighbor is row i, as offsets into reverse
+    std::vector<size_t> reverseOffsets(n + 1, 0);
+    for (size_t j = 0; j < n; ++j) {
+        if (first[2 * j] < std::numeric_limits<double>::infinity()) {
+            ++reverseOffsets[neighbors.indices[2 * j] + 1];
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        reverseOffsets[i + 1] += reverseOffsets[i];
+    }
+    std::vector<uint32_t> reverse(reverseOffsets[n]);
+    std::vector<size_t> filled(reverseOffsets.begin(), reverseOffsets.end() - 1);
+    for (size_t j = 0; j < n; ++j) {
+        if (first[2 * j] < std::numeric_limits<double>::infinity()) {
+            reverse[filled[neighbors.indices[2 * j]]++] = static_cast<uint32_t>(j);
+        }
+    }
+
+    size_t familyCount;
+    const SigmoidFamily* families = sigmoidFamilies(familyCount);
+    CalibrationResult result;
+    result.pValues.assign(n, std::numeric_limits<double>::quiet_NaN());
+    result.empiricalPValues.assign(n, std::numeric_limits<double>::quiet_NaN());
+    std::vector<char> refitted(n, 0);
+    parallelFor(n, threads, [&](size_t begin, size_t end) {
+        size_t c = std::upper_bound(model.classOffsets, model.classOffsets + model.classCount + 1, begin) - model.classOffsets - 1;
+        std::vector<std::pair<double, long> > changes;
+        std::vector<double> curve;
+        for (size_t i = begin; i < end; ++i) {
+            while (i >= model.classOffsets[c + 1]) {
+                ++c;
+            }
+            double x = first[2 * i];
+            if (x == std::numeric_limits<double>::infinity()) {
+                continue;  // the only row of its class
+            }
+
+            // downdate: the row's own distance leaves the curve, and rows that had it
+            // as nearest neighbor fall back to their second one
+            changes.clear();
+            if (x <= NN_DISTANCE_CUTOFF) {
+                changes.push_back(std::make_pair(x, -1L));
+            }
+            for (size_t r = reverseOffsets[i]; r < reverseOffsets[i + 1]; ++r) {
+                size_t j = reverse[r];
+                if (first[2 * j] <= NN_DISTANCE_CUTOFF) {
+                    changes.push_back(std::make_pair(first[2 * j], -1L));
+                }
+                if (first[2 * j + 1] <= NN_DISTANCE_CUTOFF) {
+                    changes.push_back(std::make_pair(first[2 * j + 1], 1L));
+                }
+            }
+            std::sort(changes.begin(), changes.end());
+            size_t merged = 0;
+            for (size_t k = 0; k < changes.size(); ++k) {
+                if (merged > 0 && changes[merged - 1].first == changes[k].first) {
+                    changes[merged - 1].second += changes[k].second;
+                } else {
+                    changes[merged++] = changes[k];
+                }
+            }
+            changes.resize(merged);
+
+            // a distance enters or leaves the unique curve only when its row count
+            // becomes or stops being zero
+            const double* curveBegin = curves.data() + curveOffsets[c];
+            const double* curveEnd = curves.data() + curveOffsets[c + 1];
+            long size = curveEnd - curveBegin;
+            long count = curveEnd - std::lower_bound(curveBegin, curveEnd, x);
+            for (const auto& change : changes) {
+                const double* found = std::lower_bound(curveBegin, curveEnd, change.first);
+                long before = found != curveEnd && *found == change.first ? multiplicities[found - curves.data()] : 0;
+                long after = before + change.second;
+                if (before > 0 && after == 0) {
+                    --size;
+                    count -= change.first >= x;
+                } else if (before == 0 && after > 0) {
+                    ++size;
+                    count += change.first >= x;
+                }
+            }
+            double empirical = static_cast<double>(count + 1) / (size + 1);
+            result.empiricalPValues[i] = empirical;
+            result.pValues[i] = empirical;
+
+            int32_t family = model.fitFamilies[c];
+            if (family < 0) {
+                continue;
+            }
+            double fitC = model.fitParams[2 * c], fitA = model.fitParams[2 * c + 1];
+
+            // the downdated curve itself, to refit the class's family from the model's parameters
+            curve.clear();
+            size_t k = 0;
+            for (const double* value = curveBegin; value != curveEnd; ++value) {
+                for (; k < changes.size() && changes[k].first < *value; ++k) {
+                    if (changes[k].second > 0) {
+                        curve.push_back(changes[k].first);
+                    }
+                }
+                long rows = multiplicities[value - curves.data()];
+                if (k < changes.size() && changes[k].first == *value) {
+                    rows += changes[k++].second;
+                }
+                if (rows > 0) {
+                    curve.push_back(*value);
+                }
+            }
+            for (; k < changes.size(); ++k) {
+                if (changes[k].second > 0) {
+                    curve.push_back(changes[k].first);
+                }
+            }
+            if (curve.size() >= 2) {
+                try {
+                    FitResult refit = refitFamily(curve, ecdfValues(curve.size()), families[family], fitC, fitA);
+                    fitC = refit.c[0];
+                    fitA = refit.c[1];
+                    refitted[i] = 1;
+                } catch (alglib::ap_error) {
+                    // keep the class fit
+                }
+            }
+            result.pValues[i] = sigmoidPValue(families[family], fitC, fitA, x);
+        }
+    });
+
+    result.fitted = summarize(result.pValues, bins);
+    result.empirical = summarize(result.empiricalPValues, bins);
+    result.scored = 0;
+    for (double p : result.pValues) {
+        result.scored += p == p;
+    }
+    result.refits = std::count(refitted.begin(), refitted.end(), 1);
+    return result;
+}
+
+double kolmogorovSmirnovUniform(std::vector<double> values, double& pValue) {
+    pValue = 1;
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    double n = values.size();
+    double statistic = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        statistic = std::max(statistic, std::max((i + 1) / n - values[i], values[i] - i / n));
+    }
+
+    // asymptotic Kolmogorov distribution with the Stephens small-sample correction
+    double lambda = (std::sqrt(n) + 0.12 + 0.11 / std::sqrt(n)) * statistic;
+    double sum = 0, sign = 1;
+    for (int k = 1; k <= 100; ++k) {
+        double term = sign * std::exp(-2.0 * k * k * lambda * lambda);
+        sum += term;
+        if (std::fabs(term) < 1e-12) {
+            break;
+        }
+        sign = -sign;
+    }
+    pValue = std::min(1.0, std::max(0.0, 2 * sum));
+    if (lambda < 0.2) {
+        pValue = 1;  // the series does not converge near 0
+    }
+    return statistic;
+}
+
+static void printSummary(const char* title, const CalibrationSummary& summary) {
+    size_t bins = summary.histogram.size();
+    printf("%s\n", title);
+    size_t largest = *std::max_element(summary.histogram.begin(), summary.histogram.end());
+    for (size_t b = 0; b < bins; ++b) {
+        printf("[%.2f, %.2f) %6zu ", static_cast<double>(b) / bins, static_cast<double>(b + 1) / bins, summary.histogram[b]);
+        size_t width = largest ? summary.histogram[b] * 50 / largest : 0;
+        printf("%s\n", std::string(width, '#').c_str());
+    }
+    printf("KS statistic vs uniform: %g p-value: %g\n", summary.ksStatistic, summary.ksPValue);
+}
+
+int runCalibration(const std::string& filename, size_t threads, size_t bins) {
+    std::vector<ClassMember> dataset = readDataset(filename);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    Model model = trainModel(dataset);
+    ModelView view = viewOf(model);
+
+    auto start = std::chrono::steady_clock::now();
+    CalibrationResult result = leaveOneOutCalibration(view, threads, bins);
+    double seconds = secondsSince(start);
+
+    printf("Leave-one-out p-values of %zu rows (%zu threads, %.3f ms, %zu refitted)\n", result.scored, threads,
+           seconds * 1e3, result.refits);
+    printSummary("served: the class family refitted to the downdated curve, empirical without a fit", result.fitted);
+    printSummary("empirical: the downdated curve table alone", result.empirical);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <vector>
+#include <string>
+
+#include "model.h"
+
+// histogram and uniformity test of one set of p-values
+struct CalibrationSummary {
+    std::vector<size_t> histogram;    // counts of the p-values in equal-width bins over [0, 1]
+    double ksStatistic;               // Kolmogorov-Smirnov distance to the uniform distribution
+    double ksPValue;
+};
+
+struct CalibrationResult {
+    std::vector<double> pValues;            // leave-one-out p-value as the model serves it, NaN for singleton classes
+    std::vector<double> empiricalPValues;   // from the downdated curve table alone
+    CalibrationSummary fitted;
+    CalibrationSummary empirical;
+    size_t scored;
+    size_t refits;                          // rows scored by a refitted sigmoid
+};
+
+// Leave-one-out p-value of every training row under its own class with the row
+// removed, from one all-NN pass. The class curve, sorted unique distances up to the
+// cutoff as classCurve builds it, is downdated by dropping the row's own distance and
+// moving every row whose nearest neighbor it was to its second one. The empirical
+// p-value is the fraction of that curve at least as large, as classPValue gives
+// without a fit; the served one refits the class's family to the downdated curve
+// from the model's parameters and falls back to the empirical value without a fit.
+CalibrationResult leaveOneOutCalibration(const ModelView& model, size_t threads, size_t bins);
+
+// one-sample Kolmogorov-Smirnov test against Uniform(0, 1)
+double kolmogorovSmirnovUniform(std::vector<double> values, double& pValue);
+
+int runCalibration(const std::string& filename, size_t threads, size_t bins);
+
+#endif
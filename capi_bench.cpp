@@ -0,0 +1,139 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "pidentify.h"
+#include "dataset.h"
+
+// count every heap allocation in the process, including the ones made inside the library
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    ++allocations;
+    void* memory = malloc(size ? size : 1);
+    if (memory == NULL) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+// every thread sets up before any starts scoring and tears down after all have stopped
+static std::atomic<size_t> arrived(0);
+
+static void barrier(size_t threads, size_t generation) {
+    ++arrived;
+    while (arrived.load() < threads * generation) {
+        std::this_thread::yield();
+    }
+}
+
+struct ThreadResult {
+    size_t calls;
+    size_t allocations;
+    std::vector<double> latencies;
+};
+
+static void scoringThread(const pid_model* model, const std::vector<double>& rows, size_t batch, double seconds, size_t threads, ThreadResult& result) {
+    size_t dim = pid_model_dim(model);
+    size_t classes = pid_model_class_count(model);
+    size_t available = rows.size() / dim;
+    std::vector<double> pValues(batch * classes);
+    std::vector<double> queries(batch * dim);
+    for (size_t i = 0; i < batch; ++i) {
+        std::copy(&rows[(i % available) * dim], &rows[(i % available) * dim] + dim, &queries[i * dim]);
+    }
+    result.latencies.reserve(1 << 20);
+
+    pid_context* context = pid_context_create(model);
+    pid_score_batch(context, queries.data(), batch, pValues.data(), NULL);  // warmup
+
+    // allocations are counted process-wide, so every thread reports what happened while all were scoring
+    barrier(threads, 1);
+    size_t before = allocations.load();
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    result.calls = 0;
+    while (std::chrono::steady_clock::now() < end && result.latencies.size() < result.latencies.capacity()) {
+        auto start = std::chrono::steady_clock::now();
+        pid_score_batch(context, queries.data(), batch, pValues.data(), NULL);
+        result.latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        ++result.calls;
+    }
+    barrier(threads, 2);
+    result.allocations = allocations.load() - before;
+    barrier(threads, 3);
+    pid_context_destroy(context);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model queries.data [--threads n] [--batch rows] [--seconds s]\n", argv[0]);
+        return 1;
+    }
+    size_t threads = 1, batch = 64;
+    double seconds = 2;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--threads") {
+            threads = std::max(1ul, std::stoul(argv[i + 1]));
+        } else if (arg == "--batch") {
+            batch = std::max(1ul, std::stoul(argv[i + 1]));
+        } else if (arg == "--seconds") {
+            seconds = std::stod(argv[i + 1]);
+        }
+    }
+
+    pid_model* model;
+    int status = pid_model_open(argv[1], &model);
+    if (status != PID_OK) {
+        fprintf(stderr, "%s: %s\n", argv[1], pid_error_string(status));
+        return 1;
+    }
+
+    std::vector<double> rows;
+    for (const auto& member : readDataset(argv[2])) {
+        if (member.features.size() == pid_model_dim(model)) {
+            rows.insert(rows.end(), member.features.begin(), member.features.end());
+        }
+    }
+    if (rows.empty()) {
+        fprintf(stderr, "No rows of %zu features in %s\n", pid_model_dim(model), argv[2]);
+        return 1;
+    }
+
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        workers.push_back(std::thread(scoringThread, model, std::cref(rows), batch, seconds, threads, std::ref(results[t])));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    size_t calls = 0, allocated = 0;
+    std::vector<double> latencies;
+    for (const auto& result : results) {
+        calls += result.calls;
+        allocated = std::max(allocated, result.allocations);
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("threads %zu batch %zu calls %zu rows/s %.0f\n", threads, batch, calls, calls * batch / seconds);
+    printf("per-call latency (us): p50 %.2f p99 %.2f max %.2f\n", latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100], latencies.back());
+    printf("heap allocations during steady-state scoring: %zu\n", allocated);
+
+    pid_model_close(model);
+    return 0;
+}
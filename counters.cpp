@@ -0,0 +1,349 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "counters.h"
+#include "stage.h"
+
+enum CounterEvent { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, L1D_MISSES, FP_SCALAR, FP_PACKED, DTLB_LOADS,
+                    DTLB_MISSES, EVENT_COUNT };
+
+static const char* const EVENT_NAMES[EVENT_COUNT] = {"cycles", "instructions", "cache-misses", "branch-misses",
+                                                     "L1-dcache-load-misses", "fp_arith_inst_retired.scalar_double",
+                                                     "fp_arith_inst_retired.packed_double", "dTLB-loads", "dTLB-load-misses"};
+
+// the events of one group, the first is its leader
+static const CounterEvent GROUPS[3][4] = {{CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES},
+                                          {L1D_MISSES, FP_SCALAR, FP_PACKED, EVENT_COUNT},
+                                          {DTLB_LOADS, DTLB_MISSES, EVENT_COUNT, EVENT_COUNT}};
+static const size_t GROUP_COUNT = 3;
+static const size_t MAX_DEPTH = 64;   // nested stages of one thread with counts
+
+struct EventConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+static bool intelCpu() {
+    FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (!cpuinfo) {
+        return false;
+    }
+    char line[256];
+    bool intel = false;
+    while (fgets(line, sizeof(line), cpuinfo)) {
+        if (strncmp(line, "vendor_id", 9) == 0) {
+            intel = strstr(line, "GenuineIntel") != nullptr;
+            break;
+        }
+    }
+    fclose(cpuinfo);
+    return intel;
+}
+
+// false for an event this CPU has no encoding for
+static bool eventConfig(CounterEvent event, EventConfig& result) {
+    static const bool intel = intelCpu();
+    switch (event) {
+    case CYCLES:
+        result = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+        return true;
+    case INSTRUCTIONS:
+        result = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+        return true;
+    case CACHE_MISSES:
+        result = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+        return true;
+    case BRANCH_MISSES:
+        result = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES};
+        return true;
+    case L1D_MISSES:
+        result = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+        return true;
+    case FP_SCALAR:
+        // FP_ARITH_INST_RETIRED (event 0xc7) since Broadwell, umask scalar double
+        result = {PERF_TYPE_RAW, 0x01c7};
+        return intel;
+    case FP_PACKED:
+        // umasks 128-bit, 256-bit and 512-bit packed double
+        result = {PERF_TYPE_RAW, 0x54c7};
+        return intel;
+    case DTLB_LOADS:
+        result = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16)};
+        return true;
+    case DTLB_MISSES:
+        result = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+        return true;
+    default:
+        return false;
+    }
+}
+
+// one read of every group: per event its count, per group the time it was enabled and running
+struct CounterReading {
+    uint64_t values[EVENT_COUNT];
+    uint64_t enabled[GROUP_COUNT];
+    uint64_t running[GROUP_COUNT];
+};
+
+struct ThreadCounters {
+    bool opened;
+    int leaders[GROUP_COUNT];
+    int fds[EVENT_COUNT];
+    uint64_t ids[EVENT_COUNT];
+    CounterReading stack[MAX_DEPTH];
+    size_t depth;
+
+    ThreadCounters() : opened(false), depth(0) {
+        for (size_t g = 0; g < GROUP_COUNT; ++g) {
+            leaders[g] = -1;
+        }
+        for (size_t e = 0; e < EVENT_COUNT; ++e) {
+            fds[e] = -1;
+        }
+    }
+    ~ThreadCounters() {
+        for (size_t e = 0; e < EVENT_COUNT; ++e) {
+            if (fds[e] >= 0) {
+                close(fds[e]);
+            }
+        }
+    }
+};
+
+static thread_local ThreadCounters threadCounters;
+
+// scaled counts per stage and event, and whether any thread could open the event
+static std::atomic<uint64_t> stageCounts[MAX_STAGES][EVENT_COUNT];
+static std::atomic<bool> eventOpened[EVENT_COUNT];
+static std::atomic<int> openError(0);
+static std::atomic<uint64_t> unbalanced(0);   // stages left deeper than MAX_DEPTH
+
+static int openEvent(CounterEvent event, int groupFd) {
+    EventConfig config;
+    if (!eventConfig(event, config)) {
+        return -1;
+    }
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = config.type;
+    attr.config = config.config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;   // allowed up to perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.disabled = groupFd < 0;
+    // this thread on any CPU
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+    if (fd < 0) {
+        int expected = 0;
+        openError.compare_exchange_strong(expected, errno);
+    }
+    return fd;
+}
+
+static void openThreadCounters(ThreadCounters& counters) {
+    counters.opened = true;
+    for (size_t g = 0; g < GROUP_COUNT; ++g) {
+        for (size_t i = 0; i < 4 && GROUPS[g][i] != EVENT_COUNT; ++i) {
+            CounterEvent event = GROUPS[g][i];
+            // an event that does not open is left out, the first one that does leads the group
+            int fd = openEvent(event, counters.leaders[g]);
+            if (fd < 0) {
+                continue;
+            }
+            ioctl(fd, PERF_EVENT_IOC_ID, &counters.ids[event]);
+            counters.fds[event] = fd;
+            eventOpened[event] = true;
+            if (counters.leaders[g] < 0) {
+                counters.leaders[g] = fd;
+            }
+        }
+        if (counters.leaders[g] >= 0) {
+            ioctl(counters.leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(counters.leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+}
+
+static void readThreadCounters(const ThreadCounters& counters, CounterReading& reading) {
+    memset(&reading, 0, sizeof(reading));
+    for (size_t g = 0; g < GROUP_COUNT; ++g) {
+        if (counters.leaders[g] < 0) {
+            continue;
+        }
+        // nr, time enabled, time running, then a value and id per event
+        uint64_t data[3 + 2 * EVENT_COUNT];
+        if (read(counters.leaders[g], data, sizeof(data)) <= 0) {
+            continue;
+        }
+        reading.enabled[g] = data[1];
+        reading.running[g] = data[2];
+        for (uint64_t i = 0; i < data[0] && i < EVENT_COUNT; ++i) {
+            for (size_t e = 0; e < EVENT_COUNT; ++e) {
+                if (counters.fds[e] >= 0 && counters.ids[e] == data[4 + 2 * i]) {
+                    reading.values[e] = data[3 + 2 * i];
+                }
+            }
+        }
+    }
+}
+
+static size_t eventGroup(size_t event) {
+    return event < L1D_MISSES ? 0 : (event < DTLB_LOADS ? 1 : 2);
+}
+
+static void counterHook(uint32_t slot, bool enter) {
+    ThreadCounters& counters = threadCounters;
+    if (!counters.opened) {
+        openThreadCounters(counters);
+    }
+    if (counters.leaders[0] < 0 && counters.leaders[1] < 0 && counters.leaders[2] < 0) {
+        return;
+    }
+    if (enter) {
+        if (counters.depth < MAX_DEPTH) {
+            readThreadCounters(counters, counters.stack[counters.depth]);
+        }
+        ++counters.depth;
+        return;
+    }
+    if (counters.depth == 0) {
+        return;
+    }
+    if (--counters.depth >= MAX_DEPTH) {
+        unbalanced.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    CounterReading now;
+    readThreadCounters(counters, now);
+    const CounterReading& start = counters.stack[counters.depth];
+    for (size_t e = 0; e < EVENT_COUNT; ++e) {
+        size_t g = eventGroup(e);
+        uint64_t running = now.running[g] - start.running[g];
+        if (counters.fds[e] < 0 || running == 0) {
+            continue;
+        }
+        double scale = static_cast<double>(now.enabled[g] - start.enabled[g]) / running;
+        stageCounts[slot][e].fetch_add(static_cast<uint64_t>((now.values[e] - start.values[e]) * scale),
+                                       std::memory_order_relaxed);
+    }
+}
+
+static void printCount(double value, bool available, double unit) {
+    if (available) {
+        fprintf(stderr, " %12.3f", value / unit);
+    } else {
+        fprintf(stderr, " %12s", "-");
+    }
+}
+
+static void printRatio(double numerator, double denominator, bool available) {
+    if (available && denominator > 0) {
+        fprintf(stderr, " %10.3f", numerator / denominator);
+    } else {
+        fprintf(stderr, " %10s", "-");
+    }
+}
+
+static void reportCounters() {
+    uint32_t count = stageCount();
+    if (count <= 1) {
+        return;  // no stage ran, e.g. a usage error
+    }
+    bool opened[EVENT_COUNT];
+    bool any = false;
+    for (size_t e = 0; e < EVENT_COUNT; ++e) {
+        opened[e] = eventOpened[e].load();
+        any = any || opened[e];
+    }
+    fprintf(stderr, "hardware counters by stage (user space, inclusive of nested stages):\n");
+    if (!any) {
+        int error = openError.load();
+        FILE* paranoid = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        int level = 0;
+        bool known = paranoid && fscanf(paranoid, "%d", &level) == 1;
+        if (paranoid) {
+            fclose(paranoid);
+        }
+        fprintf(stderr, "counters unavailable: perf_event_open: %s", error ? strerror(error) : "no thread entered a stage");
+        if (known) {
+            fprintf(stderr, " (kernel.perf_event_paranoid = %d)", level);
+        }
+        fprintf(stderr, "; only the calls and work items of every stage are reported\n");
+    } else {
+        for (size_t e = 0; e < EVENT_COUNT; ++e) {
+            if (!opened[e]) {
+                fprintf(stderr, "%s not counted\n", EVENT_NAMES[e]);
+            }
+        }
+    }
+    fprintf(stderr, "%-32s %6s %8s %12s %12s %12s %10s %12s %12s %12s %10s %12s %10s %10s %10s %10s %10s\n", "stage", "class",
+            "calls", "items(M)", "cycles(M)", "instr(M)", "IPC", "llc-miss(K)", "l1d-miss(K)", "br-miss(K)", "packed%",
+            "dtlb-miss(K)", "dtlb-miss%", "cyc/item", "llc/item", "l1d/item", "dtlb/item");
+    for (uint32_t slot = 1; slot < count; ++slot) {
+        const StageStats& stats = stageTable[slot];
+        uint64_t calls = stats.calls.load();
+        if (calls == 0) {
+            continue;
+        }
+        double values[EVENT_COUNT];
+        for (size_t e = 0; e < EVENT_COUNT; ++e) {
+            values[e] = static_cast<double>(stageCounts[slot][e].load());
+        }
+        double items = static_cast<double>(stats.items.load());
+        char index[24] = "";
+        if (stats.index >= 0) {
+            snprintf(index, sizeof(index), "%lld", static_cast<long long>(stats.index));
+        }
+        fprintf(stderr, "%-32s %6s %8llu %12.3f", stats.name, index, static_cast<unsigned long long>(calls), items / 1e6);
+        printCount(values[CYCLES], opened[CYCLES], 1e6);
+        printCount(values[INSTRUCTIONS], opened[INSTRUCTIONS], 1e6);
+        printRatio(values[INSTRUCTIONS], values[CYCLES], opened[INSTRUCTIONS] && opened[CYCLES]);
+        printCount(values[CACHE_MISSES], opened[CACHE_MISSES], 1e3);
+        printCount(values[L1D_MISSES], opened[L1D_MISSES], 1e3);
+        printCount(values[BRANCH_MISSES], opened[BRANCH_MISSES], 1e3);
+        printRatio(100 * values[FP_PACKED], values[FP_PACKED] + values[FP_SCALAR], opened[FP_PACKED] && opened[FP_SCALAR]);
+        printCount(values[DTLB_MISSES], opened[DTLB_MISSES], 1e3);
+        printRatio(100 * values[DTLB_MISSES], values[DTLB_LOADS], opened[DTLB_MISSES] && opened[DTLB_LOADS]);
+        printRatio(values[CYCLES], items, opened[CYCLES]);
+        printRatio(values[CACHE_MISSES], items, opened[CACHE_MISSES]);
+        printRatio(values[L1D_MISSES], items, opened[L1D_MISSES]);
+        printRatio(values[DTLB_MISSES], items, opened[DTLB_MISSES]);
+        fprintf(stderr, "\n");
+    }
+    if (unbalanced.load() > 0) {
+        fprintf(stderr, "%llu stages nested deeper than %zu were not counted\n",
+                static_cast<unsigned long long>(unbalanced.load()), MAX_DEPTH);
+    }
+}
+
+void startCounters(int& argc, char* argv[]) {
+    int kept = 1;
+    bool enabled = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--counters") {
+            enabled = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    if (enabled) {
+        stagesEnabled = true;
+        stageHook = counterHook;
+        atexit(reportCounters);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+// Hardware performance counters per stage. With --counters every thread opens
+// perf_event_open counter groups for itself the first time it enters a stage of
+// stage.h, and every stage adds the counts between entering and leaving it, so
+// the counts of nested stages are included in their parents. The groups are
+// cycles, instructions, last-level cache misses and branch misses, and L1 data
+// cache read misses with the scalar and packed double precision floating point
+// instructions where the CPU has those events, and data TLB loads and load misses
+// (to see what huge pages save); the kernel multiplexes groups that
+// do not fit the PMU together and the counts are scaled by the time they ran.
+// Where perf_event_open is not allowed or the PMU is not virtualized the report
+// says why and keeps the calls and work items of every stage.
+
+// removes --counters from the arguments and installs the stage hook it asks for;
+// the report goes to stderr at exit
+void startCounters(int& argc, char* argv[]);
+
+#endif
@@ -0,0 +1,318 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include "alglibmisc.h"
+
+#include "crossval.h"
+#include "process.h"
+#include "model.h"
+#include "fit.h"
+#include "parallel.h"
+#include "reduce.h"
+#include "trace.h"
+#include "measure.h"
+
+// the parsed dataset, shared read-only by every fold
+struct CrossValidationData {
+    size_t rows;
+    size_t dim;
+    HugeVector<double> features;                // raw rows, row-major
+    std::vector<uint32_t> classes;
+    std::vector<std::string> classNames;
+    std::vector<std::vector<uint32_t> > members;  // rows of each class
+    std::vector<uint32_t> positions;            // position of each row within its class
+    std::vector<uint32_t> folds;                // fold of each row
+    std::vector<std::vector<double> > blocks;   // per class pairwise distances, with shared normalization;
+                                                // empty for the classes past SHARED_BLOCK_LIMIT
+};
+
+// doubles of all pairwise blocks together (512 MB); the classes that do not fit measure their distances in each fold
+static const size_t SHARED_BLOCK_LIMIT = size_t(1) << 26;
+
+struct ClassCurve {
+    std::vector<double> sorted;
+    FitResult fit;
+    bool hasFit;
+};
+
+struct FoldReport {
+    size_t trainRows;
+    size_t testRows;
+    double normalizeSeconds;
+    double nnSeconds;
+    double ecdfSeconds;
+    double fitSeconds;
+    double scoreSeconds;
+    size_t correct;              // test rows whose own class has the largest p-value
+    double truePValueSum;        // p-values of the test rows under their own class
+    size_t rejected;             // test rows with an own-class p-value below 0.05
+    double otherPValueSum;       // largest p-value under any other class
+};
+
+static double scaledDistance(const double* a, const double* b, const std::vector<double>& invSigmas) {
+    double sum = 0.0;
+    for (size_t f = 0; f < invSigmas.size(); ++f) {
+        double diff = (a[f] - b[f]) * invSigmas[f];
+        sum += diff * diff;
+    }
+    return std::sqrt(sum);
+}
+
+// inverse sigmas of the selected rows (fold < 0 selects all rows), the sums over threads threads
+static std::vector<double> inverseSigmas(const CrossValidationData& data, long excludedFold, size_t threads) {
+    std::vector<double> sums(data.dim, 0.0), squares(data.dim, 0.0);
+    size_t count = 0;
+    for (size_t i = 0; i < data.rows; ++i) {
+        count += static_cast<long>(data.folds[i]) != excludedFold;
+    }
+    parallelSums(data.rows, data.dim, threads, reproducibleReductions, [&](size_t begin, size_t end, double* partial) {
+        for (size_t i = begin; i < end; ++i) {
+            if (static_cast<long>(data.folds[i]) == excludedFold) {
+                continue;
+            }
+            for (size_t f = 0; f < data.dim; ++f) {
+                partial[f] += data.features[i * data.dim + f];
+            }
+        }
+    }, sums.data());
+    parallelSums(data.rows, data.dim, threads, reproducibleReductions, [&](size_t begin, size_t end, double* partial) {
+        for (size_t i = begin; i < end; ++i) {
+            if (static_cast<long>(data.folds[i]) == excludedFold) {
+                continue;
+            }
+            for (size_t f = 0; f < data.dim; ++f) {
+                double diff = data.features[i * data.dim + f] - sums[f] / count;
+                partial[f] += diff * diff;
+            }
+        }
+    }, squares.data());
+    std::vector<double> invSigmas(data.dim, 0.0);
+    for (size_t f = 0; f < data.dim; ++f) {
+        double sigma = std::sqrt(squares[f] / count);
+        invSigmas[f] = sigma > 0 ? 1 / sigma : 0;  // constant features do not contribute
+    }
+    return invSigmas;
+}
+
+static double curvePValue(const ClassCurve& curve, double distance) {
+    if (curve.hasFit) {
+        return fitPValue(curve.fit, distance);
+    }
+    size_t below = std::lower_bound(curve.sorted.begin(), curve.sorted.end(), distance) - curve.sorted.begin();
+    return static_cast<double>(curve.sorted.size() - below + 1) / (curve.sorted.size() + 1);
+}
+
+static FoldReport runFold(const CrossValidationData& data, const std::vector<double>& sharedInvSigmas, uint32_t fold) {
+    TRACE_SPAN_ARG("task", "fold", fold);
+    FoldReport report = FoldReport();
+    size_t classCount = data.classNames.size();
+    const double* features = data.features.data();
+    bool shared = !data.blocks.empty();
+
+    // normalize: only the scale matters for distances, so the rows are never rewritten
+    auto start = std::chrono::steady_clock::now();
+    std::vector<double> invSigmas = shared ? sharedInvSigmas : inverseSigmas(data, fold, 1);   // the folds already run in parallel
+    report.normalizeSeconds = secondsSince(start);
+
+    std::vector<std::vector<uint32_t> > training(classCount);
+    std::vector<uint32_t> testing;
+    for (size_t i = 0; i < data.rows; ++i) {
+        if (data.folds[i] == fold) {
+            testing.push_back(static_cast<uint32_t>(i));
+        } else {
+            training[data.classes[i]].push_back(static_cast<uint32_t>(i));
+        }
+    }
+    report.testRows = testing.size();
+    report.trainRows = data.rows - testing.size();
+
+    // distance between a row and a training row of the same class
+    auto sameClassDistance = [&](uint32_t a, uint32_t b) {
+        if (shared && !data.blocks[data.classes[a]].empty()) {
+            const std::vector<double>& block = data.blocks[data.classes[a]];
+            return block[static_cast<size_t>(data.positions[a]) * data.members[data.classes[a]].size() + data.positions[b]];
+        }
+        return scaledDistance(features + a * data.dim, features + b * data.dim, invSigmas);
+    };
+
+    std::vector<ClassCurve> curves(classCount);
+    for (size_t c = 0; c < classCount; ++c) {
+        start = std::chrono::steady_clock::now();
+        std::vector<double>& distances = curves[c].sorted;
+        for (uint32_t i : training[c]) {
+            double minDistance = std::numeric_limits<double>::max();
+            for (uint32_t j : training[c]) {
+                if (i != j) {
+                    minDistance = std::min(minDistance, sameClassDistance(i, j));
+                }
+            }
+            if (minDistance <= NN_DISTANCE_CUTOFF) {
+                distances.push_back(minDistance);
+            }
+        }
+        report.nnSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        std::sort(distances.begin(), distances.end());
+        distances.erase(std::unique(distances.begin(), distances.end()), distances.end());
+        report.ecdfSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        curves[c].hasFit = false;
+        if (distances.size() >= 2) {
+            try {
+                curves[c].fit = selectBestFit(fitAllFamilies(distances, ecdfValues(distances.size())));
+                curves[c].hasFit = true;
+            } catch (alglib::ap_error alglib_exception) {
+                // score with the empirical curve
+            }
+        }
+        report.fitSeconds += secondsSince(start);
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t t : testing) {
+        double truePValue = 0, otherPValue = 0;
+        for (size_t c = 0; c < classCount; ++c) {
+            double minDistance = std::numeric_limits<double>::max();
+            for (uint32_t j : training[c]) {
+                double distance = c == data.classes[t] ? sameClassDistance(t, j)
+                                                       : scaledDistance(features + t * data.dim, features + j * data.dim, invSigmas);
+                minDistance = std::min(minDistance, distance);
+            }
+            double p = training[c].empty() ? 0 : curvePValue(curves[c], minDistance);
+            if (c == data.classes[t]) {
+                truePValue = p;
+            } else {
+                otherPValue = std::max(otherPValue, p);
+            }
+        }
+        report.correct += truePValue > otherPValue;
+        report.truePValueSum += truePValue;
+        report.rejected += truePValue < 0.05;
+        report.otherPValueSum += otherPValue;
+    }
+    report.scoreSeconds = secondsSince(start);
+    return report;
+}
+
+int runCrossValidation(const std::string& filename, const TableFormat& format, const CrossValidationOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+
+    // flatten once; folds only ever hold row indices
+    CrossValidationData data;
+    data.rows = dataset.size();
+    data.dim = dataset[0].features.size();
+    std::unordered_map<std::string, uint32_t> classIndex;
+    for (const auto& obj : dataset) {
+        if (obj.features.size() != data.dim) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", obj.features.size(), data.dim);
+            return 1;
+        }
+        auto found = classIndex.find(obj.name);
+        if (found == classIndex.end()) {
+            found = classIndex.insert(std::make_pair(obj.name, static_cast<uint32_t>(data.classNames.size()))).first;
+            data.classNames.push_back(obj.name);
+            data.members.push_back(std::vector<uint32_t>());
+        }
+        data.positions.push_back(static_cast<uint32_t>(data.members[found->second].size()));
+        data.members[found->second].push_back(static_cast<uint32_t>(data.classes.size()));
+        data.classes.push_back(found->second);
+        data.features.insert(data.features.end(), obj.features.begin(), obj.features.end());
+    }
+    dataset.clear();
+    double parseSeconds = secondsSince(start);
+
+    // class-stratified folds: each class is permuted (Fisher-Yates, seeded per class) and dealt out round-robin
+    data.folds.resize(data.rows);
+    alglib::hqrndstate state;
+    for (size_t c = 0; c < data.members.size(); ++c) {
+        alglib::hqrndseed(static_cast<alglib::ae_int_t>(options.seed), static_cast<alglib::ae_int_t>(c + 1), state);
+        std::vector<uint32_t> permuted = data.members[c];
+        for (size_t i = permuted.size(); i > 1; --i) {
+            size_t j = static_cast<size_t>(alglib::hqrnduniformi(state, static_cast<alglib::ae_int_t>(i)));
+            std::swap(permuted[i - 1], permuted[j]);
+        }
+        for (size_t i = 0; i < permuted.size(); ++i) {
+            data.folds[permuted[i]] = static_cast<uint32_t>(i % options.folds);
+        }
+    }
+
+    // with one normalization for all folds, same-class distances are computed once
+    start = std::chrono::steady_clock::now();
+    std::vector<double> sharedInvSigmas;
+    size_t unsharedClasses = 0;
+    if (options.sharedNormalization) {
+        sharedInvSigmas = inverseSigmas(data, -1, options.threads);
+        data.blocks.resize(data.classNames.size());
+        size_t budget = SHARED_BLOCK_LIMIT;
+        for (size_t c = 0; c < data.classNames.size(); ++c) {
+            const std::vector<uint32_t>& members = data.members[c];
+            std::vector<double>& block = data.blocks[c];
+            size_t size = members.size() * members.size();
+            if (size > budget) {
+                ++unsharedClasses;
+                continue;
+            }
+            budget -= size;
+            block.resize(size);
+            parallelFor(members.size(), options.threads, [&](size_t begin, size_t end) {
+                for (size_t a = begin; a < end; ++a) {
+                    for (size_t b = 0; b < members.size(); ++b) {
+                        block[a * members.size() + b] = scaledDistance(&data.features[members[a] * data.dim],
+                                                                       &data.features[members[b] * data.dim], sharedInvSigmas);
+                    }
+                }
+            });
+        }
+    }
+    double blockSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<FoldReport> reports(options.folds);
+    parallelFor(options.folds, options.threads, [&](size_t begin, size_t end) {
+        for (size_t fold = begin; fold < end; ++fold) {
+            reports[fold] = runFold(data, sharedInvSigmas, static_cast<uint32_t>(fold));
+        }
+    });
+    double foldSeconds = secondsSince(start);
+
+    printf("%s: %zu rows, %zu features, %zu classes, %zu folds, %zu threads%s\n", filename.c_str(), data.rows, data.dim,
+           data.classNames.size(), options.folds, options.threads,
+           options.sharedNormalization ? ", shared normalization (leaky: sigmas include the test folds)" : "");
+    printf("parse %.3f ms, shared blocks %.3f ms, folds %.3f ms\n", parseSeconds * 1e3, blockSeconds * 1e3, foldSeconds * 1e3);
+    if (unsharedClasses > 0) {
+        printf("%zu classes over the shared block limit of %zu distances, measured per fold\n", unsharedClasses,
+               SHARED_BLOCK_LIMIT);
+    }
+    printf("fold  train  test  normalize(ms)  nn(ms)  ecdf(ms)  fit(ms)  score(ms)  accuracy  mean p  p<0.05  other p\n");
+    FoldReport total = FoldReport();
+    for (size_t fold = 0; fold < options.folds; ++fold) {
+        const FoldReport& r = reports[fold];
+        double tests = std::max<size_t>(1, r.testRows);
+        printf("%4zu %6zu %5zu %14.3f %7.3f %9.3f %8.3f %10.3f %9.3f %7.3f %7.3f %8.3f\n", fold, r.trainRows, r.testRows,
+               r.normalizeSeconds * 1e3, r.nnSeconds * 1e3, r.ecdfSeconds * 1e3, r.fitSeconds * 1e3, r.scoreSeconds * 1e3,
+               r.correct / tests, r.truePValueSum / tests, r.rejected / tests, r.otherPValueSum / tests);
+        total.testRows += r.testRows;
+        total.correct += r.correct;
+        total.truePValueSum += r.truePValueSum;
+        total.rejected += r.rejected;
+        total.otherPValueSum += r.otherPValueSum;
+    }
+    double tests = std::max<size_t>(1, total.testRows);
+    printf("all: accuracy %.3f, mean own-class p-value %.3f, own-class p < 0.05 %.3f, mean best other-class p-value %.3f\n",
+           total.correct / tests, total.truePValueSum / tests, total.rejected / tests, total.otherPValueSum / tests);
+    return 0;
+}
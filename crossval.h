@@ -0,0 +1,23 @@
+#ifndef CROSSVAL_H
+#define CROSSVAL_H
+
+#include <string>
+#include <stdint.h>
+
+#include "dataset.h"
+
+struct CrossValidationOptions {
+    size_t folds;
+    size_t threads;
+    uint64_t seed;               // seed of the class-stratified fold permutation
+    bool sharedNormalization;    // normalize once over all rows and reuse per-class pairwise blocks across folds;
+                                 // the sigmas then see the test rows, so the scores are optimistic
+
+    CrossValidationOptions() : folds(10), threads(1), seed(1), sharedNormalization(false) {}
+};
+
+// Parse once, then train (normalize, NN, ECDF, fit) and score every fold as a
+// parallel task, and report per-fold stage timings and p-value metrics.
+int runCrossValidation(const std::string& filename, const TableFormat& format, const CrossValidationOptions& options);
+
+#endif
@@ -0,0 +1,231 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+
+#include "dataset.h"
+#include "reader.h"
+#include "trace.h"
+
+// Read the dataset from a file
+std::vector<ClassMember> readDataset(const std::string& filename) {
+    TRACE_SPAN("stage", "readDataset");
+    std::vector<ClassMember> dataset;
+    std::ifstream file(filename);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;  // Skip the empty lines
+        }
+
+        std::stringstream ss(line);
+        ClassMember obj;
+        std::string feature;
+
+        while (std::getline(ss, feature, ',')) {
+            if (isdigit(feature[0]) || feature[0] == '-') {
+                obj.features.push_back(std::stod(feature));
+            } else {
+                assert(obj.name == "");
+                assert(feature != "");
+                obj.name = feature;
+            }
+        }
+        dataset.push_back(obj);
+    }
+
+    //std::cout << "feature size:" << dataset[0].features.size() << std::endl;
+    return dataset;
+}
+
+// fields as std::getline splits them: a delimiter at the end of the line starts no empty field
+static void splitFields(const char* begin, const char* end, char delimiter, std::vector<std::string>& fields) {
+    fields.clear();
+    while (begin != end) {
+        const char* next = std::find(begin, end, delimiter);
+        fields.push_back(std::string(begin, next));
+        begin = next == end ? end : next + 1;
+    }
+}
+
+bool parseNumber(const std::string& field, double& value) {
+    char* end;
+    value = strtod(field.c_str(), &end);
+    return end != field.c_str() && *end == '\0';
+}
+
+bool parseCount(const std::string& field, size_t& value, size_t least) {
+    if (field.empty() || !isdigit(static_cast<unsigned char>(field[0]))) {
+        return false;   // strtoull would skip blanks and wrap a sign
+    }
+    char* end;
+    errno = 0;
+    unsigned long long parsed = strtoull(field.c_str(), &end, 10);
+    if (*end != '\0' || parsed < least || errno == ERANGE) {
+        return false;
+    }
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+TableLine parseTableLine(const char* begin, const char* end, char delimiter, const TableFormat& format, ClassMember& obj) {
+    std::vector<std::string> fields;
+    splitFields(begin, end, delimiter, fields);
+    int columns = static_cast<int>(fields.size());
+    int label = format.labelColumn < 0 ? columns + format.labelColumn : format.labelColumn;
+    if (label < 0 || label >= columns) {
+        return LINE_NO_LABEL;
+    }
+    obj.name = fields[label];
+    for (int i = 0; i < columns; ++i) {
+        if (i == label || std::find(format.skipColumns.begin(), format.skipColumns.end(), i) != format.skipColumns.end()) {
+            continue;
+        }
+        double value;
+        if (!parseNumber(fields[i], value)) {
+            return LINE_NOT_NUMERIC;
+        }
+        obj.features.push_back(value);
+    }
+    return LINE_ROW;
+}
+
+static const char BINARY_TABLE_MAGIC[8] = {'P', 'I', 'D', 'R', 'O', 'W', 'S', '1'};
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+BinaryTableHeader binaryTableLayout(uint64_t rows, uint64_t dim, uint64_t classCount) {
+    BinaryTableHeader header;
+    std::copy(BINARY_TABLE_MAGIC, BINARY_TABLE_MAGIC + 8, header.magic);
+    header.rows = rows;
+    header.dim = dim;
+    header.classCount = classCount;
+    header.namesOffset = alignSection(sizeof(BinaryTableHeader));
+    header.classesOffset = alignSection(header.namesOffset + classCount * BINARY_NAME_LENGTH);
+    header.featuresOffset = alignSection(header.classesOffset + rows * sizeof(uint32_t));
+    header.size = header.featuresOffset + rows * dim * sizeof(double);
+    return header;
+}
+
+bool isBinaryTable(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[8];
+    return file.read(magic, sizeof(magic)) && std::equal(magic, magic + 8, BINARY_TABLE_MAGIC);
+}
+
+std::vector<ClassMember> readBinaryTable(const std::string& filename) {
+    TRACE_SPAN("stage", "readBinaryTable");
+    std::vector<ClassMember> dataset;
+    std::ifstream file(filename, std::ios::binary);
+    BinaryTableHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || !std::equal(header.magic, header.magic + 8, BINARY_TABLE_MAGIC)) {
+        fprintf(stderr, "%s: not a binary table\n", filename.c_str());
+        return dataset;
+    }
+    std::vector<std::string> names(header.classCount);
+    std::vector<char> name(BINARY_NAME_LENGTH);
+    file.seekg(header.namesOffset);
+    for (auto& className : names) {
+        file.read(name.data(), BINARY_NAME_LENGTH);
+        className.assign(name.data(), std::find(name.begin(), name.end(), '\0') - name.begin());
+    }
+    std::vector<uint32_t> classes(header.rows);
+    file.seekg(header.classesOffset);
+    file.read(reinterpret_cast<char*>(classes.data()), classes.size() * sizeof(uint32_t));
+
+    file.seekg(header.featuresOffset);
+    std::vector<double> row(header.dim);
+    size_t dropped = 0;
+    dataset.reserve(header.rows);
+    for (uint64_t i = 0; i < header.rows && file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(double)); ++i) {
+        if (classes[i] >= names.size() || std::any_of(row.begin(), row.end(), [](double value) { return value != value; })) {
+            ++dropped;
+            continue;
+        }
+        ClassMember obj;
+        obj.features = row;
+        obj.name = names[classes[i]];
+        dataset.push_back(obj);
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%s: dropped %zu rows with missing features\n", filename.c_str(), dropped);
+    }
+    return dataset;
+}
+
+std::vector<ClassMember> readTable(const std::string& filename, const TableFormat& format) {
+    if (isBinaryTable(filename)) {
+        return readBinaryTable(filename);
+    }
+    if (useBlockReader(std::vector<std::string>(1, filename))) {
+        std::vector<ClassMember> dataset;
+        readTables(std::vector<std::string>(1, filename), std::vector<TableFormat>(1, format), ReaderOptions(),
+                   [&dataset](size_t, std::vector<ClassMember>& rows) { dataset.swap(rows); });
+        return dataset;
+    }
+    return readTableStream(filename, format);
+}
+
+std::vector<ClassMember> readTableStream(const std::string& filename, const TableFormat& format) {
+    TRACE_SPAN("stage", "readTable");
+    std::vector<ClassMember> dataset;
+    std::ifstream file(filename);
+    std::string line;
+    char delimiter = format.delimiter;
+    bool firstLine = true;
+    size_t dropped = 0;
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();  // CRLF line endings
+        }
+        if (line.empty()) {
+            continue;  // Skip the empty lines
+        }
+        if (delimiter == 0) {
+            delimiter = line.find(';') != std::string::npos ? ';' : ',';
+        }
+
+        ClassMember obj;
+        TableLine parsed = parseTableLine(line.data(), line.data() + line.size(), delimiter, format, obj);
+        if (parsed == LINE_NO_LABEL) {
+            ++dropped;
+            continue;
+        }
+        if (parsed == LINE_NOT_NUMERIC) {
+            // a header line, or a row with missing values
+            dropped += !firstLine;
+        } else {
+            dataset.push_back(obj);
+        }
+        firstLine = false;
+    }
+
+    if (dropped > 0) {
+        fprintf(stderr, "%s: dropped %zu rows with non-numeric features\n", filename.c_str(), dropped);
+    }
+    return dataset;
+}
+
+bool parseTableOption(const std::string& arg, const char* value, TableFormat& format) {
+    if (arg == "--delimiter") {
+        format.delimiter = value[0];
+    } else if (arg == "--label-column") {
+        format.labelColumn = std::stoi(value);
+    } else if (arg == "--skip-column") {
+        format.skipColumns.push_back(std::stoi(value));
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "classMember.h"
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+std::vector<ClassMember> readDataset(const std::string& filename);
+
+// layout of a delimited table with one class label column
+struct TableFormat {
+    char delimiter;                  // 0 detects ';' or ',' from the first line
+    int labelColumn;                 // negative values count from the end, -1 is the last column
+    std::vector<int> skipColumns;    // columns that are neither features nor the label, e.g. a row id
+    TableFormat() : delimiter(0), labelColumn(-1) {}
+};
+
+// Read a table such as glass.data or winequality-red.csv: every column but the label
+// and the skipped ones is a numeric feature. A non-numeric first line is taken as a
+// header, and rows with non-numeric features are dropped. Binary tables are
+// recognized by their magic and read with readBinaryTable; large text tables go
+// through the block reader of reader.h, which gives the same rows.
+std::vector<ClassMember> readTable(const std::string& filename, const TableFormat& format);
+// readTable of a text table line by line with std::ifstream
+std::vector<ClassMember> readTableStream(const std::string& filename, const TableFormat& format);
+
+enum TableLine { LINE_ROW, LINE_NOT_NUMERIC, LINE_NO_LABEL };
+
+// one line of a text table, without its line break, into obj: LINE_NOT_NUMERIC for a
+// header or a row with missing values, LINE_NO_LABEL if the line is short of the label column
+TableLine parseTableLine(const char* begin, const char* end, char delimiter, const TableFormat& format, ClassMember& obj);
+
+// Binary table: the header, then the class names in fixed-size slots, the class
+// index of every row and the rows (dim doubles each, NaN for a missing value).
+// Every section starts at a multiple of 64 bytes and its offset follows from the
+// row count alone, so that writers can fill the sections in parallel.
+struct BinaryTableHeader {
+    char magic[8];             // "PIDROWS1"
+    uint64_t rows;
+    uint64_t dim;
+    uint64_t classCount;
+    uint64_t namesOffset;      // classCount names of BINARY_NAME_LENGTH bytes
+    uint64_t classesOffset;    // rows uint32 class indices
+    uint64_t featuresOffset;   // rows x dim doubles, row-major
+    uint64_t size;
+};
+
+static const size_t BINARY_NAME_LENGTH = 64;
+
+BinaryTableHeader binaryTableLayout(uint64_t rows, uint64_t dim, uint64_t classCount);
+bool isBinaryTable(const std::string& filename);
+// rows with a missing value are dropped, like the non-numeric rows of readTable
+std::vector<ClassMember> readBinaryTable(const std::string& filename);
+
+// a whole field as a number, or as a count of at least least (digits only); false if it is anything else
+bool parseNumber(const std::string& field, double& value);
+bool parseCount(const std::string& field, size_t& value, size_t least = 1);
+
+// command line options describing the layout of a table file, true if arg was one of them
+bool parseTableOption(const std::string& arg, const char* value, TableFormat& format);
+
+#endif
@@ -2,15 +2,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <iostream>
+#include <sstream>
 #include "interpolation.h"
 
-using namespace alglib;
+#include "fit.h"
+#include "trace.h"
 
-struct FitResult {
-    real_1d_array c;
-    std::string functionName;
-    double wrmsError;
-};
+using namespace alglib;
 
 // helper function secant
 double sech(double x) {
@@ -106,13 +105,45 @@ void algebraic_fd(const real_1d_array &c, const real_1d_array &x, double &func,
 }
 
 
-int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_values)
+// all supported sigmoid families, fitted in this order
+static const SigmoidFamily families[] = {
+    {"Logistic fucntion", logistic, logistic_f, logistic_fd, "logistic"},
+    {"hyperbolic tangent fucntion", hyperbolic_tangent, hyperbolic_f, hyperbolic_fd, "tanh"},
+    {"arctangent function", arctangent, arctangent_f, arctangent_fd, "arctan"},
+    {"gudermannian function", gudermannian, gudermannian_f, gudermannian_fd, "gudermannian"},
+    {"simple algebraic function", algebraic, algebraic_f, algebraic_fd, "algebraic"},
+};
+
+const SigmoidFamily* sigmoidFamilies(size_t& count) {
+    count = sizeof(families) / sizeof(families[0]);
+    return families;
+}
+
+uint32_t sigmoidFamilyMask(const std::string& keys)
 {
-    alglib::real_2d_array x;
-    alglib::real_1d_array y;
-    alglib::real_1d_array w;
-    std::vector<FitResult> results;
+    if (keys == "all") {
+        return ALL_SIGMOID_FAMILIES;
+    }
+    uint32_t mask = 0;
+    std::stringstream stream(keys);
+    std::string key;
+    while (std::getline(stream, key, '+')) {
+        size_t i = 0;
+        while (i < sizeof(families) / sizeof(families[0]) && key != families[i].key) {
+            ++i;
+        }
+        if (i == sizeof(families) / sizeof(families[0])) {
+            return 0;
+        }
+        mask |= 1u << i;
+    }
+    return mask;
+}
 
+// the ECDF points as ALGLIB arrays, weighted by the squared distance
+static void fitArrays(const std::vector<double>& sorted_distances, const std::vector<double>& y_values,
+                      alglib::real_2d_array& x, alglib::real_1d_array& y, alglib::real_1d_array& w)
+{
     x.setlength(sorted_distances.size(), 1);
     y.setlength(y_values.size());
 
@@ -130,79 +161,100 @@ int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_val
     for(size_t i = 0; i < y_values.size(); i++) {
         w[i] = sorted_distances[i]*sorted_distances[i];
     }
+}
 
-    try
-    {
-        real_1d_array c = "[0.367, 0.45]"; // initial values for c & a in c(x-a)
-        double epsx = 0;
-        ae_int_t maxits = 0;
-        lsfitstate state;
-        lsfitreport rep;
-
-        // nonlinear square curve fitting for logistic function
+// fit every sigmoid family selected by familyMask to the ECDF points, throws alglib::ap_error on failure
+std::vector<FitResult> fitAllFamilies(const std::vector<double>& sorted_distances, const std::vector<double>& y_values,
+                                      uint32_t familyMask)
+{
+    alglib::real_2d_array x;
+    alglib::real_1d_array y;
+    alglib::real_1d_array w;
+    std::vector<FitResult> results;
+    fitArrays(sorted_distances, y_values, x, y, w);
+
+    real_1d_array c = "[0.367, 0.45]"; // initial values for c & a in c(x-a)
+    double epsx = 0;
+    ae_int_t maxits = 0;
+    lsfitstate state;
+    lsfitreport rep;
+
+    // nonlinear square curve fitting for each sigmoid function,
+    // every fit starts from the parameters of the previous one
+    size_t familyCount;
+    const SigmoidFamily* family = sigmoidFamilies(familyCount);
+    for (size_t i = 0; i < familyCount; ++i) {
+        if (!(familyMask & (1u << i))) {
+            continue;
+        }
+        TRACE_SPAN_ARG("fit", family[i].key, i);
         lsfitcreatewfg(x, y, w, c, state);
         lsfitsetcond(state, epsx, maxits);
-        alglib::lsfitfit(state, logistic_f, logistic_fd);
+        alglib::lsfitfit(state, family[i].f, family[i].fd);
         lsfitresults(state, c, rep);
-        results.push_back({c, "Logistic fucntion", rep.wrmserror});
+        results.push_back({c, family[i].name, rep.wrmserror, &family[i]});
         //printf("%d\n", int(rep.terminationtype));  // status code
 
         // print out the fitting procedure
-        /*for (int i = 0; i < y.size(); i++){
-            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[i][0], y[i], c[0], c[1], 1 - logistic(c[0], c[1], x[i][0]));
+        /*for (int j = 0; j < y.size(); j++){
+            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[j][0], y[j], c[0], c[1], 1 - family[i].sigmoid(c[0], c[1], x[j][0]));
         }*/
+    }
 
-        // nonlinear square curve fitting for hyperbolic tangent function
-        lsfitcreatewfg(x, y, w, c, state);
-        lsfitsetcond(state, epsx, maxits);
-        alglib::lsfitfit(state, hyperbolic_f, hyperbolic_fd);
-        lsfitresults(state, c, rep);
-        results.push_back({c, "hyperbolic tangent fucntion", rep.wrmserror});
-        //printf("%d\n", int(rep.terminationtype));
+    return results;
+}
 
-        // print out the fitting procedure
-        /*for (int i = 0; i < y.size(); i++){
-            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[i][0], y[i], c[0], c[1], 1 - hyperbolic_tangent(c[0], c[1], x[i][0]));
-        }*/
+FitResult refitFamily(const std::vector<double>& sorted_distances, const std::vector<double>& y_values,
+                      const SigmoidFamily& family, double c0, double a0)
+{
+    alglib::real_2d_array x;
+    alglib::real_1d_array y;
+    alglib::real_1d_array w;
+    fitArrays(sorted_distances, y_values, x, y, w);
 
-        // nonlinear square curve fitting for arctangent function
-        lsfitcreatewfg(x, y, w, c, state);
-        lsfitsetcond(state, epsx, maxits);
-        alglib::lsfitfit(state, arctangent_f, arctangent_fd);
-        lsfitresults(state, c, rep);
-        results.push_back({c, "arctangent function", rep.wrmserror});
-        //printf("%d\n", int(rep.terminationtype));
+    real_1d_array c;
+    c.setlength(2);
+    c[0] = c0;
+    c[1] = a0;
+    lsfitstate state;
+    lsfitreport rep;
+    lsfitcreatewfg(x, y, w, c, state);
+    lsfitsetcond(state, 0, 0);
+    alglib::lsfitfit(state, family.f, family.fd);
+    lsfitresults(state, c, rep);
+    return {c, family.name, rep.wrmserror, &family};
+}
 
-        // print out the fitting procedure
-        /*for (int i = 0; i < y.size(); i++){
-            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[i][0], y[i], c[0], c[1], 1 - arctangent(c[0], c[1], x[i][0]));
-        }*/
+FitResult selectBestFit(const std::vector<FitResult>& results)
+{
+    FitResult bestFit = results[0];
+    for (const auto& result : results) {
+        if (result.wrmsError < bestFit.wrmsError) {
+            bestFit = result;
+        }
+    }
+    return bestFit;
+}
 
-        // nonlinear square curve fitting for Gudermannian function
-        lsfitcreatewfg(x, y, w, c, state);
-        lsfitsetcond(state, epsx, maxits);
-        alglib::lsfitfit(state, gudermannian_f, gudermannian_fd);
-        lsfitresults(state, c, rep);
-        results.push_back({c, "gudermannian function", rep.wrmserror});
-        //printf("%d\n", int(rep.terminationtype));
+// p-value of a distance under a fitted curve, i.e. the fitted 1 - ECDF clamped to [0, 1]
+double sigmoidPValue(const SigmoidFamily& family, double c, double a, double distance)
+{
+    double p = 1 - family.sigmoid(c, a, distance);
+    if (p < 0) return 0;
+    if (p > 1) return 1;
+    return p;
+}
 
-        // print out the fitting procedure
-        /*for (int i = 0; i < y.size(); i++){
-            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[i][0], y[i], c[0], c[1], 1 - gudermannian(c[0], c[1], x[i][0]));
-        }*/
-        
-        // nonlinear square curve fitting for simple algebraic function
-        lsfitcreatewfg(x, y, w, c, state);
-        lsfitsetcond(state, epsx, maxits);
-        alglib::lsfitfit(state, algebraic_f, algebraic_fd);
-        lsfitresults(state, c, rep);
-        results.push_back({c, "simple algebraic function", rep.wrmserror});
-        //printf("%d\n", int(rep.terminationtype));
+double fitPValue(const FitResult& fit, double distance)
+{
+    return sigmoidPValue(*fit.family, fit.c[0], fit.c[1], distance);
+}
 
-        // print out the fitting procedure
-        /*for (int i = 0; i < y.size(); i++){
-            printf("xi: %g yi: %g f(%g,%g,xi): %g\n", x[i][0], y[i], c[0], c[1], 1 - algebraic(c[0], c[1], x[i][0]));
-        }*/
+int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_values)
+{
+    try
+    {
+        std::vector<FitResult> results = fitAllFamilies(sorted_distances, y_values);
 
         // print out all results
         for (const auto& result : results) {
@@ -212,12 +264,7 @@ int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_val
         }
 
         // print out the best result
-        FitResult bestFit = results[0];
-        for (const auto& result : results) {
-            if (result.wrmsError < bestFit.wrmsError) {
-                bestFit = result;
-            }
-        }
+        FitResult bestFit = selectBestFit(results);
 
         std::cout << "Best fit function: " << bestFit.functionName << std::endl;
         std::cout << "c & a in c(x-a): " << bestFit.c.tostring(1).c_str() << std::endl;
@@ -229,4 +276,26 @@ int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_val
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+void setFitWorkers(size_t threads) {
+    alglib::setnworkers(static_cast<alglib::ae_int_t>(threads));
+}
+
+std::string alglibBuild() {
+    std::string build;
+#if defined(__OPTIMIZE__)
+    build = "optimized ";
+#endif
+#if defined(AE_CPU) && AE_CPU == AE_INTEL
+    alglib_impl::ae_int_t cpu = alglib_impl::ae_cpuid();
+    build += "ALGLIB with SIMD kernels (this CPU:";
+    build += (cpu & alglib_impl::CPU_SSE2) ? " sse2" : "";
+    build += (cpu & alglib_impl::CPU_AVX2) ? " avx2" : "";
+    build += (cpu & alglib_impl::CPU_FMA) ? " fma" : "";
+    build += cpu ? ")" : " none)";
+#else
+    build += "plain ALGLIB";
+#endif
+    return build;
+}
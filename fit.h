@@ -2,7 +2,49 @@
 #define FIT_H
 
 #include <vector>
+#include <string>
+#include <stdint.h>
+#include "ap.h"
+
+// a sigmoid family: the sigmoid itself plus the ALGLIB callbacks fitting 1 - sigmoid(c(x-a))
+struct SigmoidFamily {
+    const char* name;
+    double (*sigmoid)(double k, double alpha, double x);
+    void (*f)(const alglib::real_1d_array &c, const alglib::real_1d_array &x, double &func, void *ptr);
+    void (*fd)(const alglib::real_1d_array &c, const alglib::real_1d_array &x, double &func, alglib::real_1d_array &grad, void *ptr);
+    const char* key;    // short name used on the command line
+};
+
+// bit i selects family i of sigmoidFamilies()
+static const uint32_t ALL_SIGMOID_FAMILIES = ~0u;
+
+struct FitResult {
+    alglib::real_1d_array c;
+    std::string functionName;
+    double wrmsError;
+    const SigmoidFamily* family;
+};
+
+const SigmoidFamily* sigmoidFamilies(size_t& count);
+// mask of "all" or of keys joined by '+', e.g. "logistic+tanh"; 0 if a key is unknown
+uint32_t sigmoidFamilyMask(const std::string& keys);
+
+std::vector<FitResult> fitAllFamilies(const std::vector<double>& sorted_distances, const std::vector<double>& y_values,
+                                      uint32_t familyMask = ALL_SIGMOID_FAMILIES);
+// one family fitted again from c0 & a0, e.g. the parameters of a fit to a nearby
+// curve; throws alglib::ap_error on failure
+FitResult refitFamily(const std::vector<double>& sorted_distances, const std::vector<double>& y_values,
+                      const SigmoidFamily& family, double c0, double a0);
+FitResult selectBestFit(const std::vector<FitResult>& results);
+double sigmoidPValue(const SigmoidFamily& family, double c, double a, double distance);
+double fitPValue(const FitResult& fit, double distance);
+
+// ALGLIB's worker threads for its parallel solvers; a no-op without the SMP support of
+// the commercial edition (AE_HPC), where every fit runs on its caller's thread
+void setFitWorkers(size_t threads);
+// which ALGLIB build is linked: plain, or with the SIMD kernels and those this CPU runs
+std::string alglibBuild();
 
 int curveFitting(std::vector<double> sorted_distances, std::vector<double> y_values);
 
-#endif
\ No newline at end of file
+#endif
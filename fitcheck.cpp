@@ -0,0 +1,145 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "fitcheck.h"
+#include "fit.h"
+#include "model.h"
+#include "process.h"
+
+struct FamilyFit {
+    double c;
+    double a;
+    double residual;
+    bool best;
+};
+
+// class name and family key to the fit
+typedef std::map<std::pair<std::string, std::string>, FamilyFit> FitTable;
+
+static bool fitTable(const std::string& filename, const TableFormat& format, FitTable& table) {
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "%s: no rows\n", filename.c_str());
+        return false;
+    }
+    Model model = normalizeModel(dataset);
+    for (size_t c = 0; c < model.classNames.size(); ++c) {
+        std::vector<double> curve = classCurve(classNearestDistances(model, c), NN_DISTANCE_CUTOFF);
+        if (curve.size() < 2) {
+            continue;
+        }
+        try {
+            std::vector<FitResult> results = fitAllFamilies(curve, ecdfValues(curve.size()));
+            const SigmoidFamily* best = selectBestFit(results).family;
+            for (const FitResult& result : results) {
+                FamilyFit fit = {result.c[0], result.c[1], result.wrmsError, result.family == best};
+                table[std::make_pair(model.classNames[c], std::string(result.family->key))] = fit;
+            }
+        } catch (alglib::ap_error alglib_exception) {
+            fprintf(stderr, "ALGLIB exception fitting class %s: '%s'\n", model.classNames[c].c_str(), alglib_exception.msg.c_str());
+        }
+    }
+    return true;
+}
+
+int runFitDump(const std::string& filename, const TableFormat& format, const std::string& output) {
+    FitTable table;
+    if (!fitTable(filename, format, table)) {
+        return 1;
+    }
+    FILE* file = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (!file) {
+        perror(output.c_str());
+        return 1;
+    }
+    fprintf(file, "# %s fitted by %s\n", filename.c_str(), alglibBuild().c_str());
+    for (const auto& entry : table) {
+        fprintf(file, "%s\t%s\t%.17g\t%.17g\t%.17g\t%d\n", entry.first.first.c_str(), entry.first.second.c_str(),
+                entry.second.c, entry.second.a, entry.second.residual, entry.second.best ? 1 : 0);
+    }
+    if (file != stdout) {
+        fclose(file);
+        printf("%zu fits of %s written to %s\n", table.size(), filename.c_str(), output.c_str());
+    }
+    return 0;
+}
+
+static bool readFitTable(const std::string& filename, std::string& build, FitTable& table) {
+    std::ifstream file(filename);
+    if (!file) {
+        perror(filename.c_str());
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '#') {
+            size_t by = line.find(" fitted by ");
+            build = by == std::string::npos ? "" : line.substr(by + 11);
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string className, key, value;
+        FamilyFit fit;
+        int best;
+        if (!std::getline(fields, className, '\t') || !std::getline(fields, key, '\t') ||
+            !(fields >> fit.c >> fit.a >> fit.residual >> best)) {
+            fprintf(stderr, "%s: not a fit dump: '%s'\n", filename.c_str(), line.c_str());
+            return false;
+        }
+        fit.best = best != 0;
+        table[std::make_pair(className, key)] = fit;
+    }
+    return true;
+}
+
+static double relativeDifference(double a, double b) {
+    return std::fabs(a - b) / std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+}
+
+int runFitCheck(const std::string& filename, const TableFormat& format, const std::string& reference, double tolerance) {
+    std::string referenceBuild;
+    FitTable expected, actual;
+    if (!readFitTable(reference, referenceBuild, expected) || !fitTable(filename, format, actual)) {
+        return 1;
+    }
+    printf("%s: %s against %s (%s), tolerance %g\n", filename.c_str(), alglibBuild().c_str(), reference.c_str(),
+           referenceBuild.c_str(), tolerance);
+    printf("%-24s %-12s %12s %12s %12s  %s\n", "class", "family", "c diff", "a diff", "residual diff", "");
+
+    size_t mismatches = 0;
+    double largest = 0;
+    for (const auto& entry : expected) {
+        auto found = actual.find(entry.first);
+        if (found == actual.end()) {
+            printf("%-24s %-12s %12s %12s %12s  MISSING\n", entry.first.first.c_str(), entry.first.second.c_str(), "-", "-", "-");
+            ++mismatches;
+            continue;
+        }
+        const FamilyFit& want = entry.second;
+        const FamilyFit& got = found->second;
+        double cDiff = relativeDifference(want.c, got.c), aDiff = relativeDifference(want.a, got.a);
+        double residualDiff = relativeDifference(want.residual, got.residual);
+        largest = std::max(largest, std::max(cDiff, std::max(aDiff, residualDiff)));
+        bool same = cDiff <= tolerance && aDiff <= tolerance && residualDiff <= tolerance && want.best == got.best;
+        mismatches += same ? 0 : 1;
+        printf("%-24s %-12s %12.2e %12.2e %12.2e  %s\n", entry.first.first.c_str(), entry.first.second.c_str(), cDiff, aDiff,
+               residualDiff, same ? "same" : (want.best != got.best ? "BEST FAMILY CHANGED" : "DIFFERENT"));
+    }
+    for (const auto& entry : actual) {
+        if (!expected.count(entry.first)) {
+            printf("%-24s %-12s %12s %12s %12s  NOT IN REFERENCE\n", entry.first.first.c_str(), entry.first.second.c_str(), "-", "-", "-");
+            ++mismatches;
+        }
+    }
+    printf("%zu fits compared, %zu mismatches, largest relative difference %.2e\n", expected.size(), mismatches, largest);
+    return mismatches ? 2 : 0;
+}
@@ -0,0 +1,17 @@
+#ifndef FITCHECK_H
+#define FITCHECK_H
+
+#include <string>
+
+#include "dataset.h"
+
+// The fitted (c, a) and residual of every sigmoid family of every class of a table,
+// written at full precision with the ALGLIB build that produced them.
+int runFitDump(const std::string& filename, const TableFormat& format, const std::string& output);
+
+// Refits a table and compares it with a dump of another build (plain against the
+// SIMD build, say): every value must agree within tolerance relative to its size
+// (at least 1), and every class must keep its best family. Exits with 2 otherwise.
+int runFitCheck(const std::string& filename, const TableFormat& format, const std::string& reference, double tolerance);
+
+#endif
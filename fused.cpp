@@ -0,0 +1,147 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+
+#include "dataanalysis.h"
+
+#include "fused.h"
+#include "kdtree.h"
+#include "model.h"
+#include "dataset.h"
+#include "measure.h"
+
+// query timings are the best of a few rounds, so that the first round's page faults do not count
+static const int BENCHMARK_ROUNDS = 3;
+
+int runClassify(const std::string& trainFile, const std::string& queryFile, size_t k) {
+    std::vector<ClassMember> training = readDataset(trainFile);
+    std::vector<ClassMember> queries = readDataset(queryFile);
+    if (training.empty()) {
+        fprintf(stderr, "No rows in %s\n", trainFile.c_str());
+        return 1;
+    }
+    Model model = trainModel(training);
+    ModelView view = viewOf(model);
+    KdTree tree = buildKdTree(view);
+
+    // training row of each model row: the model groups the rows by class, in order within a class
+    std::vector<size_t> trainingRows(view.rows);
+    std::vector<uint64_t> nextRow(view.classOffsets, view.classOffsets + view.classCount);
+    for (size_t i = 0; i < training.size(); ++i) {
+        size_t c = std::find(model.classNames.begin(), model.classNames.end(), training[i].name) - model.classNames.begin();
+        trainingRows[nextRow[c]++] = i;
+    }
+
+    FusedScratch scratch;
+    std::vector<Neighbor> neighbors(k);
+    std::vector<double> distances(view.classCount), pValues(view.classCount);
+    for (const auto& query : queries) {
+        if (query.features.size() != view.dim) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", query.features.size(), view.dim);
+            return 1;
+        }
+        size_t predicted = fusedQuery(view, tree, query.features.data(), k, scratch, neighbors.data(), distances.data(), pValues.data());
+        printf("predicted %s | neighbors", view.classNames[predicted]);
+        for (size_t n = 0; n < std::min(k, view.rows); ++n) {
+            printf(" row %zu %s %g%s", trainingRows[neighbors[n].row], view.classNames[neighbors[n].classIndex],
+                   neighbors[n].distance, n + 1 < std::min(k, view.rows) ? "," : "");
+        }
+        for (size_t c = 0; c < view.classCount; ++c) {
+            printf(" | %s distance %g p-value %g", view.classNames[c], distances[c], pValues[c]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+int runFusedBenchmark(const std::string& trainFile, size_t k) {
+    std::vector<ClassMember> dataset = readDataset(trainFile);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", trainFile.c_str());
+        return 1;
+    }
+    Model model = trainModel(dataset);
+    ModelView view = viewOf(model);
+    size_t n = view.rows, dim = view.dim;
+
+    // the training rows themselves are the queries
+    auto start = std::chrono::steady_clock::now();
+    KdTree tree = buildKdTree(view);
+    double treeBuild = secondsSince(start);
+
+    std::vector<size_t> fusedClasses(n);
+    std::vector<double> fusedPValues(n * view.classCount);
+    std::vector<FusedScratch> scratch;
+    std::vector<const double*> rows(n);
+    for (size_t i = 0; i < n; ++i) {
+        rows[i] = dataset[i].features.data();
+    }
+    std::vector<Neighbor> neighbors(n * k);
+    std::vector<double> distances(n * view.classCount);
+    double fusedQueries = std::numeric_limits<double>::max();
+    for (int round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        start = std::chrono::steady_clock::now();
+        fusedQueryGroup(view, tree, rows.data(), n, k, scratch, neighbors.data(), distances.data(), fusedPValues.data(),
+                        fusedClasses.data());
+        fusedQueries = std::min(fusedQueries, secondsSince(start));
+    }
+
+    // ALGLIB k-NN model on the same normalized rows, class index in the last column
+    start = std::chrono::steady_clock::now();
+    alglib::real_2d_array xy;
+    xy.setlength(n, dim + 1);
+    for (size_t c = 0; c < view.classCount; ++c) {
+        for (uint64_t i = view.classOffsets[c]; i < view.classOffsets[c + 1]; ++i) {
+            for (size_t f = 0; f < dim; ++f) {
+                xy[i][f] = view.features[i * dim + f];
+            }
+            xy[i][dim] = static_cast<double>(c);
+        }
+    }
+    alglib::knnbuilder builder;
+    alglib::knnmodel knn;
+    alglib::knnreport report;
+    alglib::knnbuildercreate(builder);
+    alglib::knnbuildersetdatasetcls(builder, xy, n, dim, view.classCount);
+    alglib::knnbuilderbuildknnmodel(builder, k, 0.0, knn, report);
+    double knnBuild = secondsSince(start);
+
+    std::vector<size_t> separateClasses(n);
+    std::vector<double> separatePValues(n * view.classCount);
+    std::vector<double> query(dim);
+    alglib::real_1d_array x;
+    x.setlength(dim);
+    double separateQueries = std::numeric_limits<double>::max();
+    for (int round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t f = 0; f < dim; ++f) {
+                x[f] = (dataset[i].features[f] - view.means[f]) / view.sigmas[f];
+            }
+            separateClasses[i] = alglib::knnclassify(knn, x);
+            scoreRow(view, dataset[i].features.data(), query.data(), distances.data(), &separatePValues[i * view.classCount]);
+        }
+        separateQueries = std::min(separateQueries, secondsSince(start));
+    }
+
+    size_t agree = 0;
+    double maxDifference = 0;
+    for (size_t i = 0; i < n; ++i) {
+        agree += fusedClasses[i] == separateClasses[i];
+    }
+    for (size_t i = 0; i < n * view.classCount; ++i) {
+        maxDifference = std::max(maxDifference, std::fabs(fusedPValues[i] - separatePValues[i]));
+    }
+
+    printf("%zu queries, k = %zu, %zu classes\n", n, k, view.classCount);
+    printf("fused:    build %.3f ms, queries %.3f ms (%.2f us/query)\n", treeBuild * 1e3, fusedQueries * 1e3, fusedQueries * 1e6 / n);
+    printf("separate: build %.3f ms, queries %.3f ms (%.2f us/query)\n", knnBuild * 1e3, separateQueries * 1e3, separateQueries * 1e6 / n);
+    printf("speedup: %.2fx, predicted classes agree on %zu/%zu, max p-value difference %g\n",
+           separateQueries / fusedQueries, agree, n, maxDifference);
+    return 0;
+}
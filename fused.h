@@ -0,0 +1,13 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <string>
+
+// classify every query row by a k-NN vote and print its k neighbors (training row,
+// class, distance) and per-class p-values, all from one search of the joint index
+int runClassify(const std::string& trainFile, const std::string& queryFile, size_t k);
+
+// time the fused search against ALGLIB's k-NN model followed by the p-value scorer
+int runFusedBenchmark(const std::string& trainFile, size_t k);
+
+#endif
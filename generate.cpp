@@ -0,0 +1,217 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "alglibmisc.h"
+
+#include "generate.h"
+#include "dataset.h"
+#include "parallel.h"
+#include "measure.h"
+
+// rows generated from one random stream; fixed so the output does not depend on the threads
+static const uint64_t CHUNK_ROWS = 65536;
+
+// CSV chunks formatted per thread before their offsets are known
+static const size_t CSV_CHUNKS_PER_THREAD = 2;
+
+struct GeneratorModel {
+    std::vector<double> classWeights;   // cumulative, last entry 1
+    std::vector<double> means;          // classes x components x dim
+    std::vector<std::string> names;
+};
+
+static GeneratorModel generatorModel(const GeneratorOptions& options) {
+    GeneratorModel model;
+    double total = 0;
+    for (size_t c = 0; c < options.classes; ++c) {
+        total += 1 / std::pow(c + 1.0, options.skew);
+        model.classWeights.push_back(total);
+        model.names.push_back("class" + std::to_string(c));
+    }
+    for (double& weight : model.classWeights) {
+        weight /= total;
+    }
+    model.classWeights.back() = 1;
+
+    // the component means come from stream 0, the rows from streams 1, 2, ...
+    alglib::hqrndstate state;
+    alglib::hqrndseed(static_cast<alglib::ae_int_t>(options.seed), 0, state);
+    alglib::real_1d_array mean;
+    for (size_t i = 0; i < options.classes * options.components; ++i) {
+        alglib::hqrndnormalv(state, options.dim, mean);
+        for (size_t f = 0; f < options.dim; ++f) {
+            model.means.push_back(mean[f] * options.spread);
+        }
+    }
+    return model;
+}
+
+// the rows of one chunk, NaN for a missing value
+static void generateChunk(const GeneratorOptions& options, const GeneratorModel& model, uint64_t chunk,
+                          std::vector<uint32_t>& classes, std::vector<double>& features) {
+    alglib::hqrndstate state;
+    alglib::hqrndseed(static_cast<alglib::ae_int_t>(options.seed), static_cast<alglib::ae_int_t>(chunk + 1), state);
+    alglib::real_1d_array noise;
+    size_t dim = options.dim;
+    for (size_t i = 0; i < classes.size(); ++i) {
+        double* row = &features[i * dim];
+        if (i > 0 && alglib::hqrnduniformr(state) < options.duplicateRate) {
+            classes[i] = classes[i - 1];
+            std::copy(row - dim, row, row);
+            continue;
+        }
+        double draw = alglib::hqrnduniformr(state);
+        classes[i] = static_cast<uint32_t>(std::upper_bound(model.classWeights.begin(), model.classWeights.end(), draw) -
+                                           model.classWeights.begin());
+        classes[i] = std::min<uint32_t>(classes[i], static_cast<uint32_t>(options.classes - 1));
+        size_t component = static_cast<size_t>(alglib::hqrnduniformi(state, static_cast<alglib::ae_int_t>(options.components)));
+        const double* mean = &model.means[(classes[i] * options.components + component) * dim];
+        alglib::hqrndnormalv(state, dim, noise);
+        for (size_t f = 0; f < dim; ++f) {
+            row[f] = mean[f] + noise[f] * options.sigma;
+            if (options.missingRate > 0 && alglib::hqrnduniformr(state) < options.missingRate) {
+                row[f] = std::numeric_limits<double>::quiet_NaN();
+            }
+        }
+    }
+}
+
+static bool writeAll(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static bool writeBinary(int fd, const GeneratorOptions& options, const GeneratorModel& model, uint64_t chunks) {
+    BinaryTableHeader header = binaryTableLayout(options.rows, options.dim, options.classes);
+    if (ftruncate(fd, static_cast<off_t>(header.size)) != 0) {
+        return false;
+    }
+    std::vector<char> names(options.classes * BINARY_NAME_LENGTH, 0);
+    for (size_t c = 0; c < options.classes; ++c) {
+        strncpy(&names[c * BINARY_NAME_LENGTH], model.names[c].c_str(), BINARY_NAME_LENGTH - 1);
+    }
+    bool ok = writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) &&
+              writeAll(fd, names.data(), names.size(), header.namesOffset);
+
+    // every chunk has fixed offsets in both sections, so the chunks are written independently
+    std::atomic<bool> failed(false);
+    parallelFor(chunks, options.threads, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> classes;
+        std::vector<double> features;
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            uint64_t first = chunk * CHUNK_ROWS;
+            uint64_t rows = std::min(CHUNK_ROWS, options.rows - first);
+            classes.resize(rows);
+            features.resize(rows * options.dim);
+            generateChunk(options, model, chunk, classes, features);
+            if (!writeAll(fd, reinterpret_cast<const char*>(classes.data()), rows * sizeof(uint32_t),
+                          header.classesOffset + first * sizeof(uint32_t)) ||
+                !writeAll(fd, reinterpret_cast<const char*>(features.data()), features.size() * sizeof(double),
+                          header.featuresOffset + first * options.dim * sizeof(double))) {
+                failed = true;
+            }
+        }
+    });
+    return ok && !failed;
+}
+
+static void formatChunk(const GeneratorOptions& options, const GeneratorModel& model, uint64_t chunk, std::string& text) {
+    uint64_t rows = std::min(CHUNK_ROWS, options.rows - chunk * CHUNK_ROWS);
+    std::vector<uint32_t> classes(rows);
+    std::vector<double> features(rows * options.dim);
+    generateChunk(options, model, chunk, classes, features);
+    text.clear();
+    char number[32];
+    for (uint64_t i = 0; i < rows; ++i) {
+        for (size_t f = 0; f < options.dim; ++f) {
+            double value = features[i * options.dim + f];
+            if (value != value) {
+                text += "?,";
+            } else {
+                int length = snprintf(number, sizeof(number), "%.6g,", value);
+                text.append(number, length);
+            }
+        }
+        text += model.names[classes[i]];
+        text += '\n';
+    }
+}
+
+// CSV offsets are only known once a chunk is formatted: rounds of chunks are formatted
+// in parallel, then written in parallel at the running offset
+static bool writeCsv(int fd, const GeneratorOptions& options, const GeneratorModel& model, uint64_t chunks) {
+    size_t round = options.threads * CSV_CHUNKS_PER_THREAD;
+    std::vector<std::string> texts(round);
+    std::vector<uint64_t> offsets(round);
+    uint64_t offset = 0;
+    for (uint64_t first = 0; first < chunks; first += round) {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(round, chunks - first));
+        parallelFor(count, options.threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                formatChunk(options, model, first + i, texts[i]);
+            }
+        });
+        for (size_t i = 0; i < count; ++i) {
+            offsets[i] = offset;
+            offset += texts[i].size();
+        }
+        std::vector<char> written(count, 0);
+        parallelFor(count, options.threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                written[i] = writeAll(fd, texts[i].data(), texts[i].size(), offsets[i]);
+            }
+        });
+        if (std::find(written.begin(), written.end(), 0) != written.end()) {
+            return false;
+        }
+    }
+    return ftruncate(fd, static_cast<off_t>(offset)) == 0;
+}
+
+int runGenerator(const std::string& filename, const GeneratorOptions& options) {
+    if (options.classes == 0 || options.dim == 0 || options.components == 0) {
+        fprintf(stderr, "classes, dim and components must be at least 1\n");
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    GeneratorModel model = generatorModel(options);
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename.c_str());
+        return 1;
+    }
+    uint64_t chunks = (options.rows + CHUNK_ROWS - 1) / CHUNK_ROWS;
+    bool ok = options.binary ? writeBinary(fd, options, model, chunks) : writeCsv(fd, options, model, chunks);
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    if (!ok) {
+        perror(filename.c_str());
+        return 1;
+    }
+
+    double seconds = secondsSince(start);
+    printf("%s: %llu rows, %zu features, %zu classes (skew %g), %zu components per class, %s\n", filename.c_str(),
+           static_cast<unsigned long long>(options.rows), options.dim, options.classes, options.skew, options.components,
+           options.binary ? "binary" : "csv");
+    printf("%.1f MB in %.3f s on %zu threads (%.1f MB/s, %.0f rows/s)\n", size / 1e6, seconds, options.threads,
+           size / 1e6 / seconds, options.rows / seconds);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <string>
+#include <stdint.h>
+
+struct GeneratorOptions {
+    uint64_t rows;
+    size_t classes;
+    size_t dim;
+    double skew;             // class c is drawn with weight 1 / (c + 1)^skew, 0 for equal classes
+    size_t components;       // Gaussian mixture components of each class
+    double spread;           // sigma of the component means around the origin
+    double sigma;            // sigma of the rows around their component mean
+    double duplicateRate;    // probability that a row repeats the previous row
+    double missingRate;      // probability that a value is missing
+    uint64_t seed;
+    size_t threads;
+    bool binary;             // binary table instead of CSV
+
+    GeneratorOptions()
+        : rows(100000), classes(3), dim(4), skew(0), components(2), spread(3), sigma(1), duplicateRate(0),
+          missingRate(0), seed(1), threads(1), binary(false) {}
+};
+
+// Write a synthetic labelled dataset. Rows are generated in fixed-size chunks, each
+// from its own hqrnd stream seeded with (seed, chunk + 1), so the file is the same
+// for any thread count. CSV rows are comma separated with the class name last and
+// "?" for a missing value; binary tables follow BinaryTableHeader in dataset.h.
+int runGenerator(const std::string& filename, const GeneratorOptions& options);
+
+#endif
@@ -0,0 +1,142 @@
+#include <string>
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+
+#include "hugepage.h"
+#include "stage.h"
+
+HugePageMode hugePageMode = HUGE_PAGES_AUTO;
+
+// how a live mapping was made
+enum MappingKind { MAPPED_HUGETLB, MAPPED_ADVISED, MAPPED_SMALL, MAPPING_KINDS };
+
+static std::atomic<int64_t> mappedBytes[MAPPING_KINDS];
+static std::atomic<int64_t> peakBytes[MAPPING_KINDS];
+static std::atomic<uint64_t> mappings(0);
+
+static size_t roundUp(size_t bytes) {
+    return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+}
+
+bool startHugePages(int& argc, char* argv[]) {
+    int kept = 1;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) != "--huge-pages") {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        std::string mode = i + 1 < argc ? argv[++i] : "";
+        if (mode == "auto") {
+            hugePageMode = HUGE_PAGES_AUTO;
+        } else if (mode == "hugetlb") {
+            hugePageMode = HUGE_PAGES_HUGETLB;
+        } else if (mode == "thp") {
+            hugePageMode = HUGE_PAGES_THP;
+        } else if (mode == "off") {
+            hugePageMode = HUGE_PAGES_OFF;
+        } else {
+            valid = false;
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return valid;
+}
+
+// an anonymous mapping of length bytes starting on a 2 MB boundary
+static void* mapAligned(size_t length) {
+    size_t padded = length + HUGE_PAGE_BYTES;
+    char* mapped = static_cast<char*>(mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t address = reinterpret_cast<uintptr_t>(mapped);
+    char* aligned = reinterpret_cast<char*>((address + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES);
+    if (aligned > mapped) {
+        munmap(mapped, aligned - mapped);
+    }
+    if (mapped + padded > aligned + length) {
+        munmap(aligned + length, mapped + padded - aligned - length);
+    }
+    return aligned;
+}
+
+// the kind of every live mapping is kept in a small table, so that frees are counted right
+static const size_t MAX_MAPPINGS = 4096;
+static std::atomic<uintptr_t> mappingAddresses[MAX_MAPPINGS];
+static std::atomic<uint8_t> mappingKinds[MAX_MAPPINGS];
+
+static void remember(void* data, MappingKind kind, size_t length) {
+    int64_t bytes = static_cast<int64_t>(length);
+    raiseTo(peakBytes[kind], mappedBytes[kind].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    mappings.fetch_add(1, std::memory_order_relaxed);
+    uintptr_t address = reinterpret_cast<uintptr_t>(data);
+    for (size_t i = 0; i < MAX_MAPPINGS; ++i) {
+        uintptr_t empty = 0;
+        if (mappingAddresses[i].compare_exchange_strong(empty, address)) {
+            mappingKinds[i] = kind;
+            return;
+        }
+    }
+}
+
+static MappingKind forget(void* data) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(data);
+    for (size_t i = 0; i < MAX_MAPPINGS; ++i) {
+        if (mappingAddresses[i].load() == address) {
+            MappingKind kind = static_cast<MappingKind>(mappingKinds[i].load());
+            mappingAddresses[i] = 0;
+            return kind;
+        }
+    }
+    return MAPPED_SMALL;  // past the table
+}
+
+void* allocateLarge(size_t bytes) {
+    size_t length = roundUp(bytes);
+    if (hugePageMode == HUGE_PAGES_AUTO || hugePageMode == HUGE_PAGES_HUGETLB) {
+        void* data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            remember(data, MAPPED_HUGETLB, length);
+            return data;
+        }
+    }
+    void* data = mapAligned(length);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    bool advised = false;
+    if (hugePageMode == HUGE_PAGES_AUTO || hugePageMode == HUGE_PAGES_THP) {
+        advised = madvise(data, length, MADV_HUGEPAGE) == 0;
+    } else {
+        madvise(data, length, MADV_NOHUGEPAGE);
+    }
+    remember(data, advised ? MAPPED_ADVISED : MAPPED_SMALL, length);
+    return data;
+}
+
+void freeLarge(void* data, size_t bytes) {
+    size_t length = roundUp(bytes);
+    mappedBytes[forget(data)].fetch_sub(static_cast<int64_t>(length), std::memory_order_relaxed);
+    munmap(data, length);
+}
+
+void adviseHugePages(void* data, size_t bytes) {
+    if (hugePageMode == HUGE_PAGES_OFF) {
+        return;
+    }
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(data) + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    if (end > begin) {
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+    }
+}
+
+LargeArrayUsage largeArrayUsage() {
+    LargeArrayUsage usage = {static_cast<uint64_t>(peakBytes[MAPPED_HUGETLB].load()),
+                             static_cast<uint64_t>(peakBytes[MAPPED_ADVISED].load()),
+                             static_cast<uint64_t>(peakBytes[MAPPED_SMALL].load()), mappings.load()};
+    return usage;
+}
@@ -0,0 +1,84 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <vector>
+
+// Large arrays on 2 MB pages. An array of at least one huge page gets a mapping of
+// its own, rounded up to whole 2 MB pages and 2 MB aligned, which --huge-pages
+// fills as follows:
+//   auto     hugetlb pages, else transparent huge pages (the default)
+//   hugetlb  MAP_HUGETLB pages from the pool reserved in /proc/sys/vm/nr_hugepages,
+//            else small pages
+//   thp      an anonymous mapping marked MADV_HUGEPAGE, which the kernel backs with
+//            huge pages where it can (transparent_hugepage "madvise" or "always")
+//   off      small pages, marked MADV_NOHUGEPAGE so "always" does not apply either
+// MAP_HUGETLB fails at mmap when the pool is short, so every mode falls back to
+// small pages. Smaller arrays come from operator new. The mappings bypass the heap
+// accounting of memory.cpp; --memory-report lists them separately.
+
+static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+enum HugePageMode { HUGE_PAGES_OFF, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB, HUGE_PAGES_AUTO };
+
+// the mode of later allocations
+extern HugePageMode hugePageMode;
+
+// removes --huge-pages mode from the arguments and sets hugePageMode; false for an unknown mode
+bool startHugePages(int& argc, char* argv[]);
+
+void* allocateLarge(size_t bytes);
+void freeLarge(void* data, size_t bytes);
+
+// marks the 2 MB aligned part of a mapping made elsewhere, such as a model segment,
+// for transparent huge pages unless the mode is off
+void adviseHugePages(void* data, size_t bytes);
+
+// peak bytes of the large arrays by how they were mapped
+struct LargeArrayUsage {
+    uint64_t hugetlbBytes;
+    uint64_t advisedBytes;     // MADV_HUGEPAGE, huge only where the kernel found pages
+    uint64_t smallBytes;
+    uint64_t arrays;           // mappings made
+};
+LargeArrayUsage largeArrayUsage();
+
+// std::allocator, except that arrays of a huge page or more come from allocateLarge
+template <typename T>
+struct HugePageAllocator {
+    typedef T value_type;
+
+    HugePageAllocator() {}
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n * sizeof(T) >= HUGE_PAGE_BYTES) {
+            return static_cast<T*>(allocateLarge(n * sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* data, size_t n) {
+        if (n * sizeof(T) >= HUGE_PAGE_BYTES) {
+            freeLarge(data, n * sizeof(T));
+        } else {
+            ::operator delete(data);
+        }
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return false;
+}
+
+template <typename T>
+using HugeVector = std::vector<T, HugePageAllocator<T> >;
+
+#endif
@@ -0,0 +1,417 @@
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "kdtree.h"
+#include "trace.h"
+#include "prefetch.h"
+
+// split the tree positions [begin, end) at the median of their widest dimension
+static int32_t buildNode(KdTree& tree, const ModelView& model, std::vector<uint32_t>& order,
+                         uint32_t begin, uint32_t end, size_t leafSize) {
+    int32_t index = static_cast<int32_t>(tree.nodes.size());
+    KdNode node = {begin, end, -1, -1};
+    tree.nodes.push_back(node);
+
+    size_t dim = model.dim;
+    tree.bounds.resize(tree.nodes.size() * 2 * dim);
+    double* lower = &tree.bounds[index * 2 * dim];
+    double* upper = lower + dim;
+    std::fill(lower, lower + dim, std::numeric_limits<double>::max());
+    std::fill(upper, upper + dim, -std::numeric_limits<double>::max());
+    for (uint32_t i = begin; i < end; ++i) {
+        const double* point = model.features + static_cast<size_t>(order[i]) * dim;
+        for (size_t f = 0; f < dim; ++f) {
+            lower[f] = std::min(lower[f], point[f]);
+            upper[f] = std::max(upper[f], point[f]);
+        }
+    }
+    if (end - begin <= leafSize) {
+        return index;
+    }
+
+    size_t widest = 0;
+    for (size_t f = 1; f < dim; ++f) {
+        if (upper[f] - lower[f] > upper[widest] - lower[widest]) {
+            widest = f;
+        }
+    }
+    if (upper[widest] == lower[widest]) {
+        return index;  // all points equal
+    }
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                     [&model, widest](uint32_t a, uint32_t b) {
+                         return model.features[a * model.dim + widest] < model.features[b * model.dim + widest];
+                     });
+
+    int32_t left = buildNode(tree, model, order, begin, middle, leafSize);
+    int32_t right = buildNode(tree, model, order, middle, end, leafSize);
+    tree.nodes[index].left = left;
+    tree.nodes[index].right = right;
+    return index;
+}
+
+KdTree buildKdTree(const ModelView& model, size_t leafSize) {
+    TRACE_SPAN("stage", "buildKdTree");
+    KdTree tree;
+    tree.dim = model.dim;
+    std::vector<uint32_t> order(model.rows);
+    for (size_t i = 0; i < model.rows; ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    if (model.rows > 0) {
+        buildNode(tree, model, order, 0, static_cast<uint32_t>(model.rows), std::max<size_t>(1, leafSize));
+    }
+
+    // class masks of the leaves, then of the inner nodes bottom-up (children follow their parent)
+    tree.classMasks.assign(tree.nodes.size(), 0);
+    for (size_t node = tree.nodes.size(); node-- > 0;) {
+        const KdNode& current = tree.nodes[node];
+        if (current.left >= 0) {
+            tree.classMasks[node] = tree.classMasks[current.left] | tree.classMasks[current.right];
+            continue;
+        }
+        for (uint32_t i = current.begin; i < current.end; ++i) {
+            size_t classIndex = std::upper_bound(model.classOffsets, model.classOffsets + model.classCount + 1, order[i]) - model.classOffsets - 1;
+            tree.classMasks[node] |= static_cast<uint64_t>(1) << std::min<size_t>(classIndex, 63);
+        }
+    }
+
+    tree.rows.assign(order.begin(), order.end());
+    tree.points.resize(model.rows * model.dim);
+    tree.classes.resize(model.rows);
+    for (size_t i = 0; i < model.rows; ++i) {
+        std::copy(model.features + order[i] * model.dim, model.features + (order[i] + 1) * model.dim, &tree.points[i * model.dim]);
+        tree.classes[i] = static_cast<uint32_t>(std::upper_bound(model.classOffsets, model.classOffsets + model.classCount + 1, order[i]) - model.classOffsets - 1);
+    }
+    return tree;
+}
+
+// squared distance from a query to the bounding box of a node
+static double boxDistance(const KdTree& tree, int32_t node, const double* query) {
+    const double* lower = &tree.bounds[node * 2 * tree.dim];
+    const double* upper = lower + tree.dim;
+    double sum = 0.0;
+    for (size_t f = 0; f < tree.dim; ++f) {
+        double diff = query[f] < lower[f] ? lower[f] - query[f] : (query[f] > upper[f] ? query[f] - upper[f] : 0.0);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+// true if a node at squared distance boxSum may still hold the nearest row of one of its classes
+static bool improvesClass(uint64_t mask, const double* classBest, size_t classCount, double boxSum) {
+    for (size_t c = 0; c < classCount; ++c) {
+        uint64_t bit = static_cast<uint64_t>(1) << std::min<size_t>(c, 63);
+        if ((mask & bit) && boxSum < classBest[c]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool fartherNeighbor(const Neighbor& a, const Neighbor& b) {
+    return a.distance < b.distance;
+}
+
+// what the pruning test of a node reads
+static void prefetchNode(const KdTree& tree, int32_t node) {
+    if (prefetchDistance > 0) {
+        prefetchBytes(&tree.nodes[node], sizeof(KdNode));
+        prefetchBytes(&tree.bounds[node * 2 * tree.dim], 2 * tree.dim * sizeof(double));
+        prefetchBytes(&tree.classMasks[node], sizeof(uint64_t));
+    }
+}
+
+// what visiting a node reads: the bounds of its children, or the first rows of its leaf
+static void prefetchVisit(const KdTree& tree, const KdNode& node) {
+    if (prefetchDistance == 0) {
+        return;
+    }
+    if (node.left >= 0) {
+        prefetchNode(tree, node.left);
+        prefetchNode(tree, node.right);
+        return;
+    }
+    uint32_t rows = node.end - node.begin;
+    uint32_t ahead = std::min<uint32_t>(rows, prefetchDistance);
+    prefetchBytes(&tree.points[static_cast<size_t>(node.begin) * tree.dim], ahead * tree.dim * sizeof(double));
+    prefetchBytes(&tree.rows[node.begin], rows * sizeof(uint32_t));
+    prefetchBytes(&tree.classes[node.begin], rows * sizeof(uint32_t));
+}
+
+// One query of a tree search, taken in steps. A step pops a node and, unless it is
+// pruned, prefetches what visiting it reads (the bounds of its children, or the first
+// rows of its leaf); the next step visits it. A search on its own takes the steps
+// back to back; a group search lets the other queries take one step in between.
+struct TreeWalk {
+    const double* query;
+    std::vector<int32_t>* stack;
+    std::vector<Neighbor>* heap;   // the k best so far by squared distance, a max-heap
+    size_t k;
+    double kBound;
+    int32_t pending;               // popped node to be visited by the next step, -1 if none
+    bool done;
+    uint64_t scanned;
+};
+
+// nearestNeighbors: prunes at the k-th best shrunk by 1 + epsilon
+struct NearestWalk : TreeWalk {
+    double shrink;
+
+    bool pruned(const KdTree&, int32_t, double boxSum) const {
+        return boxSum >= kBound;
+    }
+    void scanRow(const KdTree& tree, uint32_t i, double sum) {
+        Neighbor neighbor = {sum, tree.rows[i], tree.classes[i]};
+        if (heap->size() < k) {
+            heap->push_back(neighbor);
+            std::push_heap(heap->begin(), heap->end(), fartherNeighbor);
+        } else if (sum < heap->front().distance) {
+            std::pop_heap(heap->begin(), heap->end(), fartherNeighbor);
+            heap->back() = neighbor;
+            std::push_heap(heap->begin(), heap->end(), fartherNeighbor);
+        }
+    }
+    void leafScanned() {
+        if (heap->size() == k) {
+            kBound = heap->front().distance * shrink;
+        }
+    }
+};
+
+// fusedQuery: a node is only skipped if it can improve neither the k best nor any of its classes
+struct FusedWalk : TreeWalk {
+    double* classBest;
+    size_t classCount;
+
+    bool pruned(const KdTree& tree, int32_t node, double boxSum) const {
+        return boxSum >= kBound && !improvesClass(tree.classMasks[node], classBest, classCount, boxSum);
+    }
+    void scanRow(const KdTree& tree, uint32_t i, double sum) {
+        uint32_t classIndex = tree.classes[i];
+        if (sum < classBest[classIndex]) {
+            classBest[classIndex] = sum;
+        }
+        if (heap->size() < k) {
+            Neighbor neighbor = {sum, tree.rows[i], classIndex};
+            heap->push_back(neighbor);
+            std::push_heap(heap->begin(), heap->end(), fartherNeighbor);
+        } else if (k > 0 && sum < heap->front().distance) {
+            std::pop_heap(heap->begin(), heap->end(), fartherNeighbor);
+            Neighbor neighbor = {sum, tree.rows[i], classIndex};
+            heap->back() = neighbor;
+            std::push_heap(heap->begin(), heap->end(), fartherNeighbor);
+        }
+    }
+    void leafScanned() {
+        kBound = heap->size() < k ? std::numeric_limits<double>::max() : (k > 0 ? heap->front().distance : 0.0);
+    }
+};
+
+// one step of a walk; false once the walk is done
+template <typename Walk>
+static bool walkStep(const KdTree& tree, Walk& walk) {
+    size_t dim = tree.dim;
+    std::vector<int32_t>& stack = *walk.stack;
+    if (walk.pending < 0) {
+        int32_t node = stack.back();
+        stack.pop_back();
+        if (!walk.pruned(tree, node, boxDistance(tree, node, walk.query))) {
+            prefetchVisit(tree, tree.nodes[node]);
+            walk.pending = node;
+            return true;
+        }
+    } else {
+        const KdNode& current = tree.nodes[walk.pending];
+        walk.pending = -1;
+        if (current.left >= 0) {
+            // visit the nearer child first; both were prefetched when the node was popped
+            bool leftFirst = boxDistance(tree, current.left, walk.query) <= boxDistance(tree, current.right, walk.query);
+            stack.push_back(leftFirst ? current.right : current.left);
+            stack.push_back(leftFirst ? current.left : current.right);
+            return true;
+        }
+        walk.scanned += current.end - current.begin;
+        for (uint32_t i = current.begin; i < current.end; ++i) {
+            prefetchAhead(tree.points.data(), dim, i, current.end);
+            const double* point = &tree.points[static_cast<size_t>(i) * dim];
+            double sum = 0.0;
+            for (size_t f = 0; f < dim; ++f) {
+                sum += (walk.query[f] - point[f]) * (walk.query[f] - point[f]);
+            }
+            walk.scanRow(tree, i, sum);
+        }
+        walk.leafScanned();
+    }
+    if (stack.empty()) {
+        return false;
+    }
+    prefetchNode(tree, stack.back());
+    return true;
+}
+
+// the walks from the root, one step each in turn, until all are done
+template <typename Walk>
+static void walkGroup(const KdTree& tree, Walk* walks, size_t count) {
+    size_t active = 0;
+    for (size_t q = 0; q < count; ++q) {
+        walks[q].stack->clear();
+        walks[q].pending = -1;
+        walks[q].scanned = 0;
+        walks[q].done = tree.nodes.empty();
+        if (!walks[q].done) {
+            walks[q].stack->push_back(0);
+            ++active;
+        }
+    }
+    if (active > 0) {
+        prefetchNode(tree, 0);
+    }
+    while (active > 0) {
+        for (size_t q = 0; q < count; ++q) {
+            if (!walks[q].done && !walkStep(tree, walks[q])) {
+                walks[q].done = true;
+                --active;
+            }
+        }
+    }
+    uint64_t scanned = 0;
+    for (size_t q = 0; q < count; ++q) {
+        scanned += walks[q].scanned;
+    }
+    countStageItems(scanned);
+}
+
+static void startNearest(NearestWalk& walk, const double* query, size_t k, std::vector<Neighbor>& heap,
+                         std::vector<int32_t>& stack, double epsilon) {
+    walk.query = query;
+    walk.stack = &stack;
+    walk.heap = &heap;
+    walk.k = k;
+    walk.kBound = std::numeric_limits<double>::max();
+    walk.shrink = 1.0 / ((1.0 + epsilon) * (1.0 + epsilon));  // on squared distances
+    heap.clear();
+}
+
+static size_t finishNearest(std::vector<Neighbor>& heap, Neighbor* neighbors) {
+    std::sort_heap(heap.begin(), heap.end(), fartherNeighbor);
+    for (size_t i = 0; i < heap.size(); ++i) {
+        neighbors[i] = heap[i];
+        neighbors[i].distance = std::sqrt(heap[i].distance);
+    }
+    return heap.size();
+}
+
+size_t nearestNeighbors(const KdTree& tree, const double* query, size_t k, std::vector<Neighbor>& heap,
+                        std::vector<int32_t>& stack, Neighbor* neighbors, double epsilon) {
+    k = std::min(k, tree.rows.size());
+    heap.clear();
+    stack.clear();
+    if (k == 0) {
+        return 0;
+    }
+    NearestWalk walk;
+    startNearest(walk, query, k, heap, stack, epsilon);
+    walkGroup(tree, &walk, 1);
+    return finishNearest(heap, neighbors);
+}
+
+void nearestNeighborsGroup(const KdTree& tree, const double* queries, size_t count, size_t k,
+                           std::vector<FusedScratch>& scratch, Neighbor* neighbors, size_t* found, double epsilon) {
+    size_t kept = std::min(k, tree.rows.size());
+    if (kept == 0) {
+        std::fill(found, found + count, 0);
+        return;
+    }
+    size_t group = std::min(queryGroup, count);
+    if (scratch.size() < group) {
+        scratch.resize(group);
+    }
+    std::vector<NearestWalk> walks(group);
+    for (size_t first = 0; first < count; first += group) {
+        size_t size = std::min(group, count - first);
+        for (size_t q = 0; q < size; ++q) {
+            startNearest(walks[q], queries + (first + q) * tree.dim, kept, scratch[q].heap, scratch[q].stack, epsilon);
+        }
+        walkGroup(tree, walks.data(), size);
+        for (size_t q = 0; q < size; ++q) {
+            found[first + q] = finishNearest(scratch[q].heap, neighbors + (first + q) * k);
+        }
+    }
+}
+
+static void startFused(FusedWalk& walk, const ModelView& model, const double* row, size_t k, FusedScratch& scratch) {
+    size_t dim = model.dim;
+    scratch.query.resize(dim);
+    for (size_t f = 0; f < dim; ++f) {
+        scratch.query[f] = (row[f] - model.means[f]) / model.sigmas[f];
+    }
+    // squared distances while searching: a max-heap of the k best, and the best of each class
+    scratch.heap.clear();
+    scratch.classBest.assign(model.classCount, std::numeric_limits<double>::max());
+    walk.query = scratch.query.data();
+    walk.stack = &scratch.stack;
+    walk.heap = &scratch.heap;
+    walk.k = std::min(k, model.rows);
+    walk.kBound = std::numeric_limits<double>::max();
+    walk.classBest = scratch.classBest.data();
+    walk.classCount = model.classCount;
+}
+
+static size_t finishFused(const ModelView& model, FusedScratch& scratch, Neighbor* neighbors, double* distances,
+                          double* pValues) {
+    for (size_t c = 0; c < model.classCount; ++c) {
+        distances[c] = std::sqrt(scratch.classBest[c]);
+        pValues[c] = classPValue(model, c, distances[c]);
+    }
+
+    // k nearest first, then the vote
+    std::vector<Neighbor>& heap = scratch.heap;
+    std::sort_heap(heap.begin(), heap.end(), fartherNeighbor);
+    scratch.votes.assign(model.classCount, 0);
+    for (size_t i = 0; i < heap.size(); ++i) {
+        neighbors[i] = heap[i];
+        neighbors[i].distance = std::sqrt(heap[i].distance);
+        ++scratch.votes[heap[i].classIndex];
+    }
+    size_t predicted = heap.empty() ? 0 : heap[0].classIndex;
+    for (size_t i = 0; i < heap.size(); ++i) {
+        if (scratch.votes[heap[i].classIndex] > scratch.votes[predicted]) {
+            predicted = heap[i].classIndex;
+        }
+    }
+    return predicted;
+}
+
+size_t fusedQuery(const ModelView& model, const KdTree& tree, const double* row, size_t k,
+                  FusedScratch& scratch, Neighbor* neighbors, double* distances, double* pValues) {
+    FusedWalk walk;
+    startFused(walk, model, row, k, scratch);
+    walkGroup(tree, &walk, 1);
+    return finishFused(model, scratch, neighbors, distances, pValues);
+}
+
+void fusedQueryGroup(const ModelView& model, const KdTree& tree, const double* const* rows, size_t count, size_t k,
+                     std::vector<FusedScratch>& scratch, Neighbor* neighbors, double* distances, double* pValues,
+                     size_t* predicted) {
+    size_t group = std::min(queryGroup, count);
+    if (scratch.size() < group) {
+        scratch.resize(group);
+    }
+    std::vector<FusedWalk> walks(group);
+    size_t classCount = model.classCount;
+    for (size_t first = 0; first < count; first += group) {
+        size_t size = std::min(group, count - first);
+        for (size_t q = 0; q < size; ++q) {
+            startFused(walks[q], model, rows[first + q], k, scratch[q]);
+        }
+        walkGroup(tree, walks.data(), size);
+        for (size_t q = 0; q < size; ++q) {
+            size_t i = first + q;
+            predicted[i] = finishFused(model, scratch[q], neighbors + i * k, distances + i * classCount, pValues + i * classCount);
+        }
+    }
+}
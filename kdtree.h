@@ -0,0 +1,70 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "model.h"
+
+struct KdNode {
+    uint32_t begin;   // first tree position of the node
+    uint32_t end;     // one past the last tree position
+    int32_t left;     // child nodes, -1 for a leaf
+    int32_t right;
+};
+
+// Joint kd-tree over the rows of every class of a model. The rows are copied in
+// tree order so that a leaf is one contiguous block, and each node keeps its
+// bounding box for pruning.
+struct KdTree {
+    size_t dim;
+    HugeVector<KdNode> nodes;        // node 0 is the root
+    HugeVector<double> bounds;       // per node: dim lower bounds, then dim upper bounds
+    HugeVector<uint64_t> classMasks;   // per node: bit c set if class c has rows in the node (bit 63: class >= 63)
+    HugeVector<double> points;       // model rows in tree order
+    HugeVector<uint32_t> rows;       // model row of each tree position
+    HugeVector<uint32_t> classes;    // class of each tree position
+};
+
+KdTree buildKdTree(const ModelView& model, size_t leafSize = 8);
+
+struct Neighbor {
+    double distance;
+    uint32_t row;
+    uint32_t classIndex;
+};
+
+// per-thread scratch space of fusedQuery, reused across queries
+struct FusedScratch {
+    std::vector<double> query;
+    std::vector<Neighbor> heap;
+    std::vector<double> classBest;
+    std::vector<size_t> votes;
+    std::vector<int32_t> stack;
+};
+
+// k nearest rows to an already normalized query, nearest first; returns how many were found.
+// With epsilon > 0 a node is pruned unless it may hold a row closer than the k-th best
+// divided by 1 + epsilon, so each found distance is within that factor of the exact one.
+size_t nearestNeighbors(const KdTree& tree, const double* query, size_t k, std::vector<Neighbor>& heap,
+                        std::vector<int32_t>& stack, Neighbor* neighbors, double epsilon = 0.0);
+
+// One traversal of the joint tree that finds both the k nearest labelled neighbors
+// and the nearest neighbor of every class. Fills neighbors (k entries, nearest
+// first), the per-class distances and p-values, and returns the class predicted by
+// the k-NN vote (ties go to the class of the nearer neighbor).
+size_t fusedQuery(const ModelView& model, const KdTree& tree, const double* row, size_t k,
+                  FusedScratch& scratch, Neighbor* neighbors, double* distances, double* pValues);
+
+// The same searches for count queries, queryGroup of them interleaved at a time (see
+// prefetch.h); each query gets the results it would get on its own. scratch grows to
+// one entry per query in flight. nearestNeighborsGroup takes count normalized queries
+// of tree.dim values and fills k neighbors and the found count per query.
+void nearestNeighborsGroup(const KdTree& tree, const double* queries, size_t count, size_t k,
+                           std::vector<FusedScratch>& scratch, Neighbor* neighbors, size_t* found, double epsilon = 0.0);
+// fusedQuery of count raw rows: k neighbors, classCount distances and p-values and the predicted class per row
+void fusedQueryGroup(const ModelView& model, const KdTree& tree, const double* const* rows, size_t count, size_t k,
+                     std::vector<FusedScratch>& scratch, Neighbor* neighbors, double* distances, double* pValues,
+                     size_t* predicted);
+
+#endif
@@ -4,45 +4,645 @@
 #include <sstream>
 #include <fstream>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
 
 #include "fit.h"
 #include "process.h"
 #include "classMember.h"
+#include "dataset.h"
+#include "stream.h"
+#include "model.h"
+#include "segment.h"
+#include "fused.h"
+#include "calibrate.h"
+#include "crossval.h"
+#include "counters.h"
+#include "permutation.h"
+#include "batch.h"
+#include "sweep.h"
+#include "scaling.h"
+#include "pareto.h"
+#include "fitcheck.h"
+#include "numabench.h"
+#include "numa.h"
+#include "hugepage.h"
+#include "prefetch.h"
+#include "prefetchbench.h"
+#include "reader.h"
+#include "readbench.h"
+#include "reduce.h"
+#include "reducebench.h"
+#include "sparse.h"
+#include "generate.h"
+#include "memory.h"
+#include "parallel.h"
 
 using namespace std;
 
-// Read the dataset from a file
-std::vector<ClassMember> readDataset(const std::string& filename) {
-    std::vector<ClassMember> dataset;
-    std::ifstream file(filename);
-    std::string line;
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s\n", program);
+    fprintf(stderr, "       %s --stream file [--window rows] [--window-seconds s] [--refit rows] [--alpha p] [--verbose]\n", program);
+    fprintf(stderr, "       %s --publish file location\n", program);
+    fprintf(stderr, "       %s --segment-report file [--workers n] [--segment location]\n", program);
+    fprintf(stderr, "       %s --classify train.data queries.data [--k k]\n", program);
+    fprintf(stderr, "       %s --fused-bench file [--k k]\n", program);
+    fprintf(stderr, "       %s --calibrate file [--threads n] [--bins b]\n", program);
+    fprintf(stderr, "       %s --cv file [--folds k] [--threads n] [--seed s] [--shared-normalization] [table options]\n", program);
+    fprintf(stderr, "       %s --permutation-test file [--replicates b] [--threads n] [--seed s] [--neighbors m] [table options]\n", program);
+    fprintf(stderr, "       %s --batch spec [--threads n] [--output results.json]\n", program);
+    fprintf(stderr, "       %s --sweep file [--k k,...] [--cutoff d,...] [--duplicates unique,keep] [--families all,logistic+tanh,...] [--threads n] [--leaf n] [table options]\n", program);
+    fprintf(stderr, "       %s --generate output [--rows n] [--classes k] [--dim d] [--skew s] [--components m] [--spread s] [--sigma s]\n"
+                    "                   [--duplicates rate] [--missing rate] [--seed s] [--threads n] [--binary]\n", program);
+    fprintf(stderr, "       %s --scaling file [--threads 1,2,4,...] [--repetitions r] [--mode strong|weak|both] [--k k] [--leaf n] [--floor e] [table options]\n", program);
+    fprintf(stderr, "       %s --pareto file [--holdout fraction] [--seed s] [--leaf n] [--repetitions r] [table options]\n", program);
+    fprintf(stderr, "       %s --fit-dump file [--output fits.txt] [table options]\n", program);
+    fprintf(stderr, "       %s --fit-check file --reference fits.txt [--tolerance t] [table options]\n", program);
+    fprintf(stderr, "       %s --numa-bench file [--threads n] [--size MB] [--repetitions r] [table options]\n", program);
+    fprintf(stderr, "       %s --prefetch-bench file [--distances 0,2,4,...] [--groups 1,2,4,...] [--queries n] [--scan-queries n]\n"
+                    "                         [--k k] [--leaf n] [--repetitions r] [table options]\n", program);
+    fprintf(stderr, "       %s --sparse file [--threads n] [--check]\n", program);
+    fprintf(stderr, "       %s --reduce-bench file [--threads 1,2,4,...] [--repetitions r] [table options]\n", program);
+    fprintf(stderr, "       %s --read-bench file... [--block KB] [--depth n] [--threads n] [--repetitions r] [table options]\n", program);
+    fprintf(stderr, "every mode also takes [--memory-report] [--memory-budget size[K|M|G]] [--memory-sample ms] [--counters]\n"
+                    "                      [--numa all|off|pin,place,replicate] [--huge-pages auto|hugetlb|thp|off]\n"
+                    "                      [--prefetch-distance rows] [--query-group n] [--reader auto|uring|pread|stream]\n"
+                    "                      [--reproducible]\n");
+    fprintf(stderr, "table options: [--delimiter c] [--label-column i] [--skip-column i]...\n");
+    fprintf(stderr, "locations are shm:/name for POSIX shared memory or a file path (e.g. on hugetlbfs)\n");
+}
+
+static int streamMain(int argc, char* argv[]) {
+    StreamOptions options;
+    options.filename = argv[2];
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (i + 1 < argc && arg == "--window") {
+            options.windowRows = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--window-seconds") {
+            options.windowSeconds = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--refit") {
+            options.refitEvery = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--alpha") {
+            options.alpha = std::stod(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    return runStream(options);
+}
+
+static int publishMain(int argc, char* argv[]) {
+    std::vector<ClassMember> dataset = readDataset(argv[2]);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", argv[2]);
+        return 1;
+    }
+    Model model = trainModel(dataset);
+    if (!publishSegment(model, argv[3])) {
+        return 1;
+    }
+    printf("Published %zu bytes to %s\n", segmentSize(model), argv[3]);
+    return 0;
+}
+
+static int segmentReportMain(int argc, char* argv[]) {
+    size_t workers = 4;
+    std::string location = "shm:/pidentify-report-" + std::to_string(getpid());
+    bool temporary = true;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--workers") {
+            workers = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--segment") {
+            location = argv[++i];
+            temporary = false;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    int status = runSegmentReport(argv[2], location, workers);
+    if (temporary) {
+        removeSegment(location);
+    }
+    return status;
+}
+
+static int calibrateMain(int argc, char* argv[]) {
+    size_t threads = defaultThreadCount(), bins = 10;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--threads") {
+            threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--bins") {
+            bins = std::max(1ul, std::stoul(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    return runCalibration(argv[2], threads, bins);
+}
+
+static int crossValidationMain(int argc, char* argv[]) {
+    CrossValidationOptions options;
+    TableFormat format;
+    options.threads = defaultThreadCount();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shared-normalization") {
+            options.sharedNormalization = true;
+        } else if (i + 1 < argc && arg == "--folds") {
+            options.folds = std::max(2ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--seed") {
+            options.seed = std::stoull(argv[++i]);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    return runCrossValidation(argv[2], format, options);
+}
+
+static int permutationMain(int argc, char* argv[]) {
+    PermutationOptions options;
+    TableFormat format;
+    options.threads = defaultThreadCount();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--replicates") {
+            options.replicates = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--seed") {
+            options.seed = std::stoull(argv[++i]);
+        } else if (i + 1 < argc && arg == "--neighbors") {
+            options.neighbors = std::max(1ul, std::stoul(argv[++i]));
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    return runPermutationTest(argv[2], format, options);
+}
+
+static int batchMain(int argc, char* argv[]) {
+    size_t threads = defaultThreadCount();
+    std::string output = "batch-results.json";
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--threads") {
+            threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--output") {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    return runBatch(argv[2], threads, output);
+}
 
-    while (std::getline(file, line)) {
-        if (line.empty()) {
-            continue;  // Skip the empty lines
+static int generateMain(int argc, char* argv[]) {
+    GeneratorOptions options;
+    options.threads = defaultThreadCount();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--binary") {
+            options.binary = true;
+        } else if (i + 1 < argc && arg == "--rows") {
+            options.rows = std::stoull(argv[++i]);
+        } else if (i + 1 < argc && arg == "--classes") {
+            options.classes = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--dim") {
+            options.dim = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--skew") {
+            options.skew = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--components") {
+            options.components = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--spread") {
+            options.spread = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--sigma") {
+            options.sigma = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--duplicates") {
+            options.duplicateRate = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--missing") {
+            options.missingRate = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--seed") {
+            options.seed = std::stoull(argv[++i]);
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::max(1ul, std::stoul(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return 1;
         }
+    }
+    return runGenerator(argv[2], options);
+}
 
-        std::stringstream ss(line);
-        ClassMember obj;
-        std::string feature;
+// the comma separated items of a list option
+static std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
 
-        while (std::getline(ss, feature, ',')) {
-            if (isdigit(feature[0]) || feature[0] == '-') {
-                obj.features.push_back(std::stod(feature));
-            } else {
-                assert(obj.name == "");
-                assert(feature != "");
-                obj.name = feature;
+static int sweepMain(int argc, char* argv[]) {
+    SweepOptions options;
+    TableFormat format;
+    options.threads = defaultThreadCount();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--k") {
+            for (const auto& item : splitList(argv[++i])) {
+                size_t k;
+                if (!parseCount(item, k)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                options.ks.push_back(k);
+            }
+        } else if (i + 1 < argc && arg == "--cutoff") {
+            for (const auto& item : splitList(argv[++i])) {
+                double cutoff;
+                if (!parseNumber(item, cutoff)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                options.cutoffs.push_back(cutoff);
+            }
+        } else if (i + 1 < argc && arg == "--duplicates") {
+            for (const auto& item : splitList(argv[++i])) {
+                if (item != "unique" && item != "keep") {
+                    usage(argv[0]);
+                    return 1;
+                }
+                options.keepDuplicates.push_back(item == "keep");
             }
+        } else if (i + 1 < argc && arg == "--families") {
+            for (const auto& item : splitList(argv[++i])) {
+                uint32_t mask = sigmoidFamilyMask(item);
+                if (mask == 0) {
+                    fprintf(stderr, "Unknown sigmoid family in '%s'\n", item.c_str());
+                    return 1;
+                }
+                options.familyMasks.push_back(mask);
+                options.familyNames.push_back(item);
+            }
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--leaf") {
+            options.leafSize = std::max(1ul, std::stoul(argv[++i]));
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
         }
-        dataset.push_back(obj);
     }
+    // unswept parameters keep the values of a plain training run
+    if (options.ks.empty()) {
+        options.ks.push_back(5);
+    }
+    if (options.cutoffs.empty()) {
+        options.cutoffs.push_back(NN_DISTANCE_CUTOFF);
+    }
+    if (options.keepDuplicates.empty()) {
+        options.keepDuplicates.push_back(false);
+    }
+    if (options.familyMasks.empty()) {
+        options.familyMasks.push_back(ALL_SIGMOID_FAMILIES);
+        options.familyNames.push_back("all");
+    }
+    return runSweep(argv[2], format, options);
+}
 
-    //std::cout << "feature size:" << dataset[0].features.size() << std::endl;
-    return dataset;
+static int scalingMain(int argc, char* argv[]) {
+    ScalingOptions options;
+    TableFormat format;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--threads") {
+            for (const auto& item : splitList(argv[++i])) {
+                options.threads.push_back(std::max(1ul, std::stoul(item)));
+            }
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            options.repetitions = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--mode") {
+            std::string mode = argv[++i];
+            if (mode != "strong" && mode != "weak" && mode != "both") {
+                usage(argv[0]);
+                return 1;
+            }
+            options.strong = mode != "weak";
+            options.weak = mode != "strong";
+        } else if (i + 1 < argc && arg == "--k") {
+            options.k = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--leaf") {
+            options.leafSize = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--floor") {
+            options.floor = std::stod(argv[++i]);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    return runScaling(argv[2], format, options);
 }
 
-int main() {
+static int paretoMain(int argc, char* argv[]) {
+    ParetoOptions options;
+    TableFormat format;
+    bool ok = true;
+    for (int i = 3; ok && i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--holdout") {
+            ok = parseNumber(argv[++i], options.holdout) && options.holdout > 0 && options.holdout < 1;
+        } else if (i + 1 < argc && arg == "--seed") {
+            size_t seed = 0;
+            ok = parseCount(argv[++i], seed, 0);
+            options.seed = seed;
+        } else if (i + 1 < argc && arg == "--leaf") {
+            ok = parseCount(argv[++i], options.leafSize);
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            ok = parseCount(argv[++i], options.repetitions);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            ok = false;
+        } else {
+            ++i;
+        }
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return 1;
+    }
+    return runPareto(argv[2], format, options);
+}
+
+static int numaBenchMain(int argc, char* argv[]) {
+    NumaBenchmarkOptions options;
+    options.threads = defaultThreadCount();
+    TableFormat format;
+    bool ok = true;
+    for (int i = 3; ok && i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--threads") {
+            ok = parseCount(argv[++i], options.threads);
+        } else if (i + 1 < argc && arg == "--size") {
+            ok = parseCount(argv[++i], options.megabytes);
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            ok = parseCount(argv[++i], options.repetitions);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            ok = false;
+        } else {
+            ++i;
+        }
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return 1;
+    }
+    return runNumaBenchmark(argv[2], format, options);
+}
+
+static int prefetchBenchMain(int argc, char* argv[]) {
+    PrefetchBenchmarkOptions options;
+    TableFormat format;
+    bool ok = true;
+    for (int i = 3; ok && i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "--distances" || arg == "--groups")) {
+            // a prefetch distance of 0 turns prefetching off, a query group holds at least one query
+            bool distances = arg == "--distances";
+            for (const auto& item : splitList(argv[++i])) {
+                size_t value = 0;
+                ok = ok && parseCount(item, value, distances ? 0 : 1);
+                (distances ? options.distances : options.groups).push_back(value);
+            }
+        } else if (i + 1 < argc && arg == "--queries") {
+            ok = parseCount(argv[++i], options.queries);
+        } else if (i + 1 < argc && arg == "--scan-queries") {
+            ok = parseCount(argv[++i], options.scanQueries);
+        } else if (i + 1 < argc && arg == "--k") {
+            ok = parseCount(argv[++i], options.k);
+        } else if (i + 1 < argc && arg == "--leaf") {
+            ok = parseCount(argv[++i], options.leafSize);
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            ok = parseCount(argv[++i], options.repetitions);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            ok = false;
+        } else {
+            ++i;
+        }
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return 1;
+    }
+    return runPrefetchBenchmark(argv[2], format, options);
+}
+
+static int sparseMain(int argc, char* argv[]) {
+    SparseOptions options;
+    options.threads = defaultThreadCount();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--check") {
+            options.check = true;
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::max(1ul, std::stoul(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    return runSparse(argv[2], options);
+}
+
+static int reduceBenchMain(int argc, char* argv[]) {
+    ReduceBenchmarkOptions options;
+    TableFormat format;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--threads") {
+            for (const auto& item : splitList(argv[++i])) {
+                options.threads.push_back(std::stoul(item));
+            }
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            options.repetitions = std::max(1ul, std::stoul(argv[++i]));
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    return runReduceBenchmark(argv[2], format, options);
+}
+
+static int readBenchMain(int argc, char* argv[]) {
+    ReadBenchmarkOptions options;
+    TableFormat format;
+    std::vector<std::string> files;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            files.push_back(arg);
+        } else if (i + 1 < argc && arg == "--block") {
+            options.blockKB = std::max(4ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--depth") {
+            options.depth = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--threads") {
+            options.threads = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--repetitions") {
+            options.repetitions = std::max(1ul, std::stoul(argv[++i]));
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    if (files.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    return runReadBenchmark(files, format, options);
+}
+
+// --fit-dump and --fit-check
+static int fitCheckMain(int argc, char* argv[]) {
+    bool check = std::string(argv[1]) == "--fit-check";
+    std::string output, reference;
+    double tolerance = 1e-6;
+    TableFormat format;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (!check && i + 1 < argc && arg == "--output") {
+            output = argv[++i];
+        } else if (check && i + 1 < argc && arg == "--reference") {
+            reference = argv[++i];
+        } else if (check && i + 1 < argc && arg == "--tolerance") {
+            tolerance = std::stod(argv[++i]);
+        } else if (!(i + 1 < argc && parseTableOption(arg, argv[i + 1], format))) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            ++i;
+        }
+    }
+    if (check && reference.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    return check ? runFitCheck(argv[2], format, reference, tolerance) : runFitDump(argv[2], format, output);
+}
+
+// the largest value of a "--threads n" or "--threads 1,2,4" option, else fallback
+static size_t threadsOption(int argc, char* argv[], size_t fallback) {
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--threads") {
+            size_t threads = 1;
+            std::stringstream list(argv[i + 1]);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                threads = std::max(threads, std::stoul(item));
+            }
+            return threads;
+        }
+    }
+    return fallback;
+}
+
+// value of a trailing "--k k" option
+static bool parseK(int argc, char* argv[], int first, size_t& k) {
+    k = 5;
+    if (argc == first) {
+        return true;
+    }
+    if (argc == first + 2 && std::string(argv[first]) == "--k") {
+        k = std::max(1ul, std::stoul(argv[first + 1]));
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    if (!startMemoryAccounting(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    startCounters(argc, argv);
+    startReductions(argc, argv);
+    if (!startNuma(argc, argv) || !startHugePages(argc, argv) || !startPrefetch(argc, argv) ||
+        !startReader(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    // one ALGLIB worker in the reproducible mode, whose parallel solvers would split sums by worker
+    setFitWorkers(reproducibleReductions ? 1 : threadsOption(argc, argv, defaultThreadCount()));
+    size_t k;
+    if (argc > 2 && std::string(argv[1]) == "--stream") {
+        return streamMain(argc, argv);
+    } else if (argc == 4 && std::string(argv[1]) == "--publish") {
+        return publishMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--segment-report") {
+        return segmentReportMain(argc, argv);
+    } else if (argc > 3 && std::string(argv[1]) == "--classify" && parseK(argc, argv, 4, k)) {
+        return runClassify(argv[2], argv[3], k);
+    } else if (argc > 2 && std::string(argv[1]) == "--fused-bench" && parseK(argc, argv, 3, k)) {
+        return runFusedBenchmark(argv[2], k);
+    } else if (argc > 2 && std::string(argv[1]) == "--calibrate") {
+        return calibrateMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--cv") {
+        return crossValidationMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--permutation-test") {
+        return permutationMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--batch") {
+        return batchMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--sweep") {
+        return sweepMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--scaling") {
+        return scalingMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--pareto") {
+        return paretoMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--numa-bench") {
+        return numaBenchMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--prefetch-bench") {
+        return prefetchBenchMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--sparse") {
+        return sparseMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--reduce-bench") {
+        return reduceBenchMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--read-bench") {
+        return readBenchMain(argc, argv);
+    } else if (argc > 2 && (std::string(argv[1]) == "--fit-dump" || std::string(argv[1]) == "--fit-check")) {
+        return fitCheckMain(argc, argv);
+    } else if (argc > 2 && std::string(argv[1]) == "--generate") {
+        return generateMain(argc, argv);
+    } else if (argc > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
     std::string filename = "iris.data";
     std::vector<ClassMember> dataset = readDataset(filename);
 
@@ -51,10 +651,7 @@ int main() {
     size_t l = sorted_distances.size();
 
     // consturct corresponding y values in terms of distances for ECDF points
-    std::vector<double> y(l);
-    for (size_t i = 0; i < l; ++i) {
-        y[i] = 1 - static_cast<double>(i + 1) / (l + 1);
-    }
+    std::vector<double> y = ecdfValues(l);
 
     curveFitting(sorted_distances, y);
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "alglibmisc.h"
+
+#include "measure.h"
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+std::vector<ClassMember> jitteredCopies(const std::vector<ClassMember>& rows, size_t copies) {
+    if (copies <= 1 || rows.empty()) {
+        return rows;
+    }
+    size_t dim = rows[0].features.size();
+    std::vector<double> lower(rows[0].features), upper(rows[0].features);
+    for (const auto& row : rows) {
+        for (size_t f = 0; f < dim; ++f) {
+            lower[f] = std::min(lower[f], row.features[f]);
+            upper[f] = std::max(upper[f], row.features[f]);
+        }
+    }
+    alglib::hqrndstate state;
+    alglib::hqrndseed(1, static_cast<alglib::ae_int_t>(copies), state);
+    std::vector<ClassMember> result;
+    result.reserve(rows.size() * copies);
+    for (size_t copy = 0; copy < copies; ++copy) {
+        for (const auto& row : rows) {
+            result.push_back(row);
+            for (size_t f = 0; copy > 0 && f < dim; ++f) {
+                result.back().features[f] += alglib::hqrndnormal(state) * 0.01 * (upper[f] - lower[f]);
+            }
+        }
+    }
+    return result;
+}
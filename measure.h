@@ -0,0 +1,19 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <vector>
+#include <chrono>
+
+#include "classMember.h"
+
+// wall time since start on the steady clock
+double secondsSince(std::chrono::steady_clock::time_point start);
+
+// median of the values, the mean of the middle two for an even count
+double median(std::vector<double> values);
+
+// copies of every row, all but the first jittered by normal noise of 1% of the
+// feature's spread over the rows, seeded by the copy count so that a scale repeats
+std::vector<ClassMember> jitteredCopies(const std::vector<ClassMember>& rows, size_t copies);
+
+#endif
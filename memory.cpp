@@ -0,0 +1,267 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "memory.h"
+#include "stage.h"
+#include "hugepage.h"
+
+// in front of every block from operator new in the CPV_MEMORY build; 16 bytes keep the block aligned as malloc's
+struct BlockHeader {
+    uint64_t size;
+    uint64_t stage;
+};
+static_assert(sizeof(BlockHeader) == 16, "block header must keep malloc alignment");
+
+static std::atomic<uint64_t> processAllocations(0);
+static std::atomic<uint64_t> processAllocated(0);
+static std::atomic<int64_t> processLive(0);
+static std::atomic<int64_t> processPeak(0);
+static std::atomic<int64_t> processPeakRss(0);
+
+static MemoryOptions options;
+static std::atomic<bool> exceeded(false);   // set once, by the first thread over the budget
+static std::atomic<bool> stopSampler(false);
+static std::thread* sampler = nullptr;
+
+static double megabytes(int64_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+static int64_t residentBytes() {
+    // no allocation here: the sampler runs while other threads may be over the budget
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    char text[128];
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) {
+        return 0;
+    }
+    text[length] = 0;
+    unsigned long long size = 0, resident = 0;
+    if (sscanf(text, "%llu %llu", &size, &resident) != 2) {
+        return 0;
+    }
+    return static_cast<int64_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// allocs, allocated and live count the blocks allocated inside the stage, peak is the
+// stage's own live peak, process and rss those of the whole process while the stage ran
+static void printStageTable() {
+    fprintf(stderr, "%-32s %6s %10s %14s %10s %10s %12s %10s\n", "stage", "class", "allocs", "allocated(MB)", "live(MB)",
+            "peak(MB)", "process(MB)", "rss(MB)");
+    uint32_t count = stageCount();
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        const StageStats& stats = stageTable[slot];
+        uint64_t allocations = stats.allocations.load(std::memory_order_relaxed);
+        if (allocations == 0 && stats.peakRssBytes.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        char index[24] = "";
+        if (slot > 0 && stats.index >= 0) {
+            snprintf(index, sizeof(index), "%lld", static_cast<long long>(stats.index));
+        }
+        fprintf(stderr, "%-32s %6s %10llu %14.3f %10.3f %10.3f %12.3f %10.3f\n", slot == 0 ? "(outside stages)" : stats.name,
+                index, static_cast<unsigned long long>(allocations), megabytes(stats.allocatedBytes.load()),
+                megabytes(stats.liveBytes.load()), megabytes(stats.peakLiveBytes.load()),
+                megabytes(stats.peakProcessBytes.load()), megabytes(stats.peakRssBytes.load()));
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "total: %llu allocations, %.3f MB allocated, %.3f MB live, heap peak %.3f MB, "
+                    "sampled rss peak %.3f MB, max rss %.3f MB\n",
+            static_cast<unsigned long long>(processAllocations.load()), megabytes(processAllocated.load()),
+            megabytes(processLive.load()), megabytes(processPeak.load()), megabytes(processPeakRss.load()),
+            usage.ru_maxrss / 1024.0);
+    LargeArrayUsage large = largeArrayUsage();
+    if (large.arrays > 0) {
+        fprintf(stderr, "large arrays outside the heap: %llu mappings, peak %.3f MB of hugetlb pages, %.3f MB advised for "
+                        "transparent huge pages, %.3f MB of small pages\n",
+                static_cast<unsigned long long>(large.arrays), megabytes(large.hugetlbBytes), megabytes(large.advisedBytes),
+                megabytes(large.smallBytes));
+    }
+}
+
+static void budgetExceeded(const char* what, int64_t bytes, uint32_t stage) {
+    if (exceeded.exchange(true)) {
+        return;
+    }
+    const StageStats& stats = stageTable[stage];
+    fprintf(stderr, "memory budget of %.3f MB exceeded: %s at %.3f MB in stage %s", megabytes(options.budget), what,
+            megabytes(bytes), stage == 0 ? "(outside stages)" : stats.name);
+    if (stage > 0 && stats.index >= 0) {
+        fprintf(stderr, " of class %lld", static_cast<long long>(stats.index));
+    }
+    fprintf(stderr, "\n");
+    printStageTable();
+    _exit(3);
+}
+
+static void sampleResidentSet() {
+    while (!stopSampler.load()) {
+        int64_t resident = residentBytes();
+        raiseTo(processPeakRss, resident);
+        uint32_t count = stageCount();
+        uint32_t busiest = 0;
+        for (uint32_t slot = 1; slot < count; ++slot) {
+            if (stageTable[slot].active.load(std::memory_order_relaxed) > 0) {
+                raiseTo(stageTable[slot].peakRssBytes, resident);
+                busiest = slot;
+            }
+        }
+        if (options.budget > 0 && resident > static_cast<int64_t>(options.budget)) {
+            budgetExceeded("resident set", resident, busiest);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.sampleMs));
+    }
+}
+
+static void finishMemoryAccounting() {
+    if (sampler) {
+        stopSampler = true;
+        sampler->join();
+    }
+    if (options.report) {
+#ifdef CPV_MEMORY
+        fprintf(stderr, "memory by stage (heap through operator new, resident set sampled every %u ms):\n", options.sampleMs);
+#else
+        fprintf(stderr, "memory by stage (resident set sampled every %u ms; the heap columns need make cpv_memory):\n",
+                options.sampleMs);
+#endif
+        printStageTable();
+    }
+}
+
+uint64_t parseByteSize(const std::string& value) {
+    char* end = nullptr;
+    double number = strtod(value.c_str(), &end);
+    if (end == value.c_str() || number <= 0) {
+        return 0;
+    }
+    std::string suffix(end);
+    double scale = 1;
+    if (suffix == "K" || suffix == "k") {
+        scale = 1024.0;
+    } else if (suffix == "M" || suffix == "m") {
+        scale = 1024.0 * 1024;
+    } else if (suffix == "G" || suffix == "g") {
+        scale = 1024.0 * 1024 * 1024;
+    } else if (!suffix.empty()) {
+        return 0;
+    }
+    return static_cast<uint64_t>(number * scale);
+}
+
+bool startMemoryAccounting(int& argc, char* argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--memory-report") {
+            options.report = true;
+        } else if (i + 1 < argc && arg == "--memory-budget") {
+            options.budget = parseByteSize(argv[++i]);
+            if (options.budget == 0) {
+                return false;
+            }
+        } else if (i + 1 < argc && arg == "--memory-sample") {
+            options.sampleMs = static_cast<unsigned>(std::max(1, atoi(argv[++i])));
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    if (options.report || options.budget > 0) {
+        stagesEnabled = true;
+        sampler = new std::thread(sampleResidentSet);
+        atexit(finishMemoryAccounting);
+    }
+    return true;
+}
+
+#ifdef CPV_MEMORY
+
+static void* trackedAllocate(size_t size) {
+    BlockHeader* header = static_cast<BlockHeader*>(malloc(size + sizeof(BlockHeader)));
+    if (!header) {
+        return nullptr;
+    }
+    uint32_t stage = currentStage;
+    header->size = size;
+    header->stage = stage;
+
+    int64_t bytes = static_cast<int64_t>(size);
+    StageStats& stats = stageTable[stage];
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    raiseTo(stats.peakLiveBytes, stats.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    processAllocated.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = processLive.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    raiseTo(processPeak, live);
+    raiseTo(stats.peakProcessBytes, live);
+    if (options.budget > 0 && live > static_cast<int64_t>(options.budget)) {
+        budgetExceeded("live heap", live, stage);
+    }
+    return header + 1;
+}
+
+static void trackedFree(void* block) {
+    if (!block) {
+        return;
+    }
+    BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+    int64_t bytes = static_cast<int64_t>(header->size);
+    stageTable[header->stage].liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    processLive.fetch_sub(bytes, std::memory_order_relaxed);
+    free(header);
+}
+
+void* operator new(size_t size) {
+    void* block = trackedAllocate(size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void operator delete(void* block) noexcept {
+    trackedFree(block);
+}
+
+void operator delete[](void* block) noexcept {
+    trackedFree(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+    trackedFree(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+    trackedFree(block);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+#include <string>
+
+// Memory accounting for cpv. Built with -DCPV_MEMORY (make cpv_memory), memory.cpp
+// replaces the global operator new and delete: every block carries a small header
+// naming the stage of stage.h that allocated it, so the bytes allocated, the live
+// bytes and their peak are known per stage and per class. Other builds keep the
+// allocator of the C++ library and account the resident set size only, which a
+// sampler thread reads from /proc/self/statm and which also covers ALGLIB's malloc.
+
+struct MemoryOptions {
+    bool report;             // per-stage table on stderr at exit
+    uint64_t budget;         // bytes of live heap or resident memory, 0 for none
+    unsigned sampleMs;       // resident set sampling period
+
+    MemoryOptions() : report(false), budget(0), sampleMs(10) {}
+};
+
+// a byte count with an optional K, M or G suffix (powers of 1024), 0 if malformed
+uint64_t parseByteSize(const std::string& value);
+
+// removes --memory-report, --memory-budget size and --memory-sample ms from the
+// arguments and starts the accounting they ask for; false for a malformed value
+bool startMemoryAccounting(int& argc, char* argv[]);
+
+#endif
@@ -0,0 +1,229 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include "model.h"
+#include "process.h"
+#include "fit.h"
+#include "parallel.h"
+#include "numa.h"
+#include "prefetch.h"
+#include "trace.h"
+
+Model normalizeModel(const std::vector<ClassMember>& dataset, size_t threads) {
+    TRACE_SPAN("stage", "normalizeModel");
+    Model model;
+    model.dim = dataset.empty() ? 0 : dataset[0].features.size();
+    if (!featureMoments(dataset, model.means, model.sigmas, threads)) {
+        model.means.assign(model.dim, 0.0);
+        model.sigmas.assign(model.dim, 1.0);
+    }
+
+    // group rows by class in order of first appearance
+    std::unordered_map<std::string, size_t> classIndex;
+    std::vector<std::vector<size_t> > members;
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        auto found = classIndex.find(dataset[i].name);
+        if (found == classIndex.end()) {
+            found = classIndex.insert(std::make_pair(dataset[i].name, model.classNames.size())).first;
+            model.classNames.push_back(dataset[i].name);
+            members.push_back(std::vector<size_t>());
+        }
+        members[found->second].push_back(i);
+    }
+
+    model.features.reserve(dataset.size() * model.dim);
+    model.classOffsets.push_back(0);
+    for (const auto& rows : members) {
+        for (size_t i : rows) {
+            for (size_t f = 0; f < model.dim; ++f) {
+                model.features.push_back((dataset[i].features[f] - model.means[f]) / model.sigmas[f]);
+            }
+        }
+        model.classOffsets.push_back(model.classOffsets.back() + rows.size());
+    }
+    placeClasses(model.features.data(), model.dim, model.classOffsets.data(), model.classNames.size());
+    return model;
+}
+
+std::vector<double> classNearestDistances(const Model& model, size_t classIndex) {
+    TRACE_SPAN_ARG("class", "class nn", classIndex);
+    std::vector<double> distances;
+    uint64_t first = model.classOffsets[classIndex], last = model.classOffsets[classIndex + 1];
+    for (uint64_t i = first; i < last; ++i) {
+        double minDistance = std::numeric_limits<double>::max();
+        for (uint64_t j = first; j < last; ++j) {
+            prefetchAhead(model.features.data(), model.dim, j, last);
+            if (i != j) {
+                double sum = 0.0;
+                for (size_t f = 0; f < model.dim; ++f) {
+                    double diff = model.features[i * model.dim + f] - model.features[j * model.dim + f];
+                    sum += diff * diff;
+                }
+                minDistance = std::min(minDistance, std::sqrt(sum));
+            }
+        }
+        distances.push_back(minDistance);
+    }
+    countStageItems((last - first) * (last - first - std::min<uint64_t>(1, last - first)));
+    return distances;
+}
+
+std::vector<double> classCurve(const std::vector<double>& distances, double cutoff) {
+    TRACE_SPAN("class", "class curve");
+    // if the result of distance is bigger than the cutoff, it will be dropped.
+    std::vector<double> curve;
+    for (double distance : distances) {
+        if (distance <= cutoff) {
+            curve.push_back(distance);
+        }
+    }
+    std::sort(curve.begin(), curve.end());
+    curve.erase(std::unique(curve.begin(), curve.end()), curve.end());
+    return curve;
+}
+
+CurveFit fitClassCurve(const std::vector<double>& curve, const std::string& className, uint32_t familyMask) {
+    TRACE_SPAN("class", "class fit");
+    CurveFit fit = {0, 0, -1};
+    if (curve.size() >= 2) {
+        try {
+            FitResult best = selectBestFit(fitAllFamilies(curve, ecdfValues(curve.size()), familyMask));
+            size_t familyCount;
+            fit.family = static_cast<int32_t>(best.family - sigmoidFamilies(familyCount));
+            fit.c = best.c[0];
+            fit.a = best.c[1];
+        } catch (alglib::ap_error alglib_exception) {
+            fprintf(stderr, "ALGLIB exception fitting class %s: '%s'\n", className.c_str(), alglib_exception.msg.c_str());
+        }
+    }
+    return fit;
+}
+
+void addClassCurve(Model& model, const std::vector<double>& curve, const CurveFit& fit) {
+    if (model.curveOffsets.empty()) {
+        model.curveOffsets.push_back(0);
+    }
+    model.curves.insert(model.curves.end(), curve.begin(), curve.end());
+    model.curveOffsets.push_back(model.curves.size());
+    model.fitParams.push_back(fit.c);
+    model.fitParams.push_back(fit.a);
+    model.fitFamilies.push_back(fit.family);
+}
+
+Model trainModel(const std::vector<ClassMember>& dataset) {
+    Model model = normalizeModel(dataset);
+
+    // nearest neighbor distances, curve table and fit of each class
+    model.curveOffsets.push_back(0);
+    for (size_t c = 0; c < model.classNames.size(); ++c) {
+        std::vector<double> curve = classCurve(classNearestDistances(model, c), NN_DISTANCE_CUTOFF);
+        addClassCurve(model, curve, fitClassCurve(curve, model.classNames[c]));
+    }
+    return model;
+}
+
+ModelView viewOf(const Model& model) {
+    ModelView view;
+    view.dim = model.dim;
+    view.rows = model.classOffsets.back();
+    view.classCount = model.classNames.size();
+    for (const auto& name : model.classNames) {
+        view.classNames.push_back(name.c_str());
+    }
+    view.means = model.means.data();
+    view.sigmas = model.sigmas.data();
+    view.features = model.features.data();
+    view.classOffsets = model.classOffsets.data();
+    view.curveOffsets = model.curveOffsets.data();
+    view.curves = model.curves.data();
+    view.fitParams = model.fitParams.data();
+    view.fitFamilies = model.fitFamilies.data();
+    return view;
+}
+
+ClassNeighbors classNearestNeighbors(const ModelView& model, size_t k, size_t threads) {
+    TRACE_SPAN("stage", "classNearestNeighbors");
+    ClassNeighbors result;
+    result.k = k;
+    result.distances.assign(model.rows * k, std::numeric_limits<double>::infinity());
+    result.indices.assign(model.rows * k, 0);
+    parallelFor(model.rows, threads, [&model, &result, k](size_t begin, size_t end) {
+        size_t c = std::upper_bound(model.classOffsets, model.classOffsets + model.classCount + 1, begin) - model.classOffsets - 1;
+        uint64_t pairs = 0;
+        for (size_t i = begin; i < end; ++i) {
+            while (i >= model.classOffsets[c + 1]) {
+                ++c;
+            }
+            pairs += model.classOffsets[c + 1] - model.classOffsets[c] - 1;
+            double* best = &result.distances[i * k];
+            uint32_t* bestIndex = &result.indices[i * k];
+            const double* row = model.features + i * model.dim;
+            for (uint64_t j = model.classOffsets[c]; j < model.classOffsets[c + 1]; ++j) {
+                prefetchAhead(model.features, model.dim, j, model.classOffsets[c + 1]);
+                if (i == j) {
+                    continue;
+                }
+                const double* neighbor = model.features + j * model.dim;
+                double sum = 0.0;
+                for (size_t f = 0; f < model.dim; ++f) {
+                    sum += (row[f] - neighbor[f]) * (row[f] - neighbor[f]);
+                }
+                // insertion into the sorted k best
+                double distance = std::sqrt(sum);
+                if (k == 0 || distance >= best[k - 1]) {
+                    continue;
+                }
+                size_t position = k - 1;
+                while (position > 0 && best[position - 1] > distance) {
+                    best[position] = best[position - 1];
+                    bestIndex[position] = bestIndex[position - 1];
+                    --position;
+                }
+                best[position] = distance;
+                bestIndex[position] = static_cast<uint32_t>(j);
+            }
+        }
+        countStageItems(pairs);
+    });
+    return result;
+}
+
+double classPValue(const ModelView& model, size_t classIndex, double distance) {
+    int32_t family = model.fitFamilies[classIndex];
+    if (family >= 0) {
+        size_t familyCount;
+        const SigmoidFamily* families = sigmoidFamilies(familyCount);
+        return sigmoidPValue(families[family], model.fitParams[2 * classIndex], model.fitParams[2 * classIndex + 1], distance);
+    }
+
+    // no fitted curve, fall back to the fraction of the curve table at least as large
+    const double* begin = model.curves + model.curveOffsets[classIndex];
+    const double* end = model.curves + model.curveOffsets[classIndex + 1];
+    size_t below = std::lower_bound(begin, end, distance) - begin;
+    return static_cast<double>((end - begin) - below + 1) / ((end - begin) + 1);
+}
+
+void scoreRow(const ModelView& model, const double* row, double* query, double* distances, double* pValues) {
+    for (size_t f = 0; f < model.dim; ++f) {
+        query[f] = (row[f] - model.means[f]) / model.sigmas[f];
+    }
+    for (size_t c = 0; c < model.classCount; ++c) {
+        double minSum = std::numeric_limits<double>::max();
+        for (uint64_t i = model.classOffsets[c]; i < model.classOffsets[c + 1]; ++i) {
+            prefetchAhead(model.features, model.dim, i, model.classOffsets[c + 1]);
+            const double* neighbor = model.features + i * model.dim;
+            double sum = 0.0;
+            for (size_t f = 0; f < model.dim; ++f) {
+                sum += (query[f] - neighbor[f]) * (query[f] - neighbor[f]);
+            }
+            minSum = std::min(minSum, sum);
+        }
+        distances[c] = std::sqrt(minSum);
+        pValues[c] = classPValue(model, c, distances[c]);
+    }
+}
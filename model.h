@@ -0,0 +1,85 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "classMember.h"
+#include "hugepage.h"
+
+// nearest neighbor distances above the cutoff are left out of the curves
+static const double NN_DISTANCE_CUTOFF = 1;
+
+// Everything needed to score new rows: the normalization, the normalized training
+// rows grouped by class, and for each class its sorted nearest neighbor distances
+// (the curve table) and best fitted sigmoid. All arrays are flat so that a model can
+// be laid out in one memory segment and shared between processes.
+struct Model {
+    size_t dim;
+    std::vector<std::string> classNames;
+    std::vector<double> means;
+    std::vector<double> sigmas;
+    HugeVector<double> features;         // normalized rows, row-major, grouped by class
+    std::vector<uint64_t> classOffsets;  // first row of each class, plus the row count
+    std::vector<uint64_t> curveOffsets;  // first curve entry of each class, plus the curve length
+    std::vector<double> curves;          // sorted unique nearest neighbor distances of each class
+    std::vector<double> fitParams;       // c & a in c(x-a) of each class
+    std::vector<int32_t> fitFamilies;    // index into sigmoidFamilies(), -1 if the fit failed
+};
+
+// read-only view of a model, either backed by a Model or by a mapped segment
+struct ModelView {
+    size_t dim;
+    size_t rows;
+    size_t classCount;
+    std::vector<const char*> classNames;
+    const double* means;
+    const double* sigmas;
+    const double* features;
+    const uint64_t* classOffsets;
+    const uint64_t* curveOffsets;
+    const double* curves;
+    const double* fitParams;
+    const int32_t* fitFamilies;
+};
+
+// the normalized rows grouped by class, without curves; the moments are summed on
+// threads threads, which callers running inside a pool task leave at 1
+Model normalizeModel(const std::vector<ClassMember>& dataset, size_t threads = 1);
+Model trainModel(const std::vector<ClassMember>& dataset);
+
+// the stages trainModel runs for each class, for callers that schedule them separately
+struct CurveFit {
+    double c;
+    double a;
+    int32_t family;   // index into sigmoidFamilies(), -1 if there is no fit
+};
+
+// nearest neighbor distance of every row of a class to the other rows of the class
+std::vector<double> classNearestDistances(const Model& model, size_t classIndex);
+// the distances up to the cutoff, sorted, without duplicates
+std::vector<double> classCurve(const std::vector<double>& distances, double cutoff);
+// best fit among the selected families (see ALL_SIGMOID_FAMILIES)
+CurveFit fitClassCurve(const std::vector<double>& curve, const std::string& className, uint32_t familyMask = ~0u);
+// append the curve and fit of the next class
+void addClassCurve(Model& model, const std::vector<double>& curve, const CurveFit& fit);
+ModelView viewOf(const Model& model);
+
+// k nearest neighbors of every training row within its own class, nearest first
+struct ClassNeighbors {
+    size_t k;
+    std::vector<double> distances;   // rows x k, infinity where the class has fewer rows
+    std::vector<uint32_t> indices;   // rows x k, model row of each neighbor
+};
+
+ClassNeighbors classNearestNeighbors(const ModelView& model, size_t k, size_t threads);
+
+// p-value of a nearest neighbor distance under the curve of one class
+double classPValue(const ModelView& model, size_t classIndex, double distance);
+
+// per-class nearest neighbor distances and p-values of one raw (unnormalized) row,
+// query is scratch space for model.dim values so that scoring does not allocate
+void scoreRow(const ModelView& model, const double* row, double* query, double* distances, double* pValues);
+
+#endif
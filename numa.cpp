@@ -0,0 +1,191 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "numa.h"
+
+// from linux/mempolicy.h
+static const int MPOL_BIND_MODE = 2;
+static const unsigned MPOL_MF_MOVE_PAGES = 1 << 1;
+
+// nodes in one mbind mask
+static const size_t MASK_WORDS = 16;
+
+unsigned numaPolicy = 0;
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+static thread_local size_t threadNode = 0;
+
+// "0-3,8,10-11"
+static std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first, last;
+        if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } else if (sscanf(range.c_str(), "%d", &first) == 1) {
+            cpus.push_back(first);
+        }
+    }
+    return cpus;
+}
+
+// the online nodes that have CPUs, read once
+static const std::vector<NumaNode>& topology() {
+    static const std::vector<NumaNode> nodes = [] {
+        std::vector<NumaNode> found;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string list;
+        if (online && std::getline(online, list)) {
+            for (int id : parseCpuList(list)) {
+                std::ifstream cpuFile("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+                std::string cpus;
+                NumaNode node = {id, std::vector<int>()};
+                if (cpuFile && std::getline(cpuFile, cpus)) {
+                    node.cpus = parseCpuList(cpus);
+                }
+                if (!node.cpus.empty()) {
+                    found.push_back(node);
+                }
+            }
+        }
+        return found;
+    }();
+    return nodes;
+}
+
+bool parseNumaPolicy(const std::string& value, unsigned& policy) {
+    policy = 0;
+    std::stringstream words(value);
+    std::string word;
+    while (std::getline(words, word, ',')) {
+        if (word == "all") {
+            policy |= NUMA_ALL;
+        } else if (word == "pin") {
+            policy |= NUMA_PIN;
+        } else if (word == "place") {
+            policy |= NUMA_PLACE;
+        } else if (word == "replicate") {
+            policy |= NUMA_REPLICATE;
+        } else if (word != "off") {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool startNuma(int& argc, char* argv[]) {
+    int kept = 1;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--numa") {
+            valid = valid && i + 1 < argc && parseNumaPolicy(argv[++i], numaPolicy);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return valid;
+}
+
+size_t numaNodeCount() {
+    return std::max<size_t>(1, topology().size());
+}
+
+size_t workerNode(size_t worker, size_t workers) {
+    return workers == 0 ? 0 : std::min(worker * numaNodeCount() / workers, numaNodeCount() - 1);
+}
+
+void pinToNode(size_t node) {
+    const std::vector<NumaNode>& nodes = topology();
+    threadNode = node;
+    if (!(numaPolicy & NUMA_PIN) || nodes.size() < 2 || node >= nodes.size()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodes[node].cpus) {
+        CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);  // a restricted cpuset keeps the thread where it is
+}
+
+size_t currentNode() {
+    return threadNode;
+}
+
+size_t classNode(const uint64_t* classOffsets, size_t classCount, size_t c) {
+    uint64_t rows = classOffsets[classCount];
+    if (rows == 0) {
+        return 0;
+    }
+    uint64_t middle = (classOffsets[c] + classOffsets[c + 1]) / 2;
+    return std::min<size_t>(middle * numaNodeCount() / rows, numaNodeCount() - 1);
+}
+
+bool moveToNode(const void* data, size_t bytes, size_t node) {
+    const std::vector<NumaNode>& nodes = topology();
+    if (node >= nodes.size() || static_cast<size_t>(nodes[node].id) >= MASK_WORDS * 64) {
+        return false;
+    }
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(data) + page - 1) / page * page;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes) / page * page;
+    if (end <= begin) {
+        return true;  // no whole page
+    }
+    unsigned long mask[MASK_WORDS] = {0};
+    mask[nodes[node].id / 64] |= 1ul << (nodes[node].id % 64);
+    return syscall(SYS_mbind, begin, end - begin, MPOL_BIND_MODE, mask, MASK_WORDS * 64 + 1, MPOL_MF_MOVE_PAGES) == 0;
+}
+
+void placeClasses(const double* features, size_t dim, const uint64_t* classOffsets, size_t classCount) {
+    if (!(numaPolicy & NUMA_PLACE) || numaNodeCount() < 2) {
+        return;
+    }
+    for (size_t c = 0; c < classCount; ++c) {
+        moveToNode(features + classOffsets[c] * dim, (classOffsets[c + 1] - classOffsets[c]) * dim * sizeof(double),
+                   classNode(classOffsets, classCount, c));
+    }
+}
+
+bool pageNodes(const void* data, size_t bytes, std::vector<int>& nodes) {
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) / page * page;
+    size_t count = (reinterpret_cast<uintptr_t>(data) + bytes - begin + page - 1) / page;
+    std::vector<void*> pages(count);
+    for (size_t i = 0; i < count; ++i) {
+        pages[i] = reinterpret_cast<void*>(begin + i * page);
+    }
+    // without target nodes, move_pages only reports where each page is
+    std::vector<int> status(count, -1);
+    if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr, status.data(), 0) != 0) {
+        return false;
+    }
+    // node ids to indices of the topology, -1 for pages not present
+    const std::vector<NumaNode>& topo = topology();
+    nodes.assign(count, -1);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t n = 0; n < topo.size(); ++n) {
+            if (topo[n].id == status[i]) {
+                nodes[i] = static_cast<int>(n);
+            }
+        }
+    }
+    return true;
+}
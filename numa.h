@@ -0,0 +1,47 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// NUMA placement, off unless --numa asks for it. The topology comes from
+// /sys/devices/system/node, threads are pinned to the CPUs of a node with
+// sched_setaffinity and pages are moved with the mbind system call, so there is no
+// libnuma dependency. On a single node nothing is pinned or moved.
+//   pin        parallelFor and TaskPool workers are pinned to nodes in contiguous
+//              blocks, and TaskPool queues a task with a node on that node's workers
+//   place      each class block of the normalized rows is moved to the node of its class
+//   replicate  the batch scoring tasks read a copy of the kd-tree on their own node
+// Classes go to nodes in row-balanced runs in row order, and parallelFor hands out
+// row blocks in the same order, so a worker mostly reads rows on its own node.
+
+enum NumaPolicy { NUMA_PIN = 1, NUMA_PLACE = 2, NUMA_REPLICATE = 4, NUMA_ALL = 7 };
+
+// the flags in use; benchmarks comparing policies set it directly
+extern unsigned numaPolicy;
+
+// "all", "off" or a list such as "pin,place"; false if a word is unknown
+bool parseNumaPolicy(const std::string& value, unsigned& policy);
+// removes --numa policy from the arguments and sets numaPolicy; false for a malformed value
+bool startNuma(int& argc, char* argv[]);
+
+// nodes with CPUs, 1 if the topology is unknown
+size_t numaNodeCount();
+// node of a worker when workers are spread over the nodes in contiguous blocks
+size_t workerNode(size_t worker, size_t workers);
+// remembers node as the calling thread's node and, with NUMA_PIN, pins the thread to its CPUs
+void pinToNode(size_t node);
+// node of the calling thread, 0 unless pinToNode was called
+size_t currentNode();
+// node of class c: classes in order, balanced by rows over the nodes
+size_t classNode(const uint64_t* classOffsets, size_t classCount, size_t c);
+// moves the whole pages of [data, data + bytes) to node; false if mbind failed
+bool moveToNode(const void* data, size_t bytes, size_t node);
+// with NUMA_PLACE on more than one node, moves each class block of the rows to its node
+void placeClasses(const double* features, size_t dim, const uint64_t* classOffsets, size_t classCount);
+// node of each page of [data, data + bytes), -1 for a page not yet touched; false if move_pages failed
+bool pageNodes(const void* data, size_t bytes, std::vector<int>& nodes);
+
+#endif
@@ -0,0 +1,136 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <sched.h>
+
+#include "numabench.h"
+#include "numa.h"
+#include "batch.h"
+#include "parallel.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// parallelFor's blocks of n values on threads threads
+static size_t blockSize(size_t n, size_t threads) {
+    threads = std::max<size_t>(1, std::min(threads, n));
+    return (n + threads - 1) / threads;
+}
+
+// share of the pages of each reader's block that are on the reader's node
+static double localShare(const std::vector<double>& matrix, size_t threads) {
+    size_t block = blockSize(matrix.size(), threads), blocks = (matrix.size() + block - 1) / block;
+    size_t local = 0, total = 0;
+    std::vector<int> nodes;
+    for (size_t b = 0; b < blocks; ++b) {
+        size_t count = std::min(block, matrix.size() - b * block);
+        if (!pageNodes(&matrix[b * block], count * sizeof(double), nodes)) {
+            return -1;
+        }
+        local += std::count(nodes.begin(), nodes.end(), static_cast<int>(workerNode(b, blocks)));
+        total += nodes.size();
+    }
+    return total ? static_cast<double>(local) / total : 0;
+}
+
+// GB/s of the fastest of repetitions parallel sums of the matrix
+static double readBandwidth(const std::vector<double>& matrix, size_t threads, size_t repetitions, double& checksum) {
+    double fastest = std::numeric_limits<double>::max();
+    size_t block = blockSize(matrix.size(), threads);
+    std::vector<double> sums((matrix.size() + block - 1) / block);
+    for (size_t r = 0; r < repetitions; ++r) {
+        auto start = Clock::now();
+        parallelFor(matrix.size(), threads, [&](size_t begin, size_t end) {
+            double a = 0, b = 0, c = 0, d = 0;
+            size_t i = begin;
+            for (; i + 4 <= end; i += 4) {
+                a += matrix[i];
+                b += matrix[i + 1];
+                c += matrix[i + 2];
+                d += matrix[i + 3];
+            }
+            for (; i < end; ++i) {
+                a += matrix[i];
+            }
+            sums[begin / block] = a + b + c + d;
+        });
+        fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+        for (double sum : sums) {
+            checksum += sum;
+        }
+    }
+    return matrix.size() * sizeof(double) / fastest / 1e9;
+}
+
+static void bandwidthBenchmark(const NumaBenchmarkOptions& options) {
+    size_t count = options.megabytes * 1024 * 1024 / sizeof(double);
+    size_t threads = options.threads;
+    cpu_set_t loaderCpus;
+    sched_getaffinity(0, sizeof(loaderCpus), &loaderCpus);
+
+    // the loader: this thread on node 0 allocates and fills the matrix
+    pinToNode(0);
+    std::vector<double> matrix(count, 1.0);
+    double checksum = 0;
+    printf("\nbandwidth: %zu MB summed by %zu pinned readers, fastest of %zu\n", options.megabytes, threads, options.repetitions);
+    printf("%-26s %12s %10s\n", "placement", "local pages", "GB/s");
+    double share = localShare(matrix, threads);
+    double before = readBandwidth(matrix, threads, options.repetitions, checksum);
+    printf("%-26s %11.1f%% %10.2f\n", "first touch by the loader", share * 100, before);
+
+    size_t block = blockSize(count, threads), blocks = (count + block - 1) / block;
+    bool moved = true;
+    for (size_t b = 0; b < blocks; ++b) {
+        moved = moveToNode(&matrix[b * block], std::min(block, count - b * block) * sizeof(double), workerNode(b, blocks)) && moved;
+    }
+    share = localShare(matrix, threads);
+    double after = readBandwidth(matrix, threads, options.repetitions, checksum);
+    printf("%-26s %11.1f%% %10.2f%s\n", "moved to the readers", share * 100, after, moved ? "" : "  (mbind failed)");
+    printf("bandwidth gain %.2fx (checksum %g)\n", after / before, checksum);
+    sched_setaffinity(0, sizeof(loaderCpus), &loaderCpus);
+}
+
+static bool pipelineRun(const std::string& filename, const TableFormat& format, const NumaBenchmarkOptions& options,
+                        unsigned policy, PipelineProfile& fastest) {
+    numaPolicy = policy;
+    fastest.wallSeconds = std::numeric_limits<double>::max();
+    for (size_t r = 0; r < options.repetitions; ++r) {
+        PipelineProfile profile;
+        if (!profilePipeline(filename, format, 5, 8, options.threads, profile)) {
+            return false;
+        }
+        if (profile.wallSeconds < fastest.wallSeconds) {
+            fastest = profile;
+        }
+    }
+    return true;
+}
+
+int runNumaBenchmark(const std::string& filename, const TableFormat& format, const NumaBenchmarkOptions& options) {
+    size_t nodes = numaNodeCount();
+    printf("%zu NUMA node%s with CPUs%s\n", nodes, nodes == 1 ? "" : "s",
+           nodes == 1 ? ": nothing is pinned or moved, so both runs of each test measure the same placement" : "");
+    unsigned policy = numaPolicy;
+    numaPolicy = NUMA_PIN;
+    bandwidthBenchmark(options);
+
+    PipelineProfile off, all;
+    if (!pipelineRun(filename, format, options, 0, off) || !pipelineRun(filename, format, options, NUMA_ALL, all)) {
+        numaPolicy = policy;
+        return 1;
+    }
+    numaPolicy = policy;
+    printf("\npipeline: %s, %zu rows, %zu classes on %zu threads, fastest of %zu\n", filename.c_str(), off.rows, off.classes,
+           options.threads, options.repetitions);
+    printf("%-10s %10s %12s %15s %10s\n", "--numa", "wall(ms)", "nn busy(ms)", "score busy(ms)", "accuracy");
+    const PipelineProfile* runs[2] = {&off, &all};
+    const char* names[2] = {"off", "all"};
+    for (size_t i = 0; i < 2; ++i) {
+        printf("%-10s %10.3f %12.3f %15.3f %10.4f\n", names[i], runs[i]->wallSeconds * 1e3, runs[i]->stageBusy[STAGE_NN] * 1e3,
+               runs[i]->stageBusy[STAGE_SCORE] * 1e3, runs[i]->accuracy);
+    }
+    printf("wall time gain %.2fx\n", off.wallSeconds / all.wallSeconds);
+    return 0;
+}
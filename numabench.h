@@ -0,0 +1,23 @@
+#ifndef NUMABENCH_H
+#define NUMABENCH_H
+
+#include <string>
+
+#include "dataset.h"
+
+struct NumaBenchmarkOptions {
+    size_t threads;          // readers of the bandwidth test and pipeline threads
+    size_t megabytes;        // size of the matrix the readers sum
+    size_t repetitions;      // runs of each measurement, the fastest is reported
+
+    NumaBenchmarkOptions() : threads(0), megabytes(512), repetitions(5) {}
+};
+
+// What NUMA placement buys on this host. Bandwidth: a matrix first touched by a
+// loader thread on node 0 is summed by pinned readers, one contiguous block each,
+// then the blocks are moved to their readers' nodes and summed again; each run
+// reports the share of pages on the reader's node (from move_pages) and GB/s. Wall
+// time: the batch pipeline on the table without NUMA placement and with --numa all.
+int runNumaBenchmark(const std::string& filename, const TableFormat& format, const NumaBenchmarkOptions& options);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "stage.h"
+#include "numa.h"
+
+// number of worker threads to use when the caller asks for 0
+inline size_t defaultThreadCount() {
+    size_t threads = std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+// Run body(begin, end) over [0, n) split into one contiguous block per thread. The
+// blocks depend only on n and threads, so the work each index sees is deterministic.
+// The workers run in the stage of the caller, and worker w of W on node workerNode(w, W).
+template <typename Body>
+void parallelFor(size_t n, size_t threads, Body body) {
+    threads = std::max<size_t>(1, std::min(threads, n));
+    if (threads == 1) {
+        body(static_cast<size_t>(0), n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    size_t block = (n + threads - 1) / threads;
+    uint32_t stage = currentStage;
+    size_t blocks = (n + block - 1) / block;
+    for (size_t begin = 0; begin < n; begin += block) {
+        size_t end = std::min(n, begin + block);
+        size_t node = workerNode(begin / block, blocks);
+        workers.push_back(std::thread([&body, begin, end, stage, node] {
+            pinToNode(node);
+            StageScope scope(stage);
+            body(begin, end);
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
@@ -0,0 +1,543 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+
+#include "alglibmisc.h"
+
+#include "pareto.h"
+#include "model.h"
+#include "kdtree.h"
+#include "fit.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Nearest row of one class to a query, numbered within the class. The rows are the
+// normalized rows of the class; self is the row the query is, -1 for a held-out query.
+class ClassIndex {
+public:
+    virtual ~ClassIndex() {}
+    virtual size_t bytes() const = 0;
+    virtual uint32_t nearest(const double* query, int64_t self, double& distance) = 0;
+    // rows whose nearest neighbor distances make up the curve
+    virtual bool inCurve(size_t) const { return true; }
+};
+
+typedef std::function<ClassIndex*(const double* rows, size_t n, size_t dim, size_t classIndex)> IndexFactory;
+
+template <typename T>
+class BruteIndex : public ClassIndex {
+public:
+    BruteIndex(const double* rows, size_t n, size_t dim) : points(rows, rows + n * dim), n(n), dim(dim), query(dim) {}
+
+    size_t bytes() const { return points.size() * sizeof(T); }
+
+    uint32_t nearest(const double* q, int64_t self, double& distance) {
+        std::copy(q, q + dim, query.begin());
+        T best = std::numeric_limits<T>::max();
+        uint32_t bestRow = 0;
+        for (size_t j = 0; j < n; ++j) {
+            if (static_cast<int64_t>(j) == self) {
+                continue;
+            }
+            const T* point = &points[j * dim];
+            T sum = 0;
+            for (size_t f = 0; f < dim; ++f) {
+                sum += (query[f] - point[f]) * (query[f] - point[f]);
+            }
+            if (sum < best) {
+                best = sum;
+                bestRow = static_cast<uint32_t>(j);
+            }
+        }
+        distance = std::sqrt(static_cast<double>(best));
+        return bestRow;
+    }
+
+private:
+    std::vector<T> points;
+    size_t n, dim;
+    std::vector<T> query;
+};
+
+class KdIndex : public ClassIndex {
+public:
+    KdIndex(const double* rows, size_t n, size_t dim, size_t leafSize, double epsilon) : epsilon(epsilon), found(2) {
+        offsets[0] = 0;
+        offsets[1] = n;
+        ModelView view;
+        view.dim = dim;
+        view.rows = n;
+        view.classCount = 1;
+        view.features = rows;
+        view.classOffsets = offsets;
+        tree = buildKdTree(view, leafSize);
+    }
+
+    size_t bytes() const {
+        return tree.points.size() * sizeof(double) + tree.bounds.size() * sizeof(double) + tree.nodes.size() * sizeof(KdNode) +
+               tree.classMasks.size() * sizeof(uint64_t) + (tree.rows.size() + tree.classes.size()) * sizeof(uint32_t);
+    }
+
+    uint32_t nearest(const double* query, int64_t self, double& distance) {
+        size_t count = nearestNeighbors(tree, query, self >= 0 ? 2 : 1, heap, stack, found.data(), epsilon);
+        for (size_t i = 0; i < count; ++i) {
+            if (static_cast<int64_t>(found[i].row) != self) {
+                distance = found[i].distance;
+                return found[i].row;
+            }
+        }
+        distance = std::numeric_limits<double>::max();
+        return 0;
+    }
+
+private:
+    uint64_t offsets[2];
+    double epsilon;
+    KdTree tree;
+    std::vector<Neighbor> heap, found;
+    std::vector<int32_t> stack;
+};
+
+// every value as one of 2^bits - 1 steps between the smallest and the largest value of the class
+class QuantizedIndex : public ClassIndex {
+public:
+    QuantizedIndex(const double* rows, size_t n, size_t dim, int bits) : n(n), dim(dim), codes(n * dim), query(dim) {
+        lower = *std::min_element(rows, rows + n * dim);
+        double upper = *std::max_element(rows, rows + n * dim);
+        levels = (1 << bits) - 1;
+        step = upper > lower ? (upper - lower) / levels : 1.0;
+        for (size_t i = 0; i < n * dim; ++i) {
+            codes[i] = code(rows[i]);
+        }
+    }
+
+    size_t bytes() const { return codes.size(); }
+
+    uint32_t nearest(const double* q, int64_t self, double& distance) {
+        for (size_t f = 0; f < dim; ++f) {
+            query[f] = code(q[f]);
+        }
+        int32_t best = std::numeric_limits<int32_t>::max();
+        uint32_t bestRow = 0;
+        for (size_t j = 0; j < n; ++j) {
+            if (static_cast<int64_t>(j) == self) {
+                continue;
+            }
+            const uint8_t* point = &codes[j * dim];
+            int32_t sum = 0;
+            for (size_t f = 0; f < dim; ++f) {
+                int32_t diff = static_cast<int32_t>(query[f]) - point[f];
+                sum += diff * diff;
+            }
+            if (sum < best) {
+                best = sum;
+                bestRow = static_cast<uint32_t>(j);
+            }
+        }
+        distance = step * std::sqrt(static_cast<double>(best));
+        return bestRow;
+    }
+
+private:
+    uint8_t code(double value) const {
+        double level = std::floor((value - lower) / step + 0.5);
+        return static_cast<uint8_t>(std::min<double>(levels, std::max(0.0, level)));
+    }
+
+    size_t n, dim;
+    double lower, step;
+    int levels;
+    std::vector<uint8_t> codes;
+    std::vector<uint8_t> query;
+};
+
+// rows projected onto target Gaussian random directions scaled to keep distances in expectation
+class SketchIndex : public ClassIndex {
+public:
+    SketchIndex(const double* rows, size_t n, size_t dim, size_t target, alglib::hqrndstate& state)
+        : n(n), dim(dim), target(target), projection(dim * target), points(n * target), query(target) {
+        alglib::real_1d_array direction;
+        for (size_t f = 0; f < dim; ++f) {
+            alglib::hqrndnormalv(state, target, direction);
+            for (size_t t = 0; t < target; ++t) {
+                projection[f * target + t] = direction[t] / std::sqrt(static_cast<double>(target));
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            project(rows + i * dim, &points[i * target]);
+        }
+    }
+
+    size_t bytes() const { return (points.size() + projection.size()) * sizeof(double); }
+
+    uint32_t nearest(const double* q, int64_t self, double& distance) {
+        project(q, query.data());
+        double best = std::numeric_limits<double>::max();
+        uint32_t bestRow = 0;
+        for (size_t j = 0; j < n; ++j) {
+            if (static_cast<int64_t>(j) == self) {
+                continue;
+            }
+            const double* point = &points[j * target];
+            double sum = 0;
+            for (size_t t = 0; t < target; ++t) {
+                sum += (query[t] - point[t]) * (query[t] - point[t]);
+            }
+            if (sum < best) {
+                best = sum;
+                bestRow = static_cast<uint32_t>(j);
+            }
+        }
+        distance = std::sqrt(best);
+        return bestRow;
+    }
+
+private:
+    void project(const double* row, double* out) const {
+        std::fill(out, out + target, 0.0);
+        for (size_t f = 0; f < dim; ++f) {
+            for (size_t t = 0; t < target; ++t) {
+                out[t] += row[f] * projection[f * target + t];
+            }
+        }
+    }
+
+    size_t n, dim, target;
+    std::vector<double> projection;   // dim x target
+    std::vector<double> points;
+    std::vector<double> query;
+};
+
+// an exact kd-tree over a uniform sample of the class; the curve comes from the sampled rows only
+class CoresetIndex : public ClassIndex {
+public:
+    CoresetIndex(const double* rows, size_t n, size_t dim, double fraction, size_t leafSize, alglib::hqrndstate& state) {
+        std::vector<uint32_t> order(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        size_t size = std::min(n, std::max<size_t>(2, static_cast<size_t>(std::lround(n * fraction))));
+        for (size_t i = 0; i < size; ++i) {
+            size_t j = i + static_cast<size_t>(alglib::hqrnduniformi(state, static_cast<alglib::ae_int_t>(n - i)));
+            std::swap(order[i], order[j]);
+        }
+        sample.assign(order.begin(), order.begin() + size);
+        std::sort(sample.begin(), sample.end());
+        std::vector<double> gathered;
+        for (uint32_t row : sample) {
+            gathered.insert(gathered.end(), rows + row * dim, rows + (row + 1) * dim);
+        }
+        index.reset(new KdIndex(gathered.data(), size, dim, leafSize, 0.0));
+    }
+
+    size_t bytes() const { return index->bytes() + sample.size() * sizeof(uint32_t); }
+
+    uint32_t nearest(const double* query, int64_t self, double& distance) {
+        int64_t position = -1;
+        if (self >= 0) {
+            auto found = std::lower_bound(sample.begin(), sample.end(), static_cast<uint32_t>(self));
+            if (found != sample.end() && *found == self) {
+                position = found - sample.begin();
+            }
+        }
+        return sample[index->nearest(query, position, distance)];
+    }
+
+    bool inCurve(size_t row) const { return std::binary_search(sample.begin(), sample.end(), static_cast<uint32_t>(row)); }
+
+private:
+    std::vector<uint32_t> sample;
+    std::unique_ptr<KdIndex> index;
+};
+
+struct ParetoSetting {
+    std::string method;
+    std::string knob;
+    IndexFactory factory;
+};
+
+// what one setting produced, and how it compares with the exact search
+struct ParetoRun {
+    double seconds;
+    double fitSeconds;                                // of it in the curves and fits, the rest is the search
+    size_t bytes;
+    std::vector<std::vector<double> > rowDistances;   // per class and row, NaN for rows outside the curve
+    std::vector<std::vector<uint32_t> > rowNearest;
+    std::vector<double> queryDistances;               // queries x classes
+    std::vector<uint32_t> queryNearest;
+    std::vector<double> pValues;                      // queries x classes
+    Model model;
+
+    double trainRecall, queryRecall, ks, drift, pError, pErrorMax;
+    size_t familyChanges;
+};
+
+static double rowDistance(const double* a, const double* b, size_t dim) {
+    double sum = 0;
+    for (size_t f = 0; f < dim; ++f) {
+        sum += (a[f] - b[f]) * (a[f] - b[f]);
+    }
+    return std::sqrt(sum);
+}
+
+// largest difference of the empirical distribution functions of two sorted samples
+static double ksDistance(const double* a, size_t n, const double* b, size_t m) {
+    if (n == 0 || m == 0) {
+        return n == m ? 0.0 : 1.0;
+    }
+    size_t i = 0, j = 0;
+    double largest = 0;
+    while (i < n && j < m) {
+        double value = std::min(a[i], b[j]);
+        while (i < n && a[i] <= value) {
+            ++i;
+        }
+        while (j < m && b[j] <= value) {
+            ++j;
+        }
+        largest = std::max(largest, std::fabs(static_cast<double>(i) / n - static_cast<double>(j) / m));
+    }
+    return largest;
+}
+
+static void runSetting(const ParetoSetting& setting, const Model& base, const std::vector<double>& queries, ParetoRun& run) {
+    size_t dim = base.dim, classCount = base.classNames.size();
+    size_t queryCount = queries.size() / dim;
+    auto start = Clock::now();
+    std::vector<std::unique_ptr<ClassIndex> > indexes(classCount);
+    run.bytes = 0;
+    for (size_t c = 0; c < classCount; ++c) {
+        const double* rows = &base.features[base.classOffsets[c] * dim];
+        indexes[c].reset(setting.factory(rows, base.classOffsets[c + 1] - base.classOffsets[c], dim, c));
+        run.bytes += indexes[c]->bytes();
+    }
+
+    run.model = base;
+    run.fitSeconds = 0;
+    run.rowDistances.assign(classCount, std::vector<double>());
+    run.rowNearest.assign(classCount, std::vector<uint32_t>());
+    for (size_t c = 0; c < classCount; ++c) {
+        size_t n = base.classOffsets[c + 1] - base.classOffsets[c];
+        const double* rows = &base.features[base.classOffsets[c] * dim];
+        std::vector<double> distances;
+        run.rowDistances[c].assign(n, std::numeric_limits<double>::quiet_NaN());
+        run.rowNearest[c].assign(n, 0);
+        for (size_t i = 0; n >= 2 && i < n; ++i) {
+            if (indexes[c]->inCurve(i)) {
+                run.rowNearest[c][i] = indexes[c]->nearest(rows + i * dim, static_cast<int64_t>(i), run.rowDistances[c][i]);
+                distances.push_back(run.rowDistances[c][i]);
+            }
+        }
+        auto fitStart = Clock::now();
+        std::vector<double> curve = classCurve(distances, NN_DISTANCE_CUTOFF);
+        addClassCurve(run.model, curve, fitClassCurve(curve, base.classNames[c]));
+        run.fitSeconds += std::chrono::duration<double>(Clock::now() - fitStart).count();
+    }
+
+    ModelView view = viewOf(run.model);
+    run.queryDistances.assign(queryCount * classCount, 0.0);
+    run.queryNearest.assign(queryCount * classCount, 0);
+    run.pValues.assign(queryCount * classCount, 0.0);
+    for (size_t q = 0; q < queryCount; ++q) {
+        for (size_t c = 0; c < classCount; ++c) {
+            size_t slot = q * classCount + c;
+            run.queryNearest[slot] = indexes[c]->nearest(&queries[q * dim], -1, run.queryDistances[slot]);
+            run.pValues[slot] = classPValue(view, c, run.queryDistances[slot]);
+        }
+    }
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void compareWithExact(const Model& base, const std::vector<double>& queries, const ParetoRun& exact, ParetoRun& run) {
+    size_t dim = base.dim, classCount = base.classNames.size();
+    // a neighbor counts as found if it is as near as the exact one, whichever of equally near rows it is
+    size_t hits = 0, total = 0;
+    for (size_t c = 0; c < classCount; ++c) {
+        const double* rows = &base.features[base.classOffsets[c] * dim];
+        for (size_t i = 0; i < run.rowDistances[c].size(); ++i) {
+            if (std::isnan(run.rowDistances[c][i])) {
+                continue;
+            }
+            double actual = rowDistance(rows + i * dim, rows + run.rowNearest[c][i] * dim, dim);
+            hits += actual <= exact.rowDistances[c][i] * (1 + 1e-12);
+            ++total;
+        }
+    }
+    run.trainRecall = total ? static_cast<double>(hits) / total : 1.0;
+    hits = total = 0;
+    for (size_t slot = 0; slot < run.queryNearest.size(); ++slot) {
+        size_t c = slot % classCount;
+        const double* row = &base.features[(base.classOffsets[c] + run.queryNearest[slot]) * dim];
+        hits += rowDistance(&queries[(slot / classCount) * dim], row, dim) <= exact.queryDistances[slot] * (1 + 1e-12);
+        ++total;
+    }
+    run.queryRecall = total ? static_cast<double>(hits) / total : 1.0;
+
+    run.ks = run.drift = 0;
+    run.familyChanges = 0;
+    size_t fitted = 0;
+    for (size_t c = 0; c < classCount; ++c) {
+        const double* curve = &run.model.curves[run.model.curveOffsets[c]];
+        const double* exactCurve = &exact.model.curves[exact.model.curveOffsets[c]];
+        run.ks += ksDistance(exactCurve, exact.model.curveOffsets[c + 1] - exact.model.curveOffsets[c], curve,
+                             run.model.curveOffsets[c + 1] - run.model.curveOffsets[c]) / classCount;
+        int32_t family = run.model.fitFamilies[c], exactFamily = exact.model.fitFamilies[c];
+        run.familyChanges += family != exactFamily;
+        if (family >= 0 && exactFamily >= 0) {
+            double c0 = exact.model.fitParams[2 * c], a0 = exact.model.fitParams[2 * c + 1];
+            double cDrift = std::fabs(run.model.fitParams[2 * c] - c0) / std::max(std::fabs(c0), 1e-12);
+            double aDrift = std::fabs(run.model.fitParams[2 * c + 1] - a0) / std::max(std::fabs(a0), 1e-12);
+            run.drift += std::max(cDrift, aDrift);
+            ++fitted;
+        }
+    }
+    run.drift = fitted ? run.drift / fitted : 0.0;
+
+    run.pError = run.pErrorMax = 0;
+    for (size_t slot = 0; slot < run.pValues.size(); ++slot) {
+        double error = std::fabs(run.pValues[slot] - exact.pValues[slot]);
+        run.pError += error / run.pValues.size();
+        run.pErrorMax = std::max(run.pErrorMax, error);
+    }
+}
+
+static std::vector<ParetoSetting> paretoSettings(size_t dim, const ParetoOptions& options) {
+    std::vector<ParetoSetting> settings;
+    size_t leafSize = options.leafSize;
+    uint64_t seed = options.seed;
+    settings.push_back({"exact", "brute force", [](const double* rows, size_t n, size_t dim, size_t) -> ClassIndex* {
+                            return new BruteIndex<double>(rows, n, dim);
+                        }});
+    const double epsilons[] = {0.0, 0.1, 0.25, 0.5, 1.0, 2.0};
+    for (double epsilon : epsilons) {
+        char knob[32];
+        snprintf(knob, sizeof(knob), "eps=%g", epsilon);
+        settings.push_back({epsilon == 0 ? "kd-tree" : "eps-kd-tree", knob,
+                            [leafSize, epsilon](const double* rows, size_t n, size_t dim, size_t) -> ClassIndex* {
+                                return new KdIndex(rows, n, dim, leafSize, epsilon);
+                            }});
+    }
+    settings.push_back({"f32", "brute force", [](const double* rows, size_t n, size_t dim, size_t) -> ClassIndex* {
+                            return new BruteIndex<float>(rows, n, dim);
+                        }});
+    const int bits[] = {8, 6, 4};
+    for (int b : bits) {
+        settings.push_back({"quantized", "bits=" + std::to_string(b), [b](const double* rows, size_t n, size_t dim, size_t) -> ClassIndex* {
+                                return new QuantizedIndex(rows, n, dim, b);
+                            }});
+    }
+    std::vector<size_t> targets;
+    for (size_t quarter = 3; quarter >= 1; --quarter) {
+        size_t target = std::max<size_t>(1, dim * quarter / 4);
+        if (target < dim && std::find(targets.begin(), targets.end(), target) == targets.end()) {
+            targets.push_back(target);
+        }
+    }
+    for (size_t target : targets) {
+        settings.push_back({"sketch", "dims=" + std::to_string(target),
+                            [target, seed](const double* rows, size_t n, size_t dim, size_t c) -> ClassIndex* {
+                                alglib::hqrndstate state;
+                                alglib::hqrndseed(static_cast<alglib::ae_int_t>(seed), static_cast<alglib::ae_int_t>(c + 1), state);
+                                return new SketchIndex(rows, n, dim, target, state);
+                            }});
+    }
+    const double fractions[] = {0.5, 0.25, 0.1};
+    for (double fraction : fractions) {
+        char knob[32];
+        snprintf(knob, sizeof(knob), "fraction=%g", fraction);
+        settings.push_back({"coreset", knob, [fraction, leafSize, seed](const double* rows, size_t n, size_t dim, size_t c) -> ClassIndex* {
+                                alglib::hqrndstate state;
+                                alglib::hqrndseed(static_cast<alglib::ae_int_t>(seed), static_cast<alglib::ae_int_t>(c + 1), state);
+                                return new CoresetIndex(rows, n, dim, fraction, leafSize, state);
+                            }});
+    }
+    return settings;
+}
+
+int runPareto(const std::string& filename, const TableFormat& format, const ParetoOptions& options) {
+    std::vector<ClassMember> rows = readTable(filename, format);
+    if (rows.size() < 4) {
+        fprintf(stderr, "%s: too few rows\n", filename.c_str());
+        return 1;
+    }
+
+    // held-out queries from a seeded shuffle
+    alglib::hqrndstate state;
+    alglib::hqrndseed(static_cast<alglib::ae_int_t>(options.seed), 0, state);
+    for (size_t i = rows.size() - 1; i > 0; --i) {
+        std::swap(rows[i], rows[static_cast<size_t>(alglib::hqrnduniformi(state, static_cast<alglib::ae_int_t>(i + 1)))]);
+    }
+    size_t queryCount = std::min(rows.size() - 2, std::max<size_t>(1, static_cast<size_t>(rows.size() * options.holdout)));
+    std::vector<ClassMember> training(rows.begin() + queryCount, rows.end());
+    Model base = normalizeModel(training);
+    size_t dim = base.dim;
+    std::vector<double> queries;
+    for (size_t q = 0; q < queryCount; ++q) {
+        for (size_t f = 0; f < dim; ++f) {
+            queries.push_back((rows[q].features[f] - base.means[f]) / base.sigmas[f]);
+        }
+    }
+    printf("%s: %zu training rows, %zu held-out queries, %zu features, %zu classes, fastest of %zu runs\n",
+           filename.c_str(), training.size(), queryCount, dim, base.classNames.size(), options.repetitions);
+
+    std::vector<ParetoSetting> settings = paretoSettings(dim, options);
+    std::vector<ParetoRun> runs(settings.size());
+    for (size_t s = 0; s < settings.size(); ++s) {
+        double fastest = std::numeric_limits<double>::max(), fastestSearch = fastest;
+        for (size_t r = 0; r < std::max<size_t>(1, options.repetitions); ++r) {
+            runSetting(settings[s], base, queries, runs[s]);
+            fastest = std::min(fastest, runs[s].seconds);
+            fastestSearch = std::min(fastestSearch, runs[s].seconds - runs[s].fitSeconds);
+        }
+        runs[s].seconds = fastest;
+        runs[s].fitSeconds = fastest - fastestSearch;
+        compareWithExact(base, queries, runs[0], runs[s]);
+    }
+
+    // frontier of search time against mean p-value error: no faster setting is as accurate.
+    // The total also holds the lsfit of every class, which dwarfs the search on small
+    // tables and varies from run to run, so it would rank the settings by noise.
+    std::vector<double> search(settings.size());
+    std::vector<size_t> order(settings.size());
+    for (size_t s = 0; s < order.size(); ++s) {
+        search[s] = runs[s].seconds - runs[s].fitSeconds;
+        order[s] = s;
+    }
+    std::sort(order.begin(), order.end(), [&runs, &search](size_t a, size_t b) {
+        return search[a] < search[b] || (search[a] == search[b] && runs[a].pError < runs[b].pError);
+    });
+    std::vector<bool> frontier(settings.size(), false);
+    double bestError = std::numeric_limits<double>::max();
+    for (size_t s : order) {
+        if (runs[s].pError < bestError) {
+            frontier[s] = true;
+            bestError = runs[s].pError;
+        }
+    }
+
+    double exactSearch = search[1];   // the exact kd-tree
+    printf("\n%-12s %-14s %10s %10s %8s %10s %8s %8s %8s %9s %6s %10s %10s  %s\n", "method", "setting", "time(ms)", "search(ms)",
+           "speedup", "memory(KB)", "recall", "q-recall", "KS", "c,a drift", "family", "p err", "p err max", "pareto");
+    for (size_t s = 0; s < settings.size(); ++s) {
+        const ParetoRun& run = runs[s];
+        printf("%-12s %-14s %10.3f %10.3f %8.2f %10.1f %8.4f %8.4f %8.4f %8.2f%% %6zu %10.2e %10.2e  %s\n", settings[s].method.c_str(),
+               settings[s].knob.c_str(), run.seconds * 1e3, search[s] * 1e3, exactSearch / search[s],
+               run.bytes / 1024.0, run.trainRecall,
+               run.queryRecall, run.ks, run.drift * 100, run.familyChanges, run.pError, run.pErrorMax, frontier[s] ? "*" : "");
+    }
+    printf("\nPareto frontier (search time against mean p-value error):\n");
+    printf("%-12s %-14s %10s %10s %10s %10s\n", "method", "setting", "search(ms)", "time(ms)", "memory(KB)", "p err");
+    for (size_t s : order) {
+        if (frontier[s]) {
+            printf("%-12s %-14s %10.3f %10.3f %10.1f %10.2e\n", settings[s].method.c_str(), settings[s].knob.c_str(),
+                   search[s] * 1e3, runs[s].seconds * 1e3, runs[s].bytes / 1024.0, runs[s].pError);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef PARETO_H
+#define PARETO_H
+
+#include <string>
+#include <stdint.h>
+
+#include "dataset.h"
+
+struct ParetoOptions {
+    double holdout;          // fraction of the rows held out as queries
+    uint64_t seed;           // of the split, the coresets and the sketches
+    size_t leafSize;
+    size_t repetitions;      // runs per setting, the fastest is reported
+
+    ParetoOptions() : holdout(0.2), seed(1), leafSize(8), repetitions(3) {}
+};
+
+// Accuracy against speed of the approximate nearest neighbor modes: an
+// epsilon-approximate kd-tree, float32 rows, rows quantized to a few bits,
+// random-projection sketches and per-class coresets, each over a range of its knob.
+// Every setting trains the per-class curves and fits on the training rows and
+// scores the held-out rows; against the exact search it reports the time, the index
+// memory, the recall of the nearest neighbors of training rows and queries, the KS
+// distance of the curves, the drift of the fitted (c, a), and the error of the
+// query p-values, then the Pareto frontier of time against p-value error.
+int runPareto(const std::string& filename, const TableFormat& format, const ParetoOptions& options);
+
+#endif
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+#include "alglibmisc.h"
+
+#include "permutation.h"
+#include "model.h"
+#include "kdtree.h"
+#include "parallel.h"
+#include "trace.h"
+#include "measure.h"
+
+// rows shared by every replicate: normalized features and each row's nearest rows of any class
+struct PermutationIndex {
+    size_t rows;
+    size_t dim;
+    size_t neighbors;
+    const double* features;
+    std::vector<uint32_t> neighborRows;      // neighbors per row, nearest first, self excluded
+    std::vector<double> neighborDistances;
+    std::vector<uint64_t> classSizes;
+};
+
+// mean distance to the nearest row with the same label; rows alone in their class are skipped.
+// Returns the number of rows whose neighbor list held no row of their label (brute force scans).
+static size_t sameLabelStatistic(const PermutationIndex& index, const uint32_t* labels, double& statistic) {
+    size_t scans = 0, counted = 0;
+    double sum = 0.0;
+    for (size_t i = 0; i < index.rows; ++i) {
+        uint32_t label = labels[i];
+        if (index.classSizes[label] < 2) {
+            continue;
+        }
+        double distance = -1;
+        const uint32_t* candidates = &index.neighborRows[i * index.neighbors];
+        for (size_t n = 0; n < index.neighbors; ++n) {
+            if (labels[candidates[n]] == label) {
+                distance = index.neighborDistances[i * index.neighbors + n];
+                break;
+            }
+        }
+        if (distance < 0) {
+            ++scans;
+            double best = std::numeric_limits<double>::max();
+            const double* row = index.features + i * index.dim;
+            for (size_t j = 0; j < index.rows; ++j) {
+                if (j == i || labels[j] != label) {
+                    continue;
+                }
+                const double* other = index.features + j * index.dim;
+                double squares = 0.0;
+                for (size_t f = 0; f < index.dim; ++f) {
+                    squares += (row[f] - other[f]) * (row[f] - other[f]);
+                }
+                best = std::min(best, squares);
+            }
+            distance = std::sqrt(best);
+        }
+        sum += distance;
+        ++counted;
+    }
+    statistic = counted > 0 ? sum / counted : 0.0;
+    return scans;
+}
+
+int runPermutationTest(const std::string& filename, const TableFormat& format, const PermutationOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    for (const auto& obj : dataset) {
+        if (obj.features.size() != dataset[0].features.size()) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", obj.features.size(), dataset[0].features.size());
+            return 1;
+        }
+    }
+    Model model = normalizeModel(dataset, options.threads);
+    dataset.clear();
+    ModelView view = viewOf(model);
+    double normalizeSeconds = secondsSince(start);
+
+    // the rows are grouped by class, so the observed labels follow the class offsets
+    PermutationIndex index;
+    index.rows = view.rows;
+    index.dim = view.dim;
+    index.neighbors = std::min(options.neighbors, view.rows - 1);
+    index.features = view.features;
+    std::vector<uint32_t> labels(view.rows);
+    for (size_t c = 0; c < view.classCount; ++c) {
+        std::fill(labels.begin() + view.classOffsets[c], labels.begin() + view.classOffsets[c + 1], static_cast<uint32_t>(c));
+        index.classSizes.push_back(view.classOffsets[c + 1] - view.classOffsets[c]);
+    }
+
+    start = std::chrono::steady_clock::now();
+    KdTree tree = buildKdTree(view);
+    index.neighborRows.resize(index.rows * index.neighbors);
+    index.neighborDistances.resize(index.rows * index.neighbors);
+    parallelFor(index.rows, options.threads, [&](size_t begin, size_t end) {
+        TRACE_SPAN("task", "neighbor lists");
+        size_t k = index.neighbors + 1;
+        std::vector<FusedScratch> scratch;
+        std::vector<Neighbor> found((end - begin) * k);
+        std::vector<size_t> counts(end - begin);
+        nearestNeighborsGroup(tree, index.features + begin * index.dim, end - begin, k, scratch, found.data(), counts.data());
+        for (size_t i = begin; i < end; ++i) {
+            const Neighbor* neighbors = &found[(i - begin) * k];
+            size_t kept = 0;
+            for (size_t n = 0; n < counts[i - begin] && kept < index.neighbors; ++n) {
+                if (neighbors[n].row == i) {
+                    continue;
+                }
+                index.neighborRows[i * index.neighbors + kept] = neighbors[n].row;
+                index.neighborDistances[i * index.neighbors + kept] = neighbors[n].distance;
+                ++kept;
+            }
+        }
+    });
+    double indexSeconds = secondsSince(start);
+
+    double observed;
+    size_t observedScans = sameLabelStatistic(index, labels.data(), observed);
+
+    // every replicate shuffles its own copy of the labels with its own stream, so the
+    // statistics do not depend on how the replicates are split between threads
+    start = std::chrono::steady_clock::now();
+    std::vector<double> statistics(options.replicates);
+    std::vector<size_t> scans(options.replicates);
+    parallelFor(options.replicates, options.threads, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> permuted(labels.size());
+        alglib::hqrndstate state;
+        for (size_t r = begin; r < end; ++r) {
+            TRACE_SPAN_ARG("task", "replicate", r);
+            alglib::hqrndseed(static_cast<alglib::ae_int_t>(options.seed), static_cast<alglib::ae_int_t>(r + 1), state);
+            permuted = labels;
+            for (size_t i = permuted.size(); i > 1; --i) {
+                size_t j = static_cast<size_t>(alglib::hqrnduniformi(state, static_cast<alglib::ae_int_t>(i)));
+                std::swap(permuted[i - 1], permuted[j]);
+            }
+            scans[r] = sameLabelStatistic(index, permuted.data(), statistics[r]);
+        }
+    });
+    double replicateSeconds = secondsSince(start);
+
+    size_t asExtreme = 0, totalScans = 0;
+    double mean = 0.0, squares = 0.0;
+    for (size_t r = 0; r < options.replicates; ++r) {
+        asExtreme += statistics[r] <= observed;
+        totalScans += scans[r];
+        mean += statistics[r];
+    }
+    mean /= std::max<size_t>(1, options.replicates);
+    for (size_t r = 0; r < options.replicates; ++r) {
+        squares += (statistics[r] - mean) * (statistics[r] - mean);
+    }
+    double sd = options.replicates > 1 ? std::sqrt(squares / (options.replicates - 1)) : 0.0;
+
+    printf("%s: %zu rows, %zu features, %zu classes, %zu replicates, %zu threads, seed %llu\n", filename.c_str(), index.rows,
+           index.dim, view.classCount, options.replicates, options.threads, static_cast<unsigned long long>(options.seed));
+    printf("normalize %.3f ms, index (%zu neighbors per row) %.3f ms, replicates %.3f ms (%.3f ms each)\n",
+           normalizeSeconds * 1e3, index.neighbors, indexSeconds * 1e3, replicateSeconds * 1e3,
+           replicateSeconds * 1e3 / std::max<size_t>(1, options.replicates));
+    printf("observed mean same-class NN distance %.6f (%zu rows scanned)\n", observed, observedScans);
+    printf("permuted: mean %.6f, sd %.6f, rows scanned %.2f%%\n", mean, sd,
+           100.0 * totalScans / std::max<size_t>(1, options.replicates * index.rows));
+    printf("p-value %.6g (%zu of %zu permutations as tight)\n", (1.0 + asExtreme) / (1.0 + options.replicates), asExtreme,
+           options.replicates);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+#include <string>
+#include <stdint.h>
+
+#include "dataset.h"
+
+struct PermutationOptions {
+    size_t replicates;
+    size_t threads;
+    uint64_t seed;               // replicate r draws from the hqrnd stream seeded with (seed, r + 1)
+    size_t neighbors;            // overall nearest neighbors kept per row in the shared index
+
+    PermutationOptions() : replicates(1000), threads(1), seed(1), neighbors(16) {}
+};
+
+// Test whether the classes are tighter than chance: the statistic is the mean
+// distance from each row to its nearest row of the same class, and its null
+// distribution comes from permuting the class labels. Only the label array is
+// permuted; the normalized rows and their nearest neighbor lists are shared.
+int runPermutationTest(const std::string& filename, const TableFormat& format, const PermutationOptions& options);
+
+#endif
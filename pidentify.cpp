@@ -0,0 +1,165 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <new>
+
+#include "pidentify.h"
+#include "model.h"
+#include "segment.h"
+#include "dataset.h"
+
+// a model is either trained in-process or a mapped segment
+struct pid_model {
+    Model trained;
+    MappedSegment segment;
+    bool mapped;
+    ModelView view;
+};
+
+// per-thread scratch space, sized once when the context is created
+struct pid_context {
+    const pid_model* model;
+    std::vector<double> query;
+    std::vector<double> distances;
+};
+
+// The rows of a text table with the label last, as readTable reads it but strict:
+// false on a row that is short of the label, not numeric or of another width,
+// where readTable would drop it with a message. Only the first line may be a header.
+static bool readTrainingRows(const char* location, std::vector<ClassMember>& dataset) {
+    std::ifstream file(location);
+    std::string line;
+    TableFormat format;
+    char delimiter = 0;
+    bool firstLine = true;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        if (delimiter == 0) {
+            delimiter = line.find(';') != std::string::npos ? ';' : ',';
+        }
+        ClassMember obj;
+        TableLine parsed = parseTableLine(line.data(), line.data() + line.size(), delimiter, format, obj);
+        if (parsed == LINE_ROW && !obj.features.empty() &&
+            (dataset.empty() || obj.features.size() == dataset[0].features.size())) {
+            dataset.push_back(obj);
+        } else if (!(parsed == LINE_NOT_NUMERIC && firstLine)) {
+            return false;
+        }
+        firstLine = false;
+    }
+    return !file.bad() && !dataset.empty();
+}
+
+int pid_api_version(void) {
+    return PID_API_VERSION;
+}
+
+int pid_model_open(const char* location, pid_model** model) {
+    if (location == NULL || model == NULL) {
+        return PID_ERROR_ARGUMENT;
+    }
+    *model = NULL;
+    try {
+        pid_model* opened = new pid_model();
+        if (isSegmentLocation(location)) {
+            if (!mapSegment(location, opened->segment)) {
+                delete opened;
+                return PID_ERROR_OPEN;
+            }
+            opened->mapped = true;
+            opened->view = opened->segment.view;
+        } else {
+            std::ifstream file(location);
+            if (!file) {
+                delete opened;
+                return PID_ERROR_OPEN;
+            }
+            std::vector<ClassMember> dataset;
+            if (!readTrainingRows(location, dataset)) {
+                delete opened;
+                return PID_ERROR_FORMAT;
+            }
+            opened->trained = trainModel(dataset);
+            opened->mapped = false;
+            opened->view = viewOf(opened->trained);
+        }
+        *model = opened;
+        return PID_OK;
+    } catch (const std::bad_alloc&) {
+        return PID_ERROR_MEMORY;
+    } catch (...) {
+        return PID_ERROR_FORMAT;
+    }
+}
+
+void pid_model_close(pid_model* model) {
+    if (model == NULL) {
+        return;
+    }
+    if (model->mapped) {
+        unmapSegment(model->segment);
+    }
+    delete model;
+}
+
+size_t pid_model_dim(const pid_model* model) {
+    return model ? model->view.dim : 0;
+}
+
+size_t pid_model_class_count(const pid_model* model) {
+    return model ? model->view.classCount : 0;
+}
+
+const char* pid_model_class_name(const pid_model* model, size_t class_index) {
+    if (model == NULL || class_index >= model->view.classCount) {
+        return NULL;
+    }
+    return model->view.classNames[class_index];
+}
+
+pid_context* pid_context_create(const pid_model* model) {
+    if (model == NULL) {
+        return NULL;
+    }
+    try {
+        pid_context* context = new pid_context();
+        context->model = model;
+        context->query.resize(model->view.dim);
+        context->distances.resize(model->view.classCount);
+        return context;
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void pid_context_destroy(pid_context* context) {
+    delete context;
+}
+
+int pid_score_batch(pid_context* context, const double* rows, size_t n, double* p_values, double* distances) {
+    if (context == NULL || (n > 0 && (rows == NULL || p_values == NULL))) {
+        return PID_ERROR_ARGUMENT;
+    }
+    const ModelView& view = context->model->view;
+    for (size_t i = 0; i < n; ++i) {
+        double* rowDistances = distances ? distances + i * view.classCount : context->distances.data();
+        scoreRow(view, rows + i * view.dim, context->query.data(), rowDistances, p_values + i * view.classCount);
+    }
+    return PID_OK;
+}
+
+const char* pid_error_string(int error) {
+    switch (error) {
+        case PID_OK: return "ok";
+        case PID_ERROR_ARGUMENT: return "invalid argument";
+        case PID_ERROR_OPEN: return "cannot open model";
+        case PID_ERROR_FORMAT: return "not a dataset or model segment";
+        case PID_ERROR_MEMORY: return "out of memory";
+        default: return "unknown error";
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef PIDENTIFY_H
+#define PIDENTIFY_H
+
+/*
+ * C API of libpidentify.so for in-process scoring.
+ *
+ * A model is opened once and is read-only, so it can be shared by any number of
+ * threads. Each thread creates its own context, which owns the scratch buffers of
+ * a query; scoring through a context performs no heap allocations.
+ *
+ *     pid_model* model;
+ *     pid_model_open("iris.data", &model);
+ *     pid_context* context = pid_context_create(model);
+ *     pid_score_batch(context, rows, n, p_values, NULL);
+ *     pid_context_destroy(context);
+ *     pid_model_close(model);
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define PID_API __attribute__((visibility("default")))
+#else
+#define PID_API
+#endif
+
+#define PID_API_VERSION 1
+
+enum {
+    PID_OK = 0,
+    PID_ERROR_ARGUMENT = 1,  /* a NULL handle or buffer */
+    PID_ERROR_OPEN = 2,      /* the model file or segment cannot be opened */
+    PID_ERROR_FORMAT = 3,    /* the file holds no usable dataset or model */
+    PID_ERROR_MEMORY = 4     /* out of memory */
+};
+
+typedef struct pid_model pid_model;
+typedef struct pid_context pid_context;
+
+PID_API int pid_api_version(void);
+
+/* Open a model from a published segment ("shm:/name" or a segment file) or train
+ * one from a dataset file in the iris.data format: comma or semicolon separated
+ * features, the class label last, an optional header line. A malformed row or an
+ * empty file gives PID_ERROR_FORMAT. */
+PID_API int pid_model_open(const char* location, pid_model** model);
+PID_API void pid_model_close(pid_model* model);
+
+PID_API size_t pid_model_dim(const pid_model* model);
+PID_API size_t pid_model_class_count(const pid_model* model);
+PID_API const char* pid_model_class_name(const pid_model* model, size_t class_index);
+
+/* A scoring context for one thread at a time. */
+PID_API pid_context* pid_context_create(const pid_model* model);
+PID_API void pid_context_destroy(pid_context* context);
+
+/* Score n raw rows of pid_model_dim() values each. p_values receives n rows of
+ * pid_model_class_count() p-values; distances, if not NULL, receives the matching
+ * nearest neighbor distances. */
+PID_API int pid_score_batch(pid_context* context, const double* rows, size_t n, double* p_values, double* distances);
+
+PID_API const char* pid_error_string(int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include <vector>
+#include <algorithm>
+
+#include "pool.h"
+#include "numa.h"
+
+// the pool and deque of the current worker thread, so that nested submits stay local
+static thread_local TaskPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+TaskPool::TaskPool(size_t threads) : queued(0), pending(0), nextQueue(0), stopping(false) {
+    threads = std::max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue));
+        workerNodes.push_back(workerNode(i, threads));
+    }
+    // the following workers in turn, those on the same node first
+    victims.resize(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        std::vector<size_t> remote;
+        for (size_t offset = 1; offset < threads; ++offset) {
+            size_t victim = (i + offset) % threads;
+            (workerNodes[victim] == workerNodes[i] ? victims[i] : remote).push_back(victim);
+        }
+        victims[i].insert(victims[i].end(), remote.begin(), remote.end());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.push_back(std::thread(&TaskPool::work, this, i));
+    }
+}
+
+TaskPool::~TaskPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void TaskPool::submit(std::function<void()> task) {
+    push(currentPool == this ? currentQueue : nextQueue++ % queues.size(), std::move(task));
+}
+
+void TaskPool::submit(std::function<void()> task, size_t node) {
+    size_t first = std::lower_bound(workerNodes.begin(), workerNodes.end(), node) - workerNodes.begin();
+    size_t last = std::upper_bound(workerNodes.begin(), workerNodes.end(), node) - workerNodes.begin();
+    if (!(numaPolicy & NUMA_PIN) || first == last) {
+        submit(std::move(task));
+    } else if (currentPool == this && workerNodes[currentQueue] == node) {
+        push(currentQueue, std::move(task));
+    } else {
+        push(first + nextQueue++ % (last - first), std::move(task));
+    }
+}
+
+void TaskPool::push(size_t index, std::function<void()> task) {
+    // counted before it is queued, so that the counts never fall behind the deques
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++queued;
+        ++pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void TaskPool::wait() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+// own newest task first, otherwise the oldest task of the first non-empty victim
+bool TaskPool::take(size_t index, std::function<void()>& task) {
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t other : victims[index]) {
+        Queue& victim = *queues[other];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::work(size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    pinToNode(workerNodes[index]);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return queued > 0 || stopping; });
+            if (queued == 0 && stopping) {
+                return;
+            }
+        }
+        std::function<void()> task;
+        if (!take(index, task)) {
+            continue;  // taken by another worker, or not pushed yet
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            --queued;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if (--pending == 0) {
+                done.notify_all();
+            }
+        }
+    }
+}
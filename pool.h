@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+// Work-stealing pool: every worker has its own deque, runs its newest task first
+// and, when it runs dry, steals the oldest task of another worker. Tasks may submit
+// further tasks; those go to the submitting worker's deque. Workers are spread over
+// the NUMA nodes of numa.h; a task submitted for a node goes to a worker of that node
+// (with --numa pin), and thieves try the workers of their own node first.
+class TaskPool {
+public:
+    explicit TaskPool(size_t threads);
+    ~TaskPool();
+
+    size_t threads() const { return workers.size(); }
+    void submit(std::function<void()> task);
+    void submit(std::function<void()> task, size_t node);
+    // block until every submitted task, including the ones they submitted, has run
+    void wait();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void work(size_t index);
+    bool take(size_t index, std::function<void()>& task);
+    void push(size_t index, std::function<void()> task);
+
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+    std::vector<size_t> workerNodes;
+    std::vector<std::vector<size_t> > victims;   // per worker, the deques to steal from in order
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t queued;                 // tasks in the deques, guarded by sleepMutex
+    size_t pending;                // tasks submitted and not finished, guarded by sleepMutex
+    std::atomic<size_t> nextQueue;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include <string>
+#include <algorithm>
+
+#include "prefetch.h"
+
+size_t prefetchDistance = 2;
+size_t queryGroup = 2;
+
+bool startPrefetch(int& argc, char* argv[]) {
+    int kept = 1;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg != "--prefetch-distance" && arg != "--query-group") {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        std::string text = i + 1 < argc ? argv[++i] : "";
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+            valid = false;
+            continue;
+        }
+        size_t value = std::stoul(text);
+        if (arg == "--prefetch-distance") {
+            prefetchDistance = value;
+        } else {
+            queryGroup = std::max<size_t>(1, value);
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return valid;
+}
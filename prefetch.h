@@ -0,0 +1,39 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Software prefetching in the nearest neighbor loops. The brute-force scans and the
+// leaf scans of the kd-tree ask for the row prefetchDistance rows ahead of the one
+// they compare, and a kd-tree search pops a node one step before it visits it, with
+// the node's children or first leaf rows prefetched in between. The group searches
+// of kdtree.h take queryGroup queries in turns of one step each, so the misses of
+// one query are in flight while the others compute. Both are global options:
+//   --prefetch-distance n   rows ahead, 0 turns software prefetching off
+//   --query-group n         queries in flight per thread, 1 searches one at a time
+
+static const size_t CACHE_LINE_BYTES = 64;
+
+extern size_t prefetchDistance;
+extern size_t queryGroup;
+
+// removes the two options from the arguments and sets them; false for a malformed value
+bool startPrefetch(int& argc, char* argv[]);
+
+// asks for every cache line of [data, data + bytes) to be loaded for reading
+inline void prefetchBytes(const void* data, size_t bytes) {
+    uintptr_t line = reinterpret_cast<uintptr_t>(data) & ~static_cast<uintptr_t>(CACHE_LINE_BYTES - 1);
+    for (uintptr_t end = reinterpret_cast<uintptr_t>(data) + bytes; line < end; line += CACHE_LINE_BYTES) {
+        __builtin_prefetch(reinterpret_cast<const void*>(line), 0, 3);
+    }
+}
+
+// in a scan of rows [.., last), prefetches row i + prefetchDistance if there is one
+inline void prefetchAhead(const double* rows, size_t dim, uint64_t i, uint64_t last) {
+    if (prefetchDistance > 0 && i + prefetchDistance < last) {
+        prefetchBytes(rows + (i + prefetchDistance) * dim, dim * sizeof(double));
+    }
+}
+
+#endif
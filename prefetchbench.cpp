@@ -0,0 +1,163 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <unistd.h>
+
+#include "prefetchbench.h"
+#include "prefetch.h"
+#include "model.h"
+#include "kdtree.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// fastest of repetitions calls of search
+template <typename Search>
+static double fastestRun(size_t repetitions, Search search) {
+    double fastest = std::numeric_limits<double>::max();
+    for (size_t r = 0; r < repetitions; ++r) {
+        auto start = Clock::now();
+        search();
+        fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return fastest;
+}
+
+static bool sameNeighbors(const std::vector<Neighbor>& a, const std::vector<Neighbor>& b) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].distance != b[i].distance || a[i].row != b[i].row || a[i].classIndex != b[i].classIndex) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one line of the table; group 0 for a search without groups
+static void printSetting(const char* search, size_t distance, size_t group, double seconds, size_t queries,
+                         double reference, bool same) {
+    char groupText[24] = "-";
+    if (group > 0) {
+        snprintf(groupText, sizeof(groupText), "%zu", group);
+    }
+    printf("%-12s %9zu %6s %12.3f %12.3f %9.2fx %6s\n", search, distance, groupText, seconds * 1e3, seconds * 1e6 / queries,
+           reference / seconds, same ? "same" : "DIFFER");
+}
+
+int runPrefetchBenchmark(const std::string& filename, const TableFormat& format, const PrefetchBenchmarkOptions& options) {
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    for (const auto& obj : dataset) {
+        if (obj.features.size() != dataset[0].features.size()) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", obj.features.size(), dataset[0].features.size());
+            return 1;
+        }
+    }
+
+    // queries spread evenly over the rows as read, kept raw; the rows themselves are freed
+    size_t dim = dataset[0].features.size();
+    size_t queries = std::min(options.queries, dataset.size());
+    size_t scanQueries = std::min(options.scanQueries, queries);
+    std::vector<double> raw(queries * dim);
+    for (size_t q = 0; q < queries; ++q) {
+        const std::vector<double>& row = dataset[q * dataset.size() / queries].features;
+        std::copy(row.begin(), row.end(), &raw[q * dim]);
+    }
+    Model model = normalizeModel(dataset);
+    std::vector<ClassMember>().swap(dataset);
+    CurveFit noFit = {0, 0, -1};
+    for (size_t c = 0; c < model.classNames.size(); ++c) {
+        addClassCurve(model, std::vector<double>(), noFit);
+    }
+    ModelView view = viewOf(model);
+    KdTree tree = buildKdTree(view, options.leafSize);
+    size_t classCount = view.classCount;
+
+    std::vector<double> normalized(queries * dim);
+    std::vector<const double*> rows(queries);
+    for (size_t q = 0; q < queries; ++q) {
+        for (size_t f = 0; f < dim; ++f) {
+            normalized[q * dim + f] = (raw[q * dim + f] - view.means[f]) / view.sigmas[f];
+        }
+        rows[q] = &raw[q * dim];
+    }
+
+    std::vector<size_t> distances = options.distances, groups = options.groups;
+    if (distances.empty()) {
+        distances = {0, 2, 4, 8, 16};
+    }
+    if (groups.empty()) {
+        groups = {1, 2, 4, 8, 16};
+    }
+    double treeBytes = tree.points.size() * sizeof(double) + tree.bounds.size() * sizeof(double) +
+                       tree.nodes.size() * sizeof(KdNode) + tree.classMasks.size() * sizeof(uint64_t) +
+                       (tree.rows.size() + tree.classes.size()) * sizeof(uint32_t);
+    long cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    printf("%s: %zu rows, %zu features, %zu classes; rows %.1f MB, kd-tree %.1f MB, last level cache %s\n", filename.c_str(),
+           view.rows, dim, classCount, view.rows * dim * sizeof(double) / 1048576.0, treeBytes / 1048576.0,
+           cache > 0 ? (std::to_string(cache / 1048576) + " MB").c_str() : "unknown");
+    printf("%zu tree queries, %zu scan queries, k = %zu, leaf size %zu, fastest of %zu runs; speedup against distance 0, group 1\n",
+           queries, scanQueries, options.k, options.leafSize, options.repetitions);
+    printf("%-12s %9s %6s %12s %12s %10s %6s\n", "search", "distance", "group", "time(ms)", "us/query", "speedup", "result");
+
+    size_t savedDistance = prefetchDistance, savedGroup = queryGroup;
+    std::vector<FusedScratch> scratch;
+
+    // brute force: every scan query against every row
+    std::vector<double> scanQuery(dim), scanDistances(scanQueries * classCount), pValues(queries * classCount);
+    std::vector<double> scanReference;
+    double reference = 0;
+    for (size_t distance : distances) {
+        prefetchDistance = distance;
+        double seconds = fastestRun(options.repetitions, [&] {
+            for (size_t q = 0; q < scanQueries; ++q) {
+                scoreRow(view, &raw[q * queries / scanQueries * dim], scanQuery.data(), &scanDistances[q * classCount],
+                         &pValues[q * classCount]);
+            }
+        });
+        if (scanReference.empty()) {
+            scanReference = scanDistances;
+            reference = seconds;
+        }
+        printSetting("brute scan", distance, 0, seconds, scanQueries, reference, scanDistances == scanReference);
+    }
+
+    // the kd-tree searches: every distance with every group
+    std::vector<Neighbor> neighbors(queries * options.k), nearestReference, fusedReference;
+    std::vector<size_t> found(queries), predicted(queries), predictedReference;
+    std::vector<double> classDistances(queries * classCount), distancesReference;
+    for (int fused = 0; fused < 2; ++fused) {
+        reference = 0;
+        for (size_t distance : distances) {
+            for (size_t group : groups) {
+                prefetchDistance = distance;
+                queryGroup = std::max<size_t>(1, group);
+                double seconds = fastestRun(options.repetitions, [&] {
+                    if (fused) {
+                        fusedQueryGroup(view, tree, rows.data(), queries, options.k, scratch, neighbors.data(),
+                                        classDistances.data(), pValues.data(), predicted.data());
+                    } else {
+                        nearestNeighborsGroup(tree, normalized.data(), queries, options.k, scratch, neighbors.data(), found.data());
+                    }
+                });
+                std::vector<Neighbor>& neighborsReference = fused ? fusedReference : nearestReference;
+                if (neighborsReference.empty()) {
+                    neighborsReference = neighbors;
+                    distancesReference = classDistances;
+                    predictedReference = predicted;
+                    reference = seconds;
+                }
+                bool same = sameNeighbors(neighbors, neighborsReference) &&
+                            (!fused || (classDistances == distancesReference && predicted == predictedReference));
+                printSetting(fused ? "kd fused" : "kd nearest", distance, queryGroup, seconds, queries, reference, same);
+            }
+        }
+    }
+    prefetchDistance = savedDistance;
+    queryGroup = savedGroup;
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef PREFETCHBENCH_H
+#define PREFETCHBENCH_H
+
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+
+struct PrefetchBenchmarkOptions {
+    std::vector<size_t> distances;   // --prefetch-distance values, 0, 2, 4, 8, 16 if empty
+    std::vector<size_t> groups;      // --query-group values of the tree searches, 1, 2, 4, 8, 16 if empty
+    size_t queries;                  // queries of the kd-tree searches
+    size_t scanQueries;              // queries of the brute-force scan, each reads every row
+    size_t k;
+    size_t leafSize;
+    size_t repetitions;              // runs of each setting, the fastest is reported
+
+    PrefetchBenchmarkOptions() : queries(100000), scanQueries(20), k(5), leafSize(8), repetitions(3) {}
+};
+
+// What software prefetching and interleaved queries buy per search: the brute-force
+// scan of scoreRow over each prefetch distance, and nearestNeighborsGroup and
+// fusedQueryGroup over each distance and query group, all on one thread. The queries
+// are training rows spread evenly over the table, so consecutive queries end in
+// unrelated parts of the tree. Each setting is checked to find exactly what the
+// setting without prefetching or groups found. Meant for tables well beyond the last
+// level cache; the classes get no curves, so the fused p-values are all 1.
+int runPrefetchBenchmark(const std::string& filename, const TableFormat& format, const PrefetchBenchmarkOptions& options);
+
+#endif
@@ -8,50 +8,77 @@
 #include <algorithm>
 
 #include "classMember.h"
-
-void normalizeFeatures(std::vector<ClassMember>& dataset) {
+#include "process.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "reduce.h"
+
+// mean and standard deviation of every feature, false if they cannot normalize the dataset
+bool featureMoments(const std::vector<ClassMember>& dataset, std::vector<double>& means, std::vector<double>& sigmas,
+                    size_t threads) {
     if (dataset.empty()) {
         std::cerr << "Dataset is empty!" << std::endl;
-        return;
+        return false;
     }
 
     size_t numFeatures = dataset[0].features.size();
-    std::vector<double> means(numFeatures, 0.0);
-    std::vector<double> sigmas(numFeatures, 0.0);
-
-    // Calculate mean for each feature
     for (const auto& obj : dataset) {
         if (obj.features.size() != numFeatures) {
             fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", obj.features.size(), numFeatures);
-            return;
-        }
-        for (size_t i = 0; i < numFeatures; ++i) {
-            means[i] += obj.features[i];
+            return false;
         }
     }
+    means.assign(numFeatures, 0.0);
+    sigmas.assign(numFeatures, 0.0);
+
+    // Calculate mean for each feature
+    parallelSums(dataset.size(), numFeatures, threads, reproducibleReductions,
+                 [&dataset, numFeatures](size_t begin, size_t end, double* sums) {
+                     for (size_t row = begin; row < end; ++row) {
+                         for (size_t i = 0; i < numFeatures; ++i) {
+                             sums[i] += dataset[row].features[i];
+                         }
+                     }
+                 },
+                 means.data());
 
     for (double& mean : means) {
         mean /= dataset.size();
     }
 
     // Calculate standard deviation for each feature
-    for (const auto& obj : dataset) {
-        for (size_t i = 0; i < numFeatures; ++i) {
-            sigmas[i] += (obj.features[i] - means[i]) * (obj.features[i] - means[i]);
-        }
-    }
+    parallelSums(dataset.size(), numFeatures, threads, reproducibleReductions,
+                 [&dataset, &means, numFeatures](size_t begin, size_t end, double* sums) {
+                     for (size_t row = begin; row < end; ++row) {
+                         const std::vector<double>& features = dataset[row].features;
+                         for (size_t i = 0; i < numFeatures; ++i) {
+                             sums[i] += (features[i] - means[i]) * (features[i] - means[i]);
+                         }
+                     }
+                 },
+                 sigmas.data());
 
     for (double& sigma : sigmas) {
         sigma = std::sqrt(sigma / dataset.size());
         if (sigma == 0) {
             std::cerr << "Standard deviation is zero for feature index " << (&sigma - &sigmas[0]) << std::endl;
-            return;
+            return false;
         }
     }
+    return true;
+}
+
+void normalizeFeatures(std::vector<ClassMember>& dataset) {
+    TRACE_SPAN("stage", "normalizeFeatures");
+    std::vector<double> means;
+    std::vector<double> sigmas;
+    if (!featureMoments(dataset, means, sigmas)) {
+        return;
+    }
 
     // Normalize the dataset
     for (auto& obj : dataset) {
-        for (size_t i = 0; i < numFeatures; ++i) {
+        for (size_t i = 0; i < means.size(); ++i) {
             obj.features[i] = (obj.features[i] - means[i]) / sigmas[i];
         }
     }
@@ -68,6 +95,7 @@ double euclideanDistance(const std::vector<double>& a, const std::vector<double>
 
 
 std::vector<double> computeNearestNeighborDistances(const std::vector<ClassMember>& dataset) {
+    TRACE_SPAN("stage", "computeNearestNeighborDistances");
     std::unordered_map<std::string, std::vector<ClassMember> > classMap;
     std::vector<double> distances;
     
@@ -77,12 +105,20 @@ std::vector<double> computeNearestNeighborDistances(const std::vector<ClassMembe
     }
     
     // Compute nearest neighbor distances for each class
+    size_t classOrdinal = 0;
     for (const auto& pair : classMap) {
+        TRACE_SPAN_ARG("class", "class nn", classOrdinal++);
         const auto& classData = pair.second;
 
         for (const auto& obj : classData) {
             double minDistance = std::numeric_limits<double>::max();
-            for (const auto& neighbor : classData) {
+            for (size_t j = 0; j < classData.size(); ++j) {
+                // every row is a heap block of its own, so the next ones are fetched ahead
+                if (prefetchDistance > 0 && j + prefetchDistance < classData.size()) {
+                    const std::vector<double>& ahead = classData[j + prefetchDistance].features;
+                    prefetchBytes(ahead.data(), ahead.size() * sizeof(double));
+                }
+                const auto& neighbor = classData[j];
                 if (&obj != &neighbor) {
                     double distance = euclideanDistance(obj.features, neighbor.features);
                     if (distance < minDistance) {
@@ -95,6 +131,7 @@ std::vector<double> computeNearestNeighborDistances(const std::vector<ClassMembe
                 distances.push_back(minDistance);
             }
         }
+        countStageItems(classData.size() * (classData.size() - 1));
     }
 
     return distances;
@@ -109,10 +146,20 @@ std::vector<double> process(std::vector<ClassMember> dataset){
     std::vector<double> distances = computeNearestNeighborDistances(dataset);
 
     // sort distances in ascending order
+    TRACE_SPAN("stage", "sort/unique");
     std::sort(distances.begin(), distances.end());
 
     // eliminate duplicated results
     distances.erase(unique(distances.begin(), distances.end()),distances.end());
 
     return distances;
+}
+
+// y values of the ECDF points for sorted distances, 1 - i/(l+1)
+std::vector<double> ecdfValues(size_t l){
+    std::vector<double> y(l);
+    for (size_t i = 0; i < l; ++i) {
+        y[i] = 1 - static_cast<double>(i + 1) / (l + 1);
+    }
+    return y;
 }
\ No newline at end of file
@@ -5,6 +5,12 @@
 #include <vector>
 
 
+bool featureMoments(const std::vector<ClassMember>& dataset, std::vector<double>& means, std::vector<double>& sigmas,
+                    size_t threads = 1);
+void normalizeFeatures(std::vector<ClassMember>& dataset);
+double euclideanDistance(const std::vector<double>& a, const std::vector<double>& b);
+std::vector<double> computeNearestNeighborDistances(const std::vector<ClassMember>& dataset);
 std::vector<double> process(std::vector<ClassMember> dataset);
+std::vector<double> ecdfValues(size_t l);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "readbench.h"
+#include "reader.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// writes back and evicts the files' pages; only clean pages of a block device file system go
+static void dropCache(const std::vector<std::string>& files) {
+    for (const auto& file : files) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// share of the files' pages in the page cache
+static double cachedFraction(const std::vector<std::string>& files) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t pages = 0, cached = 0;
+    for (const auto& file : files) {
+        int fd = open(file.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        size_t bytes = static_cast<size_t>(status.st_size);
+        void* mapped = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            continue;
+        }
+        std::vector<unsigned char> resident((bytes + page - 1) / page);
+        if (mincore(mapped, bytes, resident.data()) == 0) {
+            pages += resident.size();
+            for (unsigned char flags : resident) {
+                cached += flags & 1;
+            }
+        }
+        munmap(mapped, bytes);
+    }
+    return pages > 0 ? static_cast<double>(cached) / pages : 0;
+}
+
+// fastest of repetitions calls of run, the files dropped from the page cache before each if cold
+template <typename Run>
+static double fastestRun(const std::vector<std::string>& files, size_t repetitions, bool cold, Run run) {
+    double fastest = std::numeric_limits<double>::max();
+    for (size_t r = 0; r < repetitions; ++r) {
+        if (cold) {
+            dropCache(files);
+        }
+        auto start = Clock::now();
+        run();
+        fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return fastest;
+}
+
+// every file with read() into one buffer, as std::ifstream gets it
+static bool readSequential(const std::vector<std::string>& files) {
+    std::vector<char> buffer(1 << 20);
+    for (const auto& file : files) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        while (read(fd, buffer.data(), buffer.size()) > 0) {
+        }
+        close(fd);
+    }
+    return true;
+}
+
+static bool sameRows(const std::vector<ClassMember>& a, const std::vector<ClassMember>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].name != b[i].name || a[i].features != b[i].features) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printRow(const char* phase, const char* backend, bool cold, double seconds, uint64_t bytes, const std::string& note) {
+    printf("%-8s %-14s %-6s %12.1f %10.1f  %s\n", phase, backend, cold ? "cold" : "warm", seconds * 1e3,
+           bytes / 1048576.0 / seconds, note.c_str());
+}
+
+int runReadBenchmark(const std::vector<std::string>& files, const TableFormat& format, const ReadBenchmarkOptions& options) {
+    uint64_t bytes = 0;
+    for (const auto& file : files) {
+        struct stat status;
+        if (stat(file.c_str(), &status) != 0) {
+            perror(file.c_str());
+            return 1;
+        }
+        bytes += static_cast<uint64_t>(status.st_size);
+    }
+    std::vector<TableFormat> formats(files.size(), format);
+    struct Backend {
+        const char* name;
+        ReaderBackend backend;
+        bool direct;
+    };
+    const Backend backends[] = {{"pread", READER_PREAD, false}, {"uring", READER_URING, false}, {"uring direct", READER_URING, true}};
+
+    // the reference rows, and the rows of every backend afterwards, held one at a time
+    std::vector<std::vector<ClassMember> > reference(files.size()), rows(files.size());
+    for (size_t f = 0; f < files.size(); ++f) {
+        reference[f] = readTableStream(files[f], format);
+    }
+    dropCache(files);
+    double afterDrop = cachedFraction(files);
+    size_t threads = options.threads > 0 ? options.threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+    printf("%zu files, %.1f MB; blocks of %zu KB, %zu reads in flight, %zu parser threads, fastest of %zu runs\n", files.size(),
+           bytes / 1048576.0, options.blockKB, options.depth, threads, options.repetitions);
+    printf("page cache after a drop: %.0f%% of the files%s\n", afterDrop * 100,
+           afterDrop > 0.5 ? " (the cold runs read from memory on this file system)" : "");
+    printf("%-8s %-14s %-6s %12s %10s  %s\n", "phase", "backend", "cache", "time(ms)", "MB/s", "");
+
+    int status = 0;
+    for (int cold = 1; cold >= 0; --cold) {
+        if (!cold) {
+            readSequential(files);
+        }
+        double seconds = fastestRun(files, options.repetitions, cold, [&] { readSequential(files); });
+        printRow("read", "read()", cold, seconds, bytes, "");
+        for (const Backend& backend : backends) {
+            ReaderOptions reader;
+            reader.backend = backend.backend;
+            reader.blockBytes = options.blockKB * 1024;
+            reader.depth = options.depth;
+            reader.threads = options.threads;
+            reader.direct = backend.direct;
+            ReaderStats stats;
+            bool ok = true;
+            seconds = fastestRun(files, options.repetitions, cold, [&] {
+                ok = readBlocks(files, reader, [](const FileBlock&) {}, stats) && ok;
+            });
+            std::string note = ok ? "" : "FAILED";
+            if (stats.backend != backend.backend) {
+                note += std::string(note.empty() ? "" : ", ") + "ran as " + readerBackendName(stats.backend);
+            } else if (stats.backend == READER_URING) {
+                note += std::string(stats.fixedBuffers ? "fixed buffers, " : "") + "up to " + std::to_string(stats.maxInFlight) +
+                        " in flight";
+            }
+            printRow("read", backend.name, cold, seconds, stats.bytes, note);
+            status |= !ok;
+        }
+
+        seconds = fastestRun(files, options.repetitions, cold, [&] {
+            for (size_t f = 0; f < files.size(); ++f) {
+                rows[f] = readTableStream(files[f], format);
+            }
+        });
+        printRow("ingest", "stream", cold, seconds, bytes, "");
+        for (const Backend& backend : backends) {
+            ReaderOptions reader;
+            reader.backend = backend.backend;
+            reader.blockBytes = options.blockKB * 1024;
+            reader.depth = options.depth;
+            reader.threads = options.threads;
+            reader.direct = backend.direct;
+            bool ok = true;
+            seconds = fastestRun(files, options.repetitions, cold, [&] {
+                for (auto& table : rows) {
+                    std::vector<ClassMember>().swap(table);
+                }
+                ok = readTables(files, formats, reader, [&rows](size_t f, std::vector<ClassMember>& table) {
+                    rows[f].swap(table);
+                }) && ok;
+            });
+            bool same = ok;
+            for (size_t f = 0; f < files.size() && same; ++f) {
+                same = sameRows(rows[f], reference[f]);
+            }
+            printRow("ingest", backend.name, cold, seconds, bytes, !ok ? "FAILED" : same ? "same rows" : "DIFFERENT ROWS");
+            status |= !same;
+        }
+    }
+    return status;
+}
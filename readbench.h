@@ -0,0 +1,27 @@
+#ifndef READBENCH_H
+#define READBENCH_H
+
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+
+struct ReadBenchmarkOptions {
+    size_t blockKB;          // block size of the block reader
+    size_t depth;            // reads in flight
+    size_t threads;          // parser threads, 0 for one per hardware thread
+    size_t repetitions;      // runs of each setting, the fastest is reported
+
+    ReadBenchmarkOptions() : blockKB(1024), depth(32), threads(0), repetitions(3) {}
+};
+
+// Table ingestion by backend: bytes read alone (read() in 1 MB calls, then pread,
+// io_uring and io_uring with O_DIRECT through readBlocks), then whole tables parsed
+// into rows (readTableStream, then the block reader over pread, io_uring and io_uring
+// with O_DIRECT), each with the files dropped from the page cache before every run
+// and with them cached. The rows of each backend are checked against readTableStream.
+// How much of the files the page cache still held after the drop is reported, since
+// some file systems (tmpfs, overlays) keep them regardless.
+int runReadBenchmark(const std::vector<std::string>& files, const TableFormat& format, const ReadBenchmarkOptions& options);
+
+#endif
@@ -0,0 +1,661 @@
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "reader.h"
+#include "stage.h"
+#include "trace.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+#endif
+
+// O_DIRECT wants offsets, lengths and buffers aligned to the logical block size, at most this
+static const size_t DIRECT_ALIGNMENT = 4096;
+
+ReaderBackend readerBackend = READER_AUTO;
+
+bool startReader(int& argc, char* argv[]) {
+    int kept = 1;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) != "--reader") {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        std::string backend = i + 1 < argc ? argv[++i] : "";
+        if (backend == "auto") {
+            readerBackend = READER_AUTO;
+        } else if (backend == "uring") {
+            readerBackend = READER_URING;
+        } else if (backend == "pread") {
+            readerBackend = READER_PREAD;
+        } else if (backend == "stream") {
+            readerBackend = READER_STREAM;
+        } else {
+            valid = false;
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return valid;
+}
+
+const char* readerBackendName(ReaderBackend backend) {
+    static const char* const names[] = {"auto", "uring", "pread", "stream"};
+    return names[backend];
+}
+
+static uint64_t fileSize(const std::string& filename) {
+    struct stat status;
+    return stat(filename.c_str(), &status) == 0 ? static_cast<uint64_t>(status.st_size) : 0;
+}
+
+bool useBlockReader(const std::vector<std::string>& files) {
+    if (readerBackend != READER_AUTO) {
+        return readerBackend != READER_STREAM;
+    }
+    uint64_t total = 0;
+    for (const auto& file : files) {
+        total += fileSize(file);
+    }
+    return total >= READER_AUTO_BYTES;
+}
+
+static size_t alignedBlockBytes(const ReaderOptions& options) {
+    size_t bytes = std::max<size_t>(options.blockBytes, 1);
+    return (bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+}
+
+// An io_uring instance driven with the raw system calls: one submission and one
+// completion ring shared with the kernel, and the array of submission entries.
+class UringQueue {
+public:
+    UringQueue() : fd(-1), prepared(0), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(nullptr) {}
+
+    ~UringQueue() {
+        if (sqes) {
+            munmap(sqes, sqesBytes);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingBytes);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingBytes);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // false if the kernel has no io_uring or it is disabled
+    bool open(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        }
+        sqRing = mmap(NULL, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return false;
+        }
+        cqRing = (params.features & IORING_FEAT_SINGLE_MMAP)
+                     ? sqRing
+                     : mmap(NULL, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* entriesMap = mmap(NULL, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (entriesMap == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(entriesMap);
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // false if the buffers cannot be pinned, e.g. beyond RLIMIT_MEMLOCK on older kernels
+    bool registerBuffers(const std::vector<iovec>& buffers) {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(),
+                       static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    // a read into registered buffer bufferIndex, or into *target when bufferIndex < 0;
+    // target must stay valid until the read completes
+    void prepareRead(int file, iovec* target, int bufferIndex, uint64_t offset, uint64_t tag) {
+        unsigned tail = *sqTail + prepared;
+        io_uring_sqe* entry = &sqes[tail & sqMask];
+        memset(entry, 0, sizeof(*entry));
+        entry->fd = file;
+        entry->off = offset;
+        entry->user_data = tag;
+        if (bufferIndex >= 0) {
+            entry->opcode = IORING_OP_READ_FIXED;
+            entry->addr = reinterpret_cast<uint64_t>(target->iov_base);
+            entry->len = static_cast<uint32_t>(target->iov_len);
+            entry->buf_index = static_cast<uint16_t>(bufferIndex);
+        } else {
+            entry->opcode = IORING_OP_READV;
+            entry->addr = reinterpret_cast<uint64_t>(target);
+            entry->len = 1;
+        }
+        sqArray[tail & sqMask] = tail & sqMask;
+        ++prepared;
+    }
+
+    // submits the prepared reads and waits for at least minComplete completions; false on an error
+    bool submit(unsigned minComplete) {
+        __atomic_store_n(sqTail, *sqTail + prepared, __ATOMIC_RELEASE);
+        unsigned toSubmit = prepared;
+        prepared = 0;
+        while (toSubmit > 0 || minComplete > 0) {
+            long result = syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                                  NULL, 0);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0) {
+                return false;
+            }
+            toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(result));
+            minComplete = 0;
+        }
+        return true;
+    }
+
+    // calls complete(tag, result) for every completion there is
+    template <typename Complete>
+    void reap(Complete complete) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& entry = cqes[head & cqMask];
+            uint64_t tag = entry.user_data;
+            int result = entry.res;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            complete(tag, result);
+        }
+    }
+
+private:
+    int fd;
+    unsigned prepared;   // entries written since the last submit
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingBytes, cqRingBytes, sqesBytes;
+    io_uring_sqe* sqes;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+};
+
+struct PlannedRead {
+    size_t file;
+    size_t index;
+    uint64_t offset;
+    size_t bytes;    // to the end of the block or of the file
+    size_t length;   // bytes asked for: bytes, rounded up for O_DIRECT
+};
+
+// The buffer pool and the queue of filled buffers between the reading thread and the parser threads.
+class BlockPipeline {
+public:
+    BlockPipeline(size_t buffers, size_t blockBytes) : blockBytes(blockBytes), closed(false) {
+        void* mapped = mmap(NULL, buffers * blockBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        memory = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+        for (size_t slot = buffers; slot-- > 0;) {
+            freeSlots.push_back(slot);
+        }
+        size = buffers;
+    }
+
+    ~BlockPipeline() {
+        if (memory) {
+            munmap(memory, size * blockBytes);
+        }
+    }
+
+    bool valid() const {
+        return memory != nullptr;
+    }
+
+    char* buffer(size_t slot) {
+        return memory + slot * blockBytes;
+    }
+
+    size_t buffers() const {
+        return size;
+    }
+
+    // a free buffer, -1 if there is none and wait is false
+    int take(bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait) {
+            freed.wait(lock, [this] { return !freeSlots.empty(); });
+        }
+        if (freeSlots.empty()) {
+            return -1;
+        }
+        int slot = static_cast<int>(freeSlots.back());
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    void release(size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(slot);
+        freed.notify_one();
+    }
+
+    void push(size_t slot, const FileBlock& block) {
+        std::lock_guard<std::mutex> lock(mutex);
+        filled.push_back(std::make_pair(slot, block));
+        ready.notify_one();
+    }
+
+    // no more blocks will be pushed
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        ready.notify_all();
+    }
+
+    // parses blocks until the pipeline is closed and drained
+    void parse(const std::function<void(const FileBlock&)>& consume) {
+        while (true) {
+            std::pair<size_t, FileBlock> next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return closed || !filled.empty(); });
+                if (filled.empty()) {
+                    return;
+                }
+                next = filled.front();
+                filled.pop_front();
+            }
+            consume(next.second);
+            release(next.first);
+        }
+    }
+
+private:
+    size_t blockBytes;
+    size_t size;
+    char* memory;
+    std::mutex mutex;
+    std::condition_variable freed, ready;
+    std::vector<size_t> freeSlots;
+    std::deque<std::pair<size_t, FileBlock> > filled;
+    bool closed;
+};
+
+static FileBlock filledBlock(const PlannedRead& read, const char* data, size_t bytes) {
+    FileBlock block = {read.file, read.index, read.offset, data, std::min(bytes, read.bytes)};
+    return block;
+}
+
+static void readFailed(const std::string& filename, int error) {
+    fprintf(stderr, "%s: %s\n", filename.c_str(), strerror(error));
+}
+
+// the reads in order, each with a buffer of the pool, one at a time
+static bool preadLoop(BlockPipeline& pipeline, const std::vector<PlannedRead>& plan, const std::vector<int>& fds,
+                      const std::vector<std::string>& files, ReaderStats& stats) {
+    for (const PlannedRead& read : plan) {
+        size_t slot = static_cast<size_t>(pipeline.take(true));
+        char* buffer = pipeline.buffer(slot);
+        size_t done = 0;
+        while (done < read.bytes) {
+            ssize_t result = pread(fds[read.file], buffer + done, read.length - done, read.offset + done);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0) {
+                readFailed(files[read.file], errno);
+                pipeline.release(slot);
+                return false;
+            }
+            if (result == 0) {
+                break;  // the file shrank
+            }
+            done += static_cast<size_t>(result);
+        }
+        pipeline.push(slot, filledBlock(read, buffer, done));
+        stats.maxInFlight = 1;
+    }
+    return true;
+}
+
+// up to depth reads queued on the ring while buffers are free; a short read is queued again for the rest
+static bool uringLoop(UringQueue& ring, bool fixed, BlockPipeline& pipeline, const std::vector<PlannedRead>& plan,
+                      const std::vector<int>& fds, const std::vector<std::string>& files, size_t depth, ReaderStats& stats) {
+    struct SlotRead {
+        size_t read;
+        size_t done;
+        iovec target;
+    };
+    std::vector<SlotRead> slots(pipeline.buffers());
+    size_t next = 0, inFlight = 0;
+    bool failed = false;
+    auto queue = [&](size_t slot) {
+        SlotRead& current = slots[slot];
+        const PlannedRead& read = plan[current.read];
+        current.target.iov_base = pipeline.buffer(slot) + current.done;
+        current.target.iov_len = read.length - current.done;
+        ring.prepareRead(fds[read.file], &current.target, fixed ? static_cast<int>(slot) : -1, read.offset + current.done, slot);
+        ++inFlight;
+    };
+    while ((!failed && next < plan.size()) || inFlight > 0) {
+        while (!failed && next < plan.size() && inFlight < depth) {
+            int slot = pipeline.take(inFlight == 0);
+            if (slot < 0) {
+                break;
+            }
+            slots[slot].read = next++;
+            slots[slot].done = 0;
+            queue(static_cast<size_t>(slot));
+        }
+        stats.maxInFlight = std::max(stats.maxInFlight, inFlight);
+        if (!ring.submit(1)) {
+            readFailed(files[0], errno);
+            return false;  // the reads in flight may still complete into the buffers, so they are not reused
+        }
+        ring.reap([&](uint64_t tag, int result) {
+            --inFlight;
+            SlotRead& current = slots[tag];
+            const PlannedRead& read = plan[current.read];
+            if (result < 0) {
+                readFailed(files[read.file], -result);
+                failed = true;
+                pipeline.release(tag);
+                return;
+            }
+            current.done += static_cast<size_t>(result);
+            if (result > 0 && current.done < read.bytes) {
+                queue(tag);
+                return;
+            }
+            pipeline.push(tag, filledBlock(read, pipeline.buffer(tag), current.done));
+        });
+    }
+    return !failed;
+}
+
+bool readBlocks(const std::vector<std::string>& files, const ReaderOptions& options,
+                const std::function<void(const FileBlock&)>& consume, ReaderStats& stats) {
+    size_t blockBytes = alignedBlockBytes(options);
+    size_t depth = std::max<size_t>(1, options.depth);
+    size_t threads = options.threads > 0 ? options.threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+    stats.backend = options.backend == READER_URING || options.backend == READER_AUTO ? READER_URING : READER_PREAD;
+    stats.fixedBuffers = false;
+    stats.bytes = stats.blocks = 0;
+    stats.maxInFlight = 0;
+
+    std::vector<int> fds;
+    std::vector<PlannedRead> plan;
+    bool opened = true;
+    for (size_t f = 0; f < files.size() && opened; ++f) {
+        int fd = open(files[f].c_str(), O_RDONLY | (options.direct ? O_DIRECT : 0));
+        if (fd < 0 && options.direct && errno == EINVAL) {
+            fprintf(stderr, "%s: no O_DIRECT on this file system, reading through the page cache\n", files[f].c_str());
+            fd = open(files[f].c_str(), O_RDONLY);
+        }
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0) {
+            readFailed(files[f], errno);
+            opened = false;
+            break;
+        }
+        fds.push_back(fd);
+        uint64_t size = static_cast<uint64_t>(status.st_size);
+        for (uint64_t offset = 0, index = 0; offset < size; offset += blockBytes, ++index) {
+            size_t bytes = static_cast<size_t>(std::min<uint64_t>(blockBytes, size - offset));
+            size_t length = options.direct ? (bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT : bytes;
+            PlannedRead read = {f, index, offset, bytes, length};
+            plan.push_back(read);
+            stats.bytes += bytes;
+        }
+    }
+    stats.blocks = plan.size();
+
+    // enough buffers to keep depth reads queued while every parser holds one
+    BlockPipeline pipeline(depth + threads, blockBytes);
+    bool ok = opened && pipeline.valid();
+    if (ok) {
+        uint32_t stage = currentStage;
+        std::vector<std::thread> parsers;
+        for (size_t t = 0; t < threads; ++t) {
+            parsers.push_back(std::thread([&pipeline, &consume, stage] {
+                StageScope scope(stage);
+                pipeline.parse(consume);
+            }));
+        }
+        UringQueue ring;
+        if (stats.backend == READER_URING && !ring.open(static_cast<unsigned>(depth))) {
+            if (options.backend == READER_URING) {
+                fprintf(stderr, "io_uring is not available (%s), reading with pread\n", strerror(errno));
+            }
+            stats.backend = READER_PREAD;
+        }
+        if (stats.backend == READER_URING) {
+            std::vector<iovec> buffers(pipeline.buffers());
+            for (size_t slot = 0; slot < buffers.size(); ++slot) {
+                buffers[slot].iov_base = pipeline.buffer(slot);
+                buffers[slot].iov_len = blockBytes;
+            }
+            stats.fixedBuffers = ring.registerBuffers(buffers);
+            ok = uringLoop(ring, stats.fixedBuffers, pipeline, plan, fds, files, depth, stats);
+        } else {
+            ok = preadLoop(pipeline, plan, fds, files, stats);
+        }
+        pipeline.close();
+        for (auto& parser : parsers) {
+            parser.join();
+        }
+    }   // the ring, and with it any read still queued after an error, goes before the buffers
+    for (int fd : fds) {
+        close(fd);
+    }
+    return ok;
+}
+
+// the lines that start in one block of a text table
+struct BlockLines {
+    std::string head;                  // before the first line break, the whole block if it has none
+    std::string tail;                  // after the last line break
+    bool lineBreak;
+    std::vector<ClassMember> rows;
+    size_t noLabel;                    // lines short of the label column
+    size_t notNumeric;                 // header and rows with missing values
+    bool labelled;                     // a line with a label was seen
+    TableLine first;                   // the first such line
+
+    BlockLines() : lineBreak(false), noLabel(0), notNumeric(0), labelled(false), first(LINE_ROW) {}
+};
+
+// as readTableStream takes a line: without its carriage return, skipped if empty
+static void parseLine(const char* begin, const char* end, char delimiter, const TableFormat& format, BlockLines& lines) {
+    if (end != begin && end[-1] == '\r') {
+        --end;
+    }
+    if (begin == end) {
+        return;
+    }
+    ClassMember obj;
+    TableLine parsed = parseTableLine(begin, end, delimiter, format, obj);
+    if (parsed == LINE_NO_LABEL) {
+        ++lines.noLabel;
+        return;
+    }
+    if (!lines.labelled) {
+        lines.labelled = true;
+        lines.first = parsed;
+    }
+    if (parsed == LINE_NOT_NUMERIC) {
+        ++lines.notNumeric;
+    } else {
+        lines.rows.push_back(std::move(obj));
+    }
+}
+
+static void parseBlock(const FileBlock& block, char delimiter, const TableFormat& format, BlockLines& lines) {
+    const char* end = block.data + block.bytes;
+    const char* lineBreak = std::find(block.data, end, '\n');
+    lines.head.assign(block.data, lineBreak);
+    lines.lineBreak = lineBreak != end;
+    if (!lines.lineBreak) {
+        return;
+    }
+    const char* begin = lineBreak + 1;
+    for (lineBreak = std::find(begin, end, '\n'); lineBreak != end; lineBreak = std::find(begin, end, '\n')) {
+        parseLine(begin, lineBreak, delimiter, format, lines);
+        begin = lineBreak + 1;
+    }
+    lines.tail.assign(begin, end);
+}
+
+// the rows of a file from its parsed blocks, the lines across blocks put back together
+static std::vector<ClassMember> assembleTable(const std::string& filename, std::vector<BlockLines>& blocks, char delimiter,
+                                              const TableFormat& format) {
+    size_t total = 0;
+    for (const auto& block : blocks) {
+        total += block.rows.size() + 1;
+    }
+    std::vector<ClassMember> rows;
+    rows.reserve(total);
+    size_t dropped = 0;
+    bool labelled = false;
+    // the first labelled line of the file is a header if it is not numeric
+    auto take = [&](BlockLines& lines) {
+        dropped += lines.noLabel + lines.notNumeric;
+        if (!labelled && lines.labelled) {
+            labelled = true;
+            dropped -= lines.first == LINE_NOT_NUMERIC;
+        }
+        for (auto& row : lines.rows) {
+            rows.push_back(std::move(row));
+        }
+        std::vector<ClassMember>().swap(lines.rows);
+    };
+    std::string carry;
+    for (auto& block : blocks) {
+        carry += block.head;
+        if (!block.lineBreak) {
+            continue;
+        }
+        BlockLines joined;
+        parseLine(carry.data(), carry.data() + carry.size(), delimiter, format, joined);
+        take(joined);
+        take(block);
+        carry = block.tail;
+    }
+    BlockLines last;
+    parseLine(carry.data(), carry.data() + carry.size(), delimiter, format, last);
+    take(last);
+    if (dropped > 0) {
+        fprintf(stderr, "%s: dropped %zu rows with non-numeric features\n", filename.c_str(), dropped);
+    }
+    return rows;
+}
+
+// readTableStream takes the delimiter from the first line that is not empty
+static char detectDelimiter(const std::string& filename) {
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            return line.find(';') != std::string::npos ? ';' : ',';
+        }
+    }
+    return ',';
+}
+
+bool readTables(const std::vector<std::string>& files, const std::vector<TableFormat>& formats, const ReaderOptions& options,
+                const std::function<void(size_t file, std::vector<ClassMember>& rows)>& done) {
+    TRACE_SPAN("stage", "readTables");
+    size_t blockBytes = alignedBlockBytes(options);
+    struct TextTable {
+        size_t file;
+        char delimiter;
+        std::vector<BlockLines> blocks;
+        std::atomic<size_t> blocksLeft;
+    };
+    std::vector<std::unique_ptr<TextTable> > tables;
+    std::vector<std::string> textFiles;
+    for (size_t f = 0; f < files.size(); ++f) {
+        std::vector<ClassMember> rows;
+        if (isBinaryTable(files[f])) {
+            rows = readBinaryTable(files[f]);
+        } else if (options.backend == READER_STREAM) {
+            rows = readTableStream(files[f], formats[f]);
+        } else if (fileSize(files[f]) > 0) {
+            tables.push_back(std::unique_ptr<TextTable>(new TextTable()));
+            TextTable& table = *tables.back();
+            table.file = f;
+            table.delimiter = formats[f].delimiter != 0 ? formats[f].delimiter : detectDelimiter(files[f]);
+            table.blocks.resize((fileSize(files[f]) + blockBytes - 1) / blockBytes);
+            table.blocksLeft = table.blocks.size();
+            textFiles.push_back(files[f]);
+            continue;
+        }
+        done(f, rows);
+    }
+    if (textFiles.empty()) {
+        return true;
+    }
+
+    ReaderStats stats;
+    return readBlocks(textFiles, options, [&](const FileBlock& block) {
+        TextTable& table = *tables[block.file];
+        if (block.index >= table.blocks.size()) {
+            return;  // the file grew since it was planned
+        }
+        parseBlock(block, table.delimiter, formats[table.file], table.blocks[block.index]);
+        if (--table.blocksLeft == 0) {
+            std::vector<ClassMember> rows = assembleTable(files[table.file], table.blocks, table.delimiter, formats[table.file]);
+            std::vector<BlockLines>().swap(table.blocks);
+            done(table.file, rows);
+        }
+    }, stats);
+}
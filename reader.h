@@ -0,0 +1,77 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "classMember.h"
+#include "dataset.h"
+
+// Block reader for large and many text tables. The files are read in blocks into a
+// fixed pool of page-aligned buffers, with up to depth reads queued across all the
+// files at once, and every completed block goes straight to one of the parser
+// threads, which parses the lines that start in it; its buffer is queued for the next
+// read as soon as the parser is done with it. A line that crosses blocks is put back
+// together once the last block of its file is parsed, and the rows come out in file
+// order, as readTable reads them. The backends, chosen with --reader:
+//   uring   an io_uring ring set up with the raw system calls (no liburing), the
+//           buffers registered as fixed buffers where the memlock limit allows
+//   pread   pread from the calling thread, one block after the other
+//   stream  readTableStream, file by file
+//   auto    uring, else pread where io_uring is missing or disabled, for text
+//           files of READER_AUTO_BYTES or more in total; stream otherwise (the default)
+
+enum ReaderBackend { READER_AUTO, READER_URING, READER_PREAD, READER_STREAM };
+
+static const uint64_t READER_AUTO_BYTES = 16 * 1024 * 1024;
+
+extern ReaderBackend readerBackend;
+
+// removes --reader backend from the arguments and sets readerBackend; false for an unknown backend
+bool startReader(int& argc, char* argv[]);
+const char* readerBackendName(ReaderBackend backend);
+// true if readTable should read these files with the block reader
+bool useBlockReader(const std::vector<std::string>& files);
+
+struct ReaderOptions {
+    ReaderBackend backend;   // auto picks uring or pread
+    size_t blockBytes;       // rounded up to a multiple of 4096
+    size_t depth;            // reads in flight
+    size_t threads;          // parser threads, 0 for one per hardware thread
+    bool direct;             // open with O_DIRECT: blocks go from the device into the buffers, past the page cache
+
+    ReaderOptions() : backend(readerBackend), blockBytes(1024 * 1024), depth(32), threads(0), direct(false) {}
+};
+
+struct FileBlock {
+    size_t file;             // index into the file list
+    size_t index;            // block of the file
+    uint64_t offset;
+    const char* data;
+    size_t bytes;
+};
+
+struct ReaderStats {
+    ReaderBackend backend;   // the backend that did the reading
+    bool fixedBuffers;       // io_uring reads went to registered buffers
+    uint64_t bytes;
+    uint64_t blocks;
+    size_t maxInFlight;      // most reads queued at once
+};
+
+// Reads every file whole and calls consume for each block, on the parser threads and
+// in no particular order; the block's buffer is reused after consume returns. False,
+// with a message on stderr, if a file cannot be opened or read.
+bool readBlocks(const std::vector<std::string>& files, const ReaderOptions& options,
+                const std::function<void(const FileBlock&)>& consume, ReaderStats& stats);
+
+// Reads text tables as readTable would and hands each file's rows to done as soon as
+// the file is complete, on a parser thread; done may keep the rows. Binary tables are
+// read with readBinaryTable first. False if a file cannot be read.
+bool readTables(const std::vector<std::string>& files, const std::vector<TableFormat>& formats, const ReaderOptions& options,
+                const std::function<void(size_t file, std::vector<ClassMember>& rows)>& done);
+
+#endif
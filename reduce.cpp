@@ -0,0 +1,18 @@
+#include <string>
+
+#include "reduce.h"
+
+bool reproducibleReductions = false;
+
+void startReductions(int& argc, char* argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--reproducible") {
+            reproducibleReductions = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+}
@@ -0,0 +1,67 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+
+// Parallel floating-point sums. The fast mode gives each thread one contiguous block
+// of the values and adds the blocks' sums in thread order, so the rounding, and with
+// it the last bits of the result, follows the thread count. The reproducible mode
+// (--reproducible) sums fixed chunks of REDUCTION_CHUNK values, however many threads
+// there are, and adds the chunk sums along a fixed pairwise tree, so the result is
+// bitwise the same at any thread count. Fewer values than a chunk, or one thread in
+// the fast mode, are summed in order as a plain loop would.
+
+static const size_t REDUCTION_CHUNK = 4096;
+
+extern bool reproducibleReductions;
+
+// removes --reproducible from the arguments and sets reproducibleReductions
+void startReductions(int& argc, char* argv[]);
+
+inline void addSums(double* sums, const double* more, size_t width) {
+    for (size_t i = 0; i < width; ++i) {
+        sums[i] += more[i];
+    }
+}
+
+// sums[0, width) = the sums body(begin, end, sums) adds up over [begin, end) of the n values
+template <typename Body>
+void parallelSums(size_t n, size_t width, size_t threads, bool reproducible, Body body, double* sums) {
+    std::fill(sums, sums + width, 0.0);
+    size_t chunks = (n + REDUCTION_CHUNK - 1) / REDUCTION_CHUNK;
+    if (chunks <= 1 || (!reproducible && threads <= 1)) {
+        body(static_cast<size_t>(0), n, sums);
+        return;
+    }
+    if (!reproducible) {
+        size_t blocks = std::min(threads, chunks);
+        size_t block = (n + blocks - 1) / blocks;
+        std::vector<double> partials(blocks * width, 0.0);
+        parallelFor(blocks, blocks, [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; ++b) {
+                body(b * block, std::min(n, (b + 1) * block), &partials[b * width]);
+            }
+        });
+        for (size_t b = 0; b < blocks; ++b) {
+            addSums(sums, &partials[b * width], width);
+        }
+        return;
+    }
+    std::vector<double> partials(chunks * width, 0.0);
+    parallelFor(chunks, threads, [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; ++c) {
+            body(c * REDUCTION_CHUNK, std::min(n, (c + 1) * REDUCTION_CHUNK), &partials[c * width]);
+        }
+    });
+    for (size_t stride = 1; stride < chunks; stride *= 2) {
+        for (size_t c = 0; c + stride < chunks; c += 2 * stride) {
+            addSums(&partials[c * width], &partials[(c + stride) * width], width);
+        }
+    }
+    std::copy(partials.begin(), partials.begin() + width, sums);
+}
+
+#endif
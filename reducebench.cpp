@@ -0,0 +1,78 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+#include "reducebench.h"
+#include "reduce.h"
+#include "process.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// largest relative difference between two vectors of moments
+static double relativeDifference(const std::vector<double>& a, const std::vector<double>& b) {
+    double largest = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        double scale = std::max(std::fabs(a[i]), std::fabs(b[i]));
+        if (scale > 0) {
+            largest = std::max(largest, std::fabs(a[i] - b[i]) / scale);
+        }
+    }
+    return largest;
+}
+
+int runReduceBenchmark(const std::string& filename, const TableFormat& format, const ReduceBenchmarkOptions& options) {
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    std::vector<size_t> threadCounts = options.threads;
+    if (threadCounts.empty()) {
+        threadCounts = {1, 2, 4, 8};
+    }
+    bool savedMode = reproducibleReductions;
+
+    // the reference: the plain in-order sums
+    std::vector<double> serialMeans, serialSigmas;
+    reproducibleReductions = false;
+    if (!featureMoments(dataset, serialMeans, serialSigmas)) {
+        return 1;
+    }
+    printf("%s: %zu rows, %zu features, chunks of %zu rows, fastest of %zu runs; speedup against fast, 1 thread\n",
+           filename.c_str(), dataset.size(), serialMeans.size(), REDUCTION_CHUNK, options.repetitions);
+    printf("%-13s %7s %10s %8s %9s  %s\n", "mode", "threads", "time(ms)", "speedup", "bits", "vs serial");
+
+    double reference = 0;
+    for (int reproducible = 0; reproducible < 2; ++reproducible) {
+        std::vector<double> firstMeans, firstSigmas;
+        for (size_t threads : threadCounts) {
+            reproducibleReductions = reproducible != 0;
+            threads = std::max<size_t>(1, threads);
+            std::vector<double> means, sigmas;
+            double fastest = std::numeric_limits<double>::max();
+            for (size_t r = 0; r < options.repetitions; ++r) {
+                auto start = Clock::now();
+                featureMoments(dataset, means, sigmas, threads);
+                fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+            }
+            if (reference == 0) {
+                reference = fastest;
+            }
+            bool first = firstMeans.empty();
+            if (first) {
+                firstMeans = means;
+                firstSigmas = sigmas;
+            }
+            const char* bits = first ? "-" : means == firstMeans && sigmas == firstSigmas ? "same" : "DIFFER";
+            printf("%-13s %7zu %10.3f %7.2fx %9s  %.2e\n", reproducible ? "reproducible" : "fast", threads,
+                   fastest * 1e3, reference / fastest, bits,
+                   std::max(relativeDifference(means, serialMeans), relativeDifference(sigmas, serialSigmas)));
+        }
+    }
+    reproducibleReductions = savedMode;
+    return 0;
+}
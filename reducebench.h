@@ -0,0 +1,22 @@
+#ifndef REDUCEBENCH_H
+#define REDUCEBENCH_H
+
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+
+struct ReduceBenchmarkOptions {
+    std::vector<size_t> threads;     // thread counts, 1, 2, 4, 8 if empty
+    size_t repetitions;              // runs of each setting, the fastest is reported
+
+    ReduceBenchmarkOptions() : repetitions(5) {}
+};
+
+// What --reproducible costs: featureMoments of the table in the fast and the
+// reproducible mode at each thread count. Every result is compared bit for bit with
+// the same mode on the first thread count, and by its largest relative difference
+// with the plain in-order sums of one thread.
+int runReduceBenchmark(const std::string& filename, const TableFormat& format, const ReduceBenchmarkOptions& options);
+
+#endif
@@ -0,0 +1,199 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+
+#include "scaling.h"
+#include "batch.h"
+#include "parallel.h"
+#include "measure.h"
+
+// stages below this share of the single-thread wall time are too short to judge
+static const double MIN_STAGE_SHARE = 0.05;
+
+// the median of every time over the repetitions
+static bool medianProfile(const std::string& file, const TableFormat& format, const ScalingOptions& options,
+                          size_t threads, PipelineProfile& result) {
+    std::vector<PipelineProfile> runs(options.repetitions);
+    for (auto& run : runs) {
+        if (!profilePipeline(file, format, options.k, options.leafSize, threads, run)) {
+            return false;
+        }
+    }
+    result = runs[0];
+    std::vector<double> values(runs.size());
+    for (size_t r = 0; r < runs.size(); ++r) {
+        values[r] = runs[r].wallSeconds;
+    }
+    result.wallSeconds = median(values);
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        for (size_t r = 0; r < runs.size(); ++r) {
+            values[r] = runs[r].stageBusy[stage];
+        }
+        result.stageBusy[stage] = median(values);
+        for (size_t r = 0; r < runs.size(); ++r) {
+            values[r] = runs[r].stageLongest[stage];
+        }
+        result.stageLongest[stage] = median(values);
+    }
+    return true;
+}
+
+// work of a stage relative to the first profile: point pairs for the NN search, rows otherwise
+static double workRatio(const PipelineProfile& first, const PipelineProfile& profile, size_t stage) {
+    if (stage == STAGE_NN) {
+        return first.pairs > 0 ? profile.pairs / first.pairs : 1.0;
+    }
+    return static_cast<double>(profile.rows) / first.rows;
+}
+
+// the stage's tasks spread over the threads it can use, but never shorter than its longest task
+static double stageTime(const PipelineProfile& profile, size_t stage, size_t threads) {
+    size_t usable = std::max<size_t>(1, std::min(threads, profile.stageTasks[stage]));
+    return std::max(profile.stageBusy[stage] / usable, profile.stageLongest[stage]);
+}
+
+static double stageEfficiency(const std::vector<size_t>& threads, const std::vector<PipelineProfile>& profiles,
+                              size_t t, size_t stage) {
+    double time = stageTime(profiles[t], stage, threads[t]);
+    double ratio = static_cast<double>(threads[t]) / threads[0];
+    return time > 0 ? stageTime(profiles[0], stage, threads[0]) * workRatio(profiles[0], profiles[t], stage) / (ratio * time) : 0;
+}
+
+static void reportWalls(const std::vector<size_t>& threads, const std::vector<PipelineProfile>& profiles, bool weak) {
+    printf("%8s %10s %10s %10s %10s", "threads", "rows", "wall(ms)", weak ? "scaled" : "speedup", "efficiency");
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        printf(" %10s", PIPELINE_STAGE_NAMES[stage]);
+    }
+    printf("   (stage time ms)\n");
+    const PipelineProfile& first = profiles[0];
+    for (size_t t = 0; t < threads.size(); ++t) {
+        const PipelineProfile& profile = profiles[t];
+        double ratio = static_cast<double>(threads[t]) / threads[0];
+        // strong: speedup over the first count; weak: time the first count would need for these rows
+        double speedup = weak ? first.wallSeconds * ratio / profile.wallSeconds : first.wallSeconds / profile.wallSeconds;
+        printf("%8zu %10zu %10.3f %10.3f %10.3f", threads[t], profile.rows, profile.wallSeconds * 1e3, speedup, speedup / ratio);
+        for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+            printf(" %10.3f", stageTime(profile, stage, threads[t]) * 1e3);
+        }
+        printf("\n");
+    }
+}
+
+// efficiency of every stage at every thread count, and the first stage to fall below the floor
+static void reportEfficiency(const std::vector<size_t>& threads, const std::vector<PipelineProfile>& profiles,
+                             const ScalingOptions& options, bool weak) {
+    const PipelineProfile& first = profiles[0];
+    printf("%8s %43s", "threads", "");
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        printf(" %10s", PIPELINE_STAGE_NAMES[stage]);
+    }
+    printf("   (%s efficiency per stage)\n", weak ? "weak" : "strong");
+    const char* worstStage = nullptr;
+    size_t worstThreads = 0;
+    double worstEfficiency = 0;
+    for (size_t t = 0; t < threads.size(); ++t) {
+        printf("%8zu %43s", threads[t], "");
+        for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+            double efficiency = stageEfficiency(threads, profiles, t, stage);
+            printf(" %10.3f", efficiency);
+            if (!worstStage && t > 0 && stageTime(first, stage, threads[0]) >= MIN_STAGE_SHARE * first.wallSeconds &&
+                efficiency < options.floor) {
+                worstStage = PIPELINE_STAGE_NAMES[stage];
+                worstThreads = threads[t];
+                worstEfficiency = efficiency;
+            }
+        }
+        printf("\n");
+    }
+    // what limits a stage at the last count: too few tasks, or tasks slowed down by contention
+    const PipelineProfile& last = profiles.back();
+    printf("%8s %43s", "tasks", "");
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        printf(" %10zu", last.stageTasks[stage]);
+    }
+    printf("\n%8s %43s", "busy x", "");
+    for (size_t stage = 0; stage < PIPELINE_STAGES; ++stage) {
+        double expected = first.stageBusy[stage] * workRatio(first, last, stage);
+        printf(" %10.3f", expected > 0 ? last.stageBusy[stage] / expected : 0.0);
+    }
+    printf("\n");
+    if (worstStage) {
+        printf("first stage below %.0f%% efficiency: %s at %zu threads (%.0f%%)\n", options.floor * 100, worstStage,
+               worstThreads, worstEfficiency * 100);
+    } else {
+        printf("every stage above %.0f%% efficiency\n", options.floor * 100);
+    }
+}
+
+// the rows as a CSV readTable reads
+static bool writeRows(const std::vector<ClassMember>& rows, const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    for (const auto& row : rows) {
+        for (double value : row.features) {
+            fprintf(file, "%.17g,", value);
+        }
+        fprintf(file, "%s\n", row.name.c_str());
+    }
+    return fclose(file) == 0;
+}
+
+int runScaling(const std::string& filename, const TableFormat& format, const ScalingOptions& options) {
+    std::vector<size_t> threads = options.threads;
+    if (threads.empty()) {
+        size_t hardware = defaultThreadCount();
+        for (size_t count = 1; count < hardware; count *= 2) {
+            threads.push_back(count);
+        }
+        threads.push_back(hardware);
+    }
+    std::vector<ClassMember> rows = readTable(filename, format);
+    if (rows.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    printf("%s: %zu rows, %zu features, k %zu, leaf %zu, median of %zu runs, %zu hardware threads\n", filename.c_str(),
+           rows.size(), rows[0].features.size(), options.k, options.leafSize, options.repetitions, defaultThreadCount());
+
+    if (options.strong) {
+        std::vector<PipelineProfile> profiles(threads.size());
+        for (size_t t = 0; t < threads.size(); ++t) {
+            if (!medianProfile(filename, format, options, threads[t], profiles[t])) {
+                return 1;
+            }
+        }
+        printf("\nstrong scaling: %zu rows, %zu classes\n", profiles[0].rows, profiles[0].classes);
+        reportWalls(threads, profiles, false);
+        reportEfficiency(threads, profiles, options, false);
+    }
+
+    if (options.weak) {
+        char temporary[] = "/tmp/cpv-scaling-XXXXXX";
+        int fd = mkstemp(temporary);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        std::vector<PipelineProfile> profiles(threads.size());
+        bool ok = true;
+        for (size_t t = 0; ok && t < threads.size(); ++t) {
+            ok = writeRows(jitteredCopies(rows, threads[t]), temporary) &&
+                 medianProfile(temporary, TableFormat(), options, threads[t], profiles[t]);
+        }
+        unlink(temporary);
+        if (!ok) {
+            fprintf(stderr, "weak scaling failed on the replicated table\n");
+            return 1;
+        }
+        printf("\nweak scaling: %zu rows per thread (jittered copies), %zu classes\n", rows.size(), profiles[0].classes);
+        reportWalls(threads, profiles, true);
+        reportEfficiency(threads, profiles, options, true);
+    }
+    return 0;
+}
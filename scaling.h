@@ -0,0 +1,32 @@
+#ifndef SCALING_H
+#define SCALING_H
+
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+
+struct ScalingOptions {
+    std::vector<size_t> threads;   // thread counts, 1, 2, 4, ... up to the hardware threads if empty
+    size_t repetitions;            // runs per thread count, the median of each time is reported
+    bool strong;
+    bool weak;
+    size_t k;
+    size_t leafSize;
+    double floor;                  // efficiency below which a stage counts as no longer scaling
+
+    ScalingOptions() : repetitions(3), strong(true), weak(true), k(5), leafSize(8), floor(0.5) {}
+};
+
+// Thread scaling of the batch pipeline (parse, normalize, per-class NN, ECDF, fit,
+// index build, scoring) on one table. Strong scaling runs the table itself at every
+// thread count; weak scaling runs a table of threads jittered copies of it, so the
+// rows grow with the threads. Reported per thread count: the wall time, speedup and
+// parallel efficiency of the whole run, and per stage the same for its time bound,
+// the larger of its summed task time over the threads it can use (at most its task
+// count) and its longest task, with the stage whose efficiency first falls below
+// the floor. Weak efficiencies are normalized by the work of each stage, which for
+// the nearest neighbor search grows with the square of the class sizes.
+int runScaling(const std::string& filename, const TableFormat& format, const ScalingOptions& options);
+
+#endif
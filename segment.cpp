@@ -0,0 +1,436 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+
+#include "segment.h"
+#include "dataset.h"
+
+static const char SEGMENT_MAGIC[8] = {'P', 'I', 'D', 'S', 'E', 'G', '1', 0};
+static const long HUGETLBFS_MAGIC_NUMBER = 0x958458f6;
+
+static uint64_t align64(uint64_t offset) {
+    return (offset + 63) & ~static_cast<uint64_t>(63);
+}
+
+static SegmentHeader segmentLayout(const Model& model) {
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    header.dim = model.dim;
+    header.rows = model.classOffsets.back();
+    header.classCount = model.classNames.size();
+    header.curveLength = model.curves.size();
+
+    uint64_t offset = align64(sizeof(header));
+    header.meansOffset = offset;
+    offset = align64(offset + header.dim * sizeof(double));
+    header.sigmasOffset = offset;
+    offset = align64(offset + header.dim * sizeof(double));
+    header.featuresOffset = offset;
+    offset = align64(offset + header.rows * header.dim * sizeof(double));
+    header.classOffsetsOffset = offset;
+    offset = align64(offset + (header.classCount + 1) * sizeof(uint64_t));
+    header.curveOffsetsOffset = offset;
+    offset = align64(offset + (header.classCount + 1) * sizeof(uint64_t));
+    header.curvesOffset = offset;
+    offset = align64(offset + header.curveLength * sizeof(double));
+    header.fitParamsOffset = offset;
+    offset = align64(offset + 2 * header.classCount * sizeof(double));
+    header.fitFamiliesOffset = offset;
+    offset = align64(offset + header.classCount * sizeof(int32_t));
+    header.namesOffset = offset;
+    offset = align64(offset + header.classCount * SEGMENT_NAME_LENGTH);
+    header.size = offset;
+    return header;
+}
+
+size_t segmentSize(const Model& model) {
+    return segmentLayout(model).size;
+}
+
+void writeSegment(const Model& model, void* memory) {
+    SegmentHeader header = segmentLayout(model);
+    char* base = static_cast<char*>(memory);
+    memset(base, 0, header.size);
+    memcpy(base, &header, sizeof(header));
+    memcpy(base + header.meansOffset, model.means.data(), header.dim * sizeof(double));
+    memcpy(base + header.sigmasOffset, model.sigmas.data(), header.dim * sizeof(double));
+    memcpy(base + header.featuresOffset, model.features.data(), model.features.size() * sizeof(double));
+    memcpy(base + header.classOffsetsOffset, model.classOffsets.data(), model.classOffsets.size() * sizeof(uint64_t));
+    memcpy(base + header.curveOffsetsOffset, model.curveOffsets.data(), model.curveOffsets.size() * sizeof(uint64_t));
+    memcpy(base + header.curvesOffset, model.curves.data(), model.curves.size() * sizeof(double));
+    memcpy(base + header.fitParamsOffset, model.fitParams.data(), model.fitParams.size() * sizeof(double));
+    memcpy(base + header.fitFamiliesOffset, model.fitFamilies.data(), model.fitFamilies.size() * sizeof(int32_t));
+    for (size_t c = 0; c < header.classCount; ++c) {
+        strncpy(base + header.namesOffset + c * SEGMENT_NAME_LENGTH, model.classNames[c].c_str(), SEGMENT_NAME_LENGTH - 1);
+    }
+}
+
+// count elements of elementSize at offset lie past the header and within size, aligned for their type
+static bool sectionFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t size) {
+    return offset >= sizeof(SegmentHeader) && offset <= size && offset % elementSize == 0 &&
+           count <= (size - offset) / elementSize;
+}
+
+// offsets[0..count] rise from 0 to last
+static bool offsetsValid(const uint64_t* offsets, uint64_t count, uint64_t last) {
+    if (offsets[0] != 0 || offsets[count] != last) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        if (offsets[i] > offsets[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool viewSegment(const void* memory, size_t size, ModelView& view) {
+    const char* base = static_cast<const char*>(memory);
+    if (size < sizeof(SegmentHeader)) {
+        return false;
+    }
+    SegmentHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 || header.size > size) {
+        return false;
+    }
+    // every section within the segment, so that a truncated or corrupt one is refused rather than read past
+    uint64_t limit = header.size;
+    if (header.dim == 0 || header.rows > limit / sizeof(double) / header.dim || header.classCount >= limit ||
+        !sectionFits(header.meansOffset, header.dim, sizeof(double), limit) ||
+        !sectionFits(header.sigmasOffset, header.dim, sizeof(double), limit) ||
+        !sectionFits(header.featuresOffset, header.rows * header.dim, sizeof(double), limit) ||
+        !sectionFits(header.classOffsetsOffset, header.classCount + 1, sizeof(uint64_t), limit) ||
+        !sectionFits(header.curveOffsetsOffset, header.classCount + 1, sizeof(uint64_t), limit) ||
+        !sectionFits(header.curvesOffset, header.curveLength, sizeof(double), limit) ||
+        !sectionFits(header.fitParamsOffset, 2 * header.classCount, sizeof(double), limit) ||
+        !sectionFits(header.fitFamiliesOffset, header.classCount, sizeof(int32_t), limit) ||
+        !sectionFits(header.namesOffset, header.classCount, SEGMENT_NAME_LENGTH, limit)) {
+        return false;
+    }
+    if (!offsetsValid(reinterpret_cast<const uint64_t*>(base + header.classOffsetsOffset), header.classCount, header.rows) ||
+        !offsetsValid(reinterpret_cast<const uint64_t*>(base + header.curveOffsetsOffset), header.classCount,
+                      header.curveLength)) {
+        return false;
+    }
+    for (size_t c = 0; c < header.classCount; ++c) {
+        const char* name = base + header.namesOffset + c * SEGMENT_NAME_LENGTH;
+        if (memchr(name, 0, SEGMENT_NAME_LENGTH) == NULL) {
+            return false;
+        }
+    }
+
+    view.dim = header.dim;
+    view.rows = header.rows;
+    view.classCount = header.classCount;
+    view.classNames.clear();
+    for (size_t c = 0; c < header.classCount; ++c) {
+        view.classNames.push_back(base + header.namesOffset + c * SEGMENT_NAME_LENGTH);
+    }
+    view.means = reinterpret_cast<const double*>(base + header.meansOffset);
+    view.sigmas = reinterpret_cast<const double*>(base + header.sigmasOffset);
+    view.features = reinterpret_cast<const double*>(base + header.featuresOffset);
+    view.classOffsets = reinterpret_cast<const uint64_t*>(base + header.classOffsetsOffset);
+    view.curveOffsets = reinterpret_cast<const uint64_t*>(base + header.curveOffsetsOffset);
+    view.curves = reinterpret_cast<const double*>(base + header.curvesOffset);
+    view.fitParams = reinterpret_cast<const double*>(base + header.fitParamsOffset);
+    view.fitFamilies = reinterpret_cast<const int32_t*>(base + header.fitFamiliesOffset);
+    return true;
+}
+
+static bool isSharedMemory(const std::string& location) {
+    return location.compare(0, 4, "shm:") == 0;
+}
+
+static int openLocation(const std::string& location, int flags) {
+    if (isSharedMemory(location)) {
+        return shm_open(location.c_str() + 4, flags, 0644);
+    }
+    return open(location.c_str(), flags, 0644);
+}
+
+// mappings of hugetlbfs files must cover whole huge pages
+static size_t mappingLength(int fd, size_t size) {
+    struct statfs fs;
+    if (fstatfs(fd, &fs) == 0 && static_cast<long>(fs.f_type) == HUGETLBFS_MAGIC_NUMBER) {
+        size_t page = fs.f_bsize;
+        return (size + page - 1) / page * page;
+    }
+    return size;
+}
+
+// shared memory locations and files that start with the segment magic
+bool isSegmentLocation(const std::string& location) {
+    if (isSharedMemory(location)) {
+        return true;
+    }
+    char magic[sizeof(SEGMENT_MAGIC)] = {0};
+    std::ifstream file(location, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return file && memcmp(magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0;
+}
+
+bool publishSegment(const Model& model, const std::string& location) {
+    size_t size = segmentSize(model);
+    int fd = openLocation(location, O_CREAT | O_RDWR | O_TRUNC);
+    if (fd < 0) {
+        perror(location.c_str());
+        return false;
+    }
+    size_t length = mappingLength(fd, size);
+    if (ftruncate(fd, length) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return false;
+    }
+    // hugetlbfs does not support write(), so the segment is always filled through a mapping
+    void* memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    writeSegment(model, memory);
+    munmap(memory, length);
+    return true;
+}
+
+bool mapSegment(const std::string& location, MappedSegment& segment) {
+    int fd = openLocation(location, O_RDONLY);
+    if (fd < 0) {
+        perror(location.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    segment.length = mappingLength(fd, st.st_size);
+    segment.memory = mmap(NULL, segment.length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment.memory == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    adviseHugePages(segment.memory, segment.length);   // huge shmem pages where shmem_enabled allows them
+    if (!viewSegment(segment.memory, st.st_size, segment.view)) {
+        fprintf(stderr, "%s is not a model segment\n", location.c_str());
+        munmap(segment.memory, segment.length);
+        return false;
+    }
+    return true;
+}
+
+void unmapSegment(MappedSegment& segment) {
+    munmap(segment.memory, segment.length);
+    segment.memory = NULL;
+}
+
+void removeSegment(const std::string& location) {
+    if (isSharedMemory(location)) {
+        shm_unlink(location.c_str() + 4);
+    } else {
+        unlink(location.c_str());
+    }
+}
+
+struct MemoryUsage {
+    long rssKb;
+    long pssKb;
+};
+
+// RSS and PSS of the mapping containing address, from /proc/self/smaps.
+// PSS splits every shared page between the processes mapping it.
+static MemoryUsage mappingUsage(const void* address) {
+    MemoryUsage usage = {0, 0};
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    uintptr_t target = reinterpret_cast<uintptr_t>(address);
+    bool inMapping = false;
+    while (std::getline(smaps, line)) {
+        unsigned long start, end;
+        char dash;
+        std::stringstream ss(line);
+        if (line.find(':') > line.find(' ') && ss >> std::hex >> start >> dash >> end && dash == '-') {
+            inMapping = start <= target && target < end;  // a mapping header line
+            continue;
+        }
+        if (!inMapping) {
+            continue;
+        }
+        long value;
+        if (sscanf(line.c_str(), "Rss: %ld kB", &value) == 1) {
+            usage.rssKb = value;
+        } else if (sscanf(line.c_str(), "Pss: %ld kB", &value) == 1) {
+            usage.pssKb = value;
+        }
+    }
+    return usage;
+}
+
+struct WorkerReport {
+    long rssKb;
+    long pssKb;
+    double checksum;
+};
+
+// read every page of the model the way scoring does
+static double touchModel(const ModelView& view) {
+    double sum = 0;
+    for (size_t i = 0; i < view.rows * view.dim; ++i) {
+        sum += view.features[i];
+    }
+    for (size_t i = 0; i < view.curveOffsets[view.classCount]; ++i) {
+        sum += view.curves[i];
+    }
+    return sum;
+}
+
+static void segmentWorker(bool shared, const std::string& location, int readyFd, int goFd, int resultFd) {
+    MappedSegment segment;
+    if (!mapSegment(location, segment)) {
+        _exit(1);
+    }
+
+    // a private worker loads its own copy of the model, as if read from a model file,
+    // into a mapping of its own so that the copy can be measured like the shared one
+    ModelView view = segment.view;
+    void* model = segment.memory;
+    if (!shared) {
+        model = mmap(NULL, segment.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (model == MAP_FAILED) {
+            _exit(1);
+        }
+        memcpy(model, segment.memory, segment.length);
+        unmapSegment(segment);
+        viewSegment(model, segment.length, view);
+    }
+
+    WorkerReport report;
+    report.checksum = touchModel(view);
+
+    // measure only once every worker holds the model, so shared pages are split N ways;
+    // the ready pipe is closed before waiting so that the parent sees EOF once every
+    // worker has either reported or died
+    char token = 'r';
+    if (write(readyFd, &token, 1) != 1) {
+        _exit(1);
+    }
+    close(readyFd);
+    if (read(goFd, &token, 1) != 1) {
+        _exit(1);
+    }
+    MemoryUsage usage = mappingUsage(model);
+    report.rssKb = usage.rssKb;
+    report.pssKb = usage.pssKb;
+    if (write(resultFd, &report, sizeof(report)) != sizeof(report)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+static bool runWorkers(bool shared, const std::string& location, size_t workers, std::vector<WorkerReport>& reports) {
+    int ready[2], go[2], results[2];
+    if (pipe(ready) != 0 || pipe(go) != 0 || pipe(results) != 0) {
+        perror("pipe");
+        return false;
+    }
+    std::vector<pid_t> children;
+    for (size_t i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            // only the parent may hold the write end of go, so that closing it reaches every
+            // worker, and only the workers the write ends of ready and results, so that a
+            // worker dying before its handshake shows as EOF
+            close(go[1]);
+            close(ready[0]);
+            close(results[0]);
+            segmentWorker(shared, location, ready[1], go[0], results[1]);
+        }
+        children.push_back(pid);
+    }
+    close(ready[1]);
+    close(go[0]);
+    close(results[1]);
+
+    // without every worker the measurement is off; a short read or EOF is a failed
+    // worker, and closing go releases the others
+    bool ok = children.size() == workers;
+    char token;
+    for (size_t i = 0; i < children.size() && ok; ++i) {
+        ok = read(ready[0], &token, 1) == 1;
+    }
+    for (size_t i = 0; i < children.size() && ok; ++i) {
+        ok = write(go[1], "g", 1) == 1;
+    }
+    close(go[1]);
+    for (size_t i = 0; i < children.size() && ok; ++i) {
+        WorkerReport report;
+        ok = read(results[0], &report, sizeof(report)) == sizeof(report);
+        if (ok) {
+            reports.push_back(report);
+        }
+    }
+    close(ready[0]);
+    close(results[0]);
+    for (pid_t pid : children) {
+        int status;
+        ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+    }
+    return ok;
+}
+
+int runSegmentReport(const std::string& datasetFile, const std::string& location, size_t workers) {
+    std::vector<ClassMember> dataset = readDataset(datasetFile);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", datasetFile.c_str());
+        return 1;
+    }
+    Model model = trainModel(dataset);
+    dataset.clear();
+    if (!publishSegment(model, location)) {
+        return 1;
+    }
+
+    printf("Model segment: %zu bytes (%zu rows x %zu features, %zu classes) at %s\n", segmentSize(model),
+           static_cast<size_t>(model.classOffsets.back()), model.dim, model.classNames.size(), location.c_str());
+    printf("model mapping per worker:\n");
+    printf("mode     workers  RSS/worker(kB)  PSS/worker(kB)  total PSS(kB)\n");
+
+    long totalPss[2] = {0, 0};
+    const char* modes[2] = {"shared", "private"};
+    for (int mode = 0; mode < 2; ++mode) {
+        std::vector<WorkerReport> reports;
+        if (!runWorkers(mode == 0, location, workers, reports)) {
+            fprintf(stderr, "%s workers failed\n", modes[mode]);
+            return 1;
+        }
+        long rss = 0;
+        for (const auto& report : reports) {
+            rss += report.rssKb;
+            totalPss[mode] += report.pssKb;
+        }
+        printf("%-8s %7zu  %14ld  %14ld  %13ld\n", modes[mode], workers, rss / static_cast<long>(workers),
+               totalPss[mode] / static_cast<long>(workers), totalPss[mode]);
+    }
+    printf("Savings: %ld kB per process, %ld kB across %zu workers\n",
+           (totalPss[1] - totalPss[0]) / static_cast<long>(workers), totalPss[1] - totalPss[0], workers);
+    return 0;
+}
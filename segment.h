@@ -0,0 +1,61 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <string>
+#include <stdint.h>
+
+#include "model.h"
+
+// Layout of a model segment: this header followed by 64-byte aligned arrays at the
+// given offsets. Offsets are relative to the start of the segment, so it can be
+// mapped at any address by any number of processes.
+//
+// Known gap: a segment holds no kd-tree of kdtree.h. Its readers, libpidentify and
+// the segment report, scan the rows of each class, and a process that wants the tree
+// builds a private one from the view. The tree arrays refer to each other by index
+// only, so they could follow the curves as further sections; that needs a KdTree
+// that can point into a mapping instead of owning its vectors.
+struct SegmentHeader {
+    char magic[8];
+    uint64_t size;
+    uint64_t dim;
+    uint64_t rows;
+    uint64_t classCount;
+    uint64_t curveLength;
+    uint64_t meansOffset;
+    uint64_t sigmasOffset;
+    uint64_t featuresOffset;
+    uint64_t classOffsetsOffset;
+    uint64_t curveOffsetsOffset;
+    uint64_t curvesOffset;
+    uint64_t fitParamsOffset;
+    uint64_t fitFamiliesOffset;
+    uint64_t namesOffset;
+};
+
+// class names are stored in fixed-size slots
+static const size_t SEGMENT_NAME_LENGTH = 64;
+
+size_t segmentSize(const Model& model);
+void writeSegment(const Model& model, void* memory);
+bool viewSegment(const void* memory, size_t size, ModelView& view);
+
+// A segment mapped read-only into this process. Locations are "shm:/name" for POSIX
+// shared memory or a file path, e.g. on a hugetlbfs mount for 2 MB pages.
+struct MappedSegment {
+    void* memory;
+    size_t length;
+    ModelView view;
+};
+
+bool isSegmentLocation(const std::string& location);
+bool publishSegment(const Model& model, const std::string& location);
+bool mapSegment(const std::string& location, MappedSegment& segment);
+void unmapSegment(MappedSegment& segment);
+void removeSegment(const std::string& location);
+
+// fork workers that map the shared segment, then workers that load a private copy,
+// and report the per-process RSS and PSS of the model in both cases
+int runSegmentReport(const std::string& datasetFile, const std::string& location, size_t workers);
+
+#endif
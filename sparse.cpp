@@ -0,0 +1,411 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <atomic>
+#include <numeric>
+#include <unordered_map>
+#include <algorithm>
+
+#include "sparse.h"
+#include "model.h"
+#include "fit.h"
+#include "parallel.h"
+#include "stage.h"
+#include "trace.h"
+#include "measure.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// values of the expanded table up to which --check runs the dense pipeline
+static const uint64_t SPARSE_CHECK_VALUES = 100000000;
+
+static const char* skipBlanks(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r') {
+        ++p;
+    }
+    return p;
+}
+
+static bool endOfToken(const char* p) {
+    return *p == '\0' || *p == ' ' || *p == '\t' || *p == '\r';
+}
+
+// one "index:value" pair, p moved past it
+static bool parseEntry(const char*& p, uint32_t& index, double& value) {
+    if (!isdigit(static_cast<unsigned char>(*p))) {
+        return false;
+    }
+    char* end;
+    unsigned long long parsed = strtoull(p, &end, 10);
+    if (*end != ':' || parsed >= std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    index = static_cast<uint32_t>(parsed);
+    p = end + 1;
+    value = strtod(p, &end);
+    if (end == p || !endOfToken(end) || !std::isfinite(value)) {
+        return false;
+    }
+    p = end;
+    return true;
+}
+
+SparseTable readSparseTable(const std::string& filename) {
+    TRACE_SPAN("stage", "readSparseTable");
+    SparseTable table;
+    SparseRows& rows = table.rows;
+    rows.dim = 0;
+    rows.rowOffsets.push_back(0);
+    std::ifstream file(filename);
+    std::string line;
+    std::vector<std::pair<uint32_t, double> > entries;
+    size_t dropped = 0;
+
+    while (std::getline(file, line)) {
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        const char* p = skipBlanks(line.c_str());
+        if (*p == '\0') {
+            continue;
+        }
+        const char* label = p;
+        while (!endOfToken(p)) {
+            ++p;
+        }
+        std::string name(label, p);
+        entries.clear();
+        bool valid = true;
+        for (p = skipBlanks(p); valid && *p != '\0'; p = skipBlanks(p)) {
+            if (line.compare(p - line.c_str(), 4, "qid:") == 0) {
+                while (!endOfToken(p)) {
+                    ++p;
+                }
+                continue;
+            }
+            uint32_t index;
+            double value;
+            valid = parseEntry(p, index, value);
+            if (valid) {
+                entries.push_back(std::make_pair(index, value));
+            }
+        }
+        if (!valid) {
+            ++dropped;
+            continue;
+        }
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const std::pair<uint32_t, double>& a, const std::pair<uint32_t, double>& b) { return a.first < b.first; });
+        for (size_t e = 0; e < entries.size(); ++e) {
+            double value = entries[e].second;
+            while (e + 1 < entries.size() && entries[e + 1].first == entries[e].first) {
+                value += entries[++e].second;
+            }
+            if (value != 0) {
+                rows.indices.push_back(entries[e].first);
+                rows.values.push_back(value);
+                rows.dim = std::max<size_t>(rows.dim, entries[e].first + 1);
+            }
+        }
+        rows.rowOffsets.push_back(rows.indices.size());
+        table.names.push_back(name);
+    }
+
+    if (dropped > 0) {
+        fprintf(stderr, "%s: dropped %zu malformed rows\n", filename.c_str(), dropped);
+    }
+    return table;
+}
+
+SparseModel normalizeSparseModel(const SparseTable& table) {
+    TRACE_SPAN("stage", "normalizeSparseModel");
+    const SparseRows& input = table.rows;
+    size_t n = table.names.size(), dim = input.dim;
+    SparseModel model;
+
+    // the moments over all rows: the zeros a feature leaves out add (0 - mean)^2 each
+    std::vector<double> sums(dim, 0.0), squares(dim, 0.0);
+    std::vector<uint64_t> present(dim, 0);
+    for (size_t k = 0; k < input.indices.size(); ++k) {
+        sums[input.indices[k]] += input.values[k];
+        ++present[input.indices[k]];
+    }
+    model.means.resize(dim);
+    for (size_t f = 0; f < dim; ++f) {
+        model.means[f] = sums[f] / n;
+    }
+    for (size_t k = 0; k < input.indices.size(); ++k) {
+        double diff = input.values[k] - model.means[input.indices[k]];
+        squares[input.indices[k]] += diff * diff;
+    }
+    model.inverseSigmas.resize(dim);
+    for (size_t f = 0; f < dim; ++f) {
+        double sigma = std::sqrt((squares[f] + (n - present[f]) * model.means[f] * model.means[f]) / n);
+        model.inverseSigmas[f] = sigma > 0 ? 1 / sigma : 0;  // constant features do not contribute
+    }
+
+    // group rows by class in order of first appearance
+    std::unordered_map<std::string, size_t> classIndex;
+    std::vector<std::vector<size_t> > members;
+    for (size_t i = 0; i < n; ++i) {
+        auto found = classIndex.find(table.names[i]);
+        if (found == classIndex.end()) {
+            found = classIndex.insert(std::make_pair(table.names[i], model.classNames.size())).first;
+            model.classNames.push_back(table.names[i]);
+            members.push_back(std::vector<size_t>());
+        }
+        members[found->second].push_back(i);
+    }
+
+    SparseRows& rows = model.rows;
+    rows.dim = dim;
+    rows.rowOffsets.reserve(n + 1);
+    rows.rowOffsets.push_back(0);
+    rows.indices.reserve(input.indices.size());
+    rows.values.reserve(input.values.size());
+    model.squaredNorms.reserve(n);
+    model.classOffsets.push_back(0);
+    for (const auto& classRows : members) {
+        for (size_t i : classRows) {
+            double norm = 0;
+            for (uint64_t k = input.rowOffsets[i]; k < input.rowOffsets[i + 1]; ++k) {
+                double value = input.values[k] * model.inverseSigmas[input.indices[k]];
+                if (value != 0) {
+                    rows.indices.push_back(input.indices[k]);
+                    rows.values.push_back(value);
+                    norm += value * value;
+                }
+            }
+            rows.rowOffsets.push_back(rows.indices.size());
+            model.squaredNorms.push_back(norm);
+        }
+        model.classOffsets.push_back(model.classOffsets.back() + classRows.size());
+    }
+    return model;
+}
+
+SparseIndex buildSparseIndex(const SparseModel& model) {
+    TRACE_SPAN("stage", "buildSparseIndex");
+    const SparseRows& rows = model.rows;
+    size_t n = model.squaredNorms.size();
+    SparseIndex index;
+    index.postingOffsets.assign(rows.dim + 1, 0);
+    for (uint32_t f : rows.indices) {
+        ++index.postingOffsets[f + 1];
+    }
+    std::partial_sum(index.postingOffsets.begin(), index.postingOffsets.end(), index.postingOffsets.begin());
+    index.postingRows.resize(rows.indices.size());
+    index.postingValues.resize(rows.indices.size());
+    std::vector<uint64_t> filled(index.postingOffsets.begin(), index.postingOffsets.end() - 1);
+    for (size_t r = 0; r < n; ++r) {
+        for (uint64_t k = rows.rowOffsets[r]; k < rows.rowOffsets[r + 1]; ++k) {
+            uint64_t slot = filled[rows.indices[k]]++;
+            index.postingRows[slot] = static_cast<uint32_t>(r);
+            index.postingValues[slot] = rows.values[k];
+        }
+    }
+
+    index.rowsByNorm.resize(n);
+    std::iota(index.rowsByNorm.begin(), index.rowsByNorm.end(), 0);
+    for (size_t c = 0; c + 1 < model.classOffsets.size(); ++c) {
+        std::stable_sort(index.rowsByNorm.begin() + model.classOffsets[c], index.rowsByNorm.begin() + model.classOffsets[c + 1],
+                         [&model](uint32_t a, uint32_t b) { return model.squaredNorms[a] < model.squaredNorms[b]; });
+    }
+    return index;
+}
+
+double sparseDistance(const SparseRows& rows, size_t a, size_t b) {
+    uint64_t p = rows.rowOffsets[a], pEnd = rows.rowOffsets[a + 1];
+    uint64_t q = rows.rowOffsets[b], qEnd = rows.rowOffsets[b + 1];
+    double sum = 0.0;
+    while (p < pEnd && q < qEnd) {
+        double diff;
+        if (rows.indices[p] < rows.indices[q]) {
+            diff = rows.values[p++];
+        } else if (rows.indices[q] < rows.indices[p]) {
+            diff = rows.values[q++];
+        } else {
+            diff = rows.values[p++] - rows.values[q++];
+        }
+        sum += diff * diff;
+    }
+    for (; p < pEnd; ++p) {
+        sum += rows.values[p] * rows.values[p];
+    }
+    for (; q < qEnd; ++q) {
+        sum += rows.values[q] * rows.values[q];
+    }
+    return std::sqrt(sum);
+}
+
+// bound on the rounding error of |a|^2 + |b|^2 - 2 a.b, relative to |a|^2 + |b|^2
+static const double SPARSE_DOT_TOLERANCE = 1e-9;
+
+std::vector<double> sparseClassNearestDistances(const SparseModel& model, const SparseIndex& index, size_t classIndex,
+                                                size_t threads, uint64_t& candidates) {
+    TRACE_SPAN_ARG("class", "sparse class nn", classIndex);
+    const SparseRows& rows = model.rows;
+    const std::vector<double>& norms = model.squaredNorms;
+    uint32_t first = static_cast<uint32_t>(model.classOffsets[classIndex]);
+    uint32_t last = static_cast<uint32_t>(model.classOffsets[classIndex + 1]);
+    std::vector<double> distances(last - first);
+    std::atomic<uint64_t> taken(0);
+    parallelFor(last - first, threads, [&](size_t begin, size_t end) {
+        // seen[j - first] == q + 1 once row j is a candidate of query q, dot[j - first] its dot product
+        std::vector<uint32_t> seen(last - first, 0);
+        std::vector<double> dot(last - first);
+        std::vector<uint32_t> touched;
+        uint64_t measured = 0;
+        for (size_t q = begin; q < end; ++q) {
+            uint32_t i = first + static_cast<uint32_t>(q), stamp = static_cast<uint32_t>(q + 1);
+            touched.clear();
+            for (uint64_t k = rows.rowOffsets[i]; k < rows.rowOffsets[i + 1]; ++k) {
+                const uint32_t* posting = &index.postingRows[0] + index.postingOffsets[rows.indices[k]];
+                const uint32_t* postingEnd = &index.postingRows[0] + index.postingOffsets[rows.indices[k] + 1];
+                const uint32_t* j = std::lower_bound(posting, postingEnd, first);
+                const double* value = &index.postingValues[0] + (j - &index.postingRows[0]);
+                for (; j != postingEnd && *j < last; ++j, ++value) {
+                    if (*j == i) {
+                        continue;
+                    }
+                    if (seen[*j - first] != stamp) {
+                        seen[*j - first] = stamp;
+                        dot[*j - first] = 0;
+                        touched.push_back(*j);
+                    }
+                    dot[*j - first] += rows.values[k] * *value;
+                }
+            }
+            // a row sharing no feature is at sqrt(|i|^2 + |j|^2): the smallest norm is the nearest
+            for (uint32_t r = first; r < last; ++r) {
+                uint32_t j = index.rowsByNorm[r];
+                if (j != i && seen[j - first] != stamp) {
+                    seen[j - first] = stamp;
+                    dot[j - first] = 0;
+                    touched.push_back(j);
+                    break;
+                }
+            }
+            measured += touched.size();
+
+            // squared distances from the norms, then exactly for the rows the rounding leaves in doubt
+            double bound = std::numeric_limits<double>::max();
+            for (uint32_t j : touched) {
+                dot[j - first] = norms[i] + norms[j] - 2 * dot[j - first];
+                bound = std::min(bound, dot[j - first] + SPARSE_DOT_TOLERANCE * (norms[i] + norms[j]));
+            }
+            double nearest = std::numeric_limits<double>::max();
+            for (uint32_t j : touched) {
+                if (dot[j - first] - SPARSE_DOT_TOLERANCE * (norms[i] + norms[j]) <= bound) {
+                    nearest = std::min(nearest, sparseDistance(rows, i, j));
+                }
+            }
+            distances[q] = nearest;
+        }
+        taken += measured;
+    });
+    candidates = taken;
+    countStageItems(candidates);
+    return distances;
+}
+
+// the rows as dense ClassMembers, without the constant features, for --check
+static std::vector<ClassMember> expandTable(const SparseTable& table, const SparseModel& model) {
+    std::vector<uint32_t> column(table.rows.dim, 0);
+    size_t dim = 0;
+    for (size_t f = 0; f < table.rows.dim; ++f) {
+        column[f] = static_cast<uint32_t>(dim);
+        dim += model.inverseSigmas[f] > 0;
+    }
+    std::vector<ClassMember> dataset(table.names.size());
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        dataset[i].name = table.names[i];
+        dataset[i].features.assign(dim, 0.0);
+        for (uint64_t k = table.rows.rowOffsets[i]; k < table.rows.rowOffsets[i + 1]; ++k) {
+            if (model.inverseSigmas[table.rows.indices[k]] > 0) {
+                dataset[i].features[column[table.rows.indices[k]]] = table.rows.values[k];
+            }
+        }
+    }
+    return dataset;
+}
+
+int runSparse(const std::string& filename, const SparseOptions& options) {
+    auto start = Clock::now();
+    SparseTable table = readSparseTable(filename);
+    double parseSeconds = secondsSince(start);
+    if (table.names.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    start = Clock::now();
+    SparseModel model = normalizeSparseModel(table);
+    double normalizeSeconds = secondsSince(start);
+    start = Clock::now();
+    SparseIndex index = buildSparseIndex(model);
+    double indexSeconds = secondsSince(start);
+
+    size_t classCount = model.classNames.size();
+    std::vector<std::vector<double> > distances(classCount);
+    std::vector<uint64_t> candidates(classCount);
+    std::vector<CurveFit> fits(classCount);
+    std::vector<size_t> curveLengths(classCount);
+    double nnSeconds = 0, fitSeconds = 0;
+    for (size_t c = 0; c < classCount; ++c) {
+        start = Clock::now();
+        distances[c] = sparseClassNearestDistances(model, index, c, options.threads, candidates[c]);
+        nnSeconds += secondsSince(start);
+        start = Clock::now();
+        std::vector<double> curve = classCurve(distances[c], NN_DISTANCE_CUTOFF);
+        curveLengths[c] = curve.size();
+        fits[c] = fitClassCurve(curve, model.classNames[c]);
+        fitSeconds += secondsSince(start);
+    }
+
+    size_t rows = table.names.size();
+    size_t nonzeros = table.rows.indices.size();
+    printf("%s: %zu rows, %zu features, %zu nonzeros (%.4f%% dense), %zu classes, %zu threads\n", filename.c_str(), rows,
+           table.rows.dim, nonzeros, table.rows.dim ? 100.0 * nonzeros / (static_cast<double>(rows) * table.rows.dim) : 0.0,
+           classCount, options.threads);
+    printf("parse %.3f ms, normalize %.3f ms, index %.3f ms, nn %.3f ms, fit %.3f ms\n", parseSeconds * 1e3,
+           normalizeSeconds * 1e3, indexSeconds * 1e3, nnSeconds * 1e3, fitSeconds * 1e3);
+    printf("%-16s %8s %9s %14s %6s %-12s %10s %10s\n", "class", "rows", "nnz/row", "candidates/row", "curve", "family", "c", "a");
+    size_t familyCount;
+    const SigmoidFamily* families = sigmoidFamilies(familyCount);
+    for (size_t c = 0; c < classCount; ++c) {
+        uint64_t first = model.classOffsets[c], last = model.classOffsets[c + 1];
+        double classNonzeros = static_cast<double>(model.rows.rowOffsets[last] - model.rows.rowOffsets[first]);
+        printf("%-16s %8zu %9.2f %14.2f %6zu %-12s %10.5g %10.5g\n", model.classNames[c].c_str(), static_cast<size_t>(last - first),
+               classNonzeros / (last - first), static_cast<double>(candidates[c]) / (last - first), curveLengths[c],
+               fits[c].family >= 0 ? families[fits[c].family].name : "-", fits[c].c, fits[c].a);
+    }
+
+    if (!options.check) {
+        return 0;
+    }
+    size_t dim = 0;
+    for (double scale : model.inverseSigmas) {
+        dim += scale > 0;
+    }
+    if (static_cast<uint64_t>(rows) * dim > SPARSE_CHECK_VALUES) {
+        printf("check: skipped, %zu x %zu expanded values are too many\n", rows, dim);
+        return 0;
+    }
+    Model dense = normalizeModel(expandTable(table, model));
+    double largest = 0;
+    for (size_t c = 0; c < classCount; ++c) {
+        std::vector<double> expected = classNearestDistances(dense, c);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            double scale = std::max(expected[i], distances[c][i]);
+            if (scale > 0) {
+                largest = std::max(largest, std::fabs(expected[i] - distances[c][i]) / scale);
+            }
+        }
+    }
+    printf("check: largest relative difference of the nearest neighbor distances against the dense pipeline %.2e\n", largest);
+    return largest < 1e-9 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+// Rows in compressed sparse row form: the features of row r are
+// indices/values[rowOffsets[r], rowOffsets[r + 1]), by ascending index, zeros left out.
+struct SparseRows {
+    size_t dim;                          // one past the largest feature index
+    std::vector<uint64_t> rowOffsets;    // rows + 1
+    std::vector<uint32_t> indices;
+    std::vector<double> values;
+};
+
+struct SparseTable {
+    SparseRows rows;
+    std::vector<std::string> names;      // class label of every row
+};
+
+// Read a table in the svmlight/libsvm text format, one row per line: the label, then
+// "index:value" pairs separated by spaces or tabs. Indices need not be sorted; a
+// repeated index adds up. Empty lines and '#' comments are skipped, "qid:" pairs are
+// ignored, and malformed lines are dropped with a message, as readTable drops rows.
+SparseTable readSparseTable(const std::string& filename);
+
+// The normalized rows grouped by class, as normalizeModel for dense rows. The
+// normalization only scales: every feature is divided by its standard deviation over
+// all rows, zeros included, but not centred, since subtracting the mean would fill in
+// the zeros and leaves Euclidean distances unchanged anyway. Features that are
+// constant over the table get a scale of 0 and drop out.
+struct SparseModel {
+    std::vector<std::string> classNames;
+    std::vector<double> means;           // of every feature, kept implicit in the rows
+    std::vector<double> inverseSigmas;
+    SparseRows rows;                     // scaled rows, grouped by class in order of first appearance
+    std::vector<uint64_t> classOffsets;  // first row of each class, plus the row count
+    std::vector<double> squaredNorms;    // of every scaled row
+};
+
+SparseModel normalizeSparseModel(const SparseTable& table);
+
+// Inverted index of a sparse model: for every feature the rows that have it and
+// their values, from which the dot products of a row with every row sharing a
+// feature add up, and the rows of each class by norm for the ones that share none.
+struct SparseIndex {
+    std::vector<uint64_t> postingOffsets;   // dim + 1
+    std::vector<uint32_t> postingRows;      // ascending within each feature, so each class is one run
+    std::vector<double> postingValues;
+    std::vector<uint32_t> rowsByNorm;       // each class's rows by ascending squared norm, in class order
+};
+
+SparseIndex buildSparseIndex(const SparseModel& model);
+
+// Euclidean distance of two rows, merging their sorted indices
+double sparseDistance(const SparseRows& rows, size_t a, size_t b);
+
+// Nearest neighbor distance of every row of a class to the other rows of the class,
+// as classNearestDistances. The candidates of a row are the rows the index gives for
+// its features plus, of the rows sharing none, the one with the smallest norm; their
+// squared distances follow from the norms and the dot products, and the few within
+// rounding of the nearest are measured again with sparseDistance, so the distances
+// are those of the merge. candidates counts the candidates of all rows.
+std::vector<double> sparseClassNearestDistances(const SparseModel& model, const SparseIndex& index, size_t classIndex,
+                                                size_t threads, uint64_t& candidates);
+
+struct SparseOptions {
+    size_t threads;
+    bool check;          // compare with the dense pipeline on the expanded rows
+    SparseOptions() : threads(1), check(false) {}
+};
+
+// the curve and fit of every class of a sparse table, with the time of each stage
+int runSparse(const std::string& filename, const SparseOptions& options);
+
+#endif
@@ -0,0 +1,44 @@
+#include <mutex>
+
+#include "stage.h"
+
+StageStats stageTable[MAX_STAGES];
+thread_local uint32_t currentStage = 0;
+StageHook stageHook = nullptr;
+bool stagesEnabled = false;
+
+static std::mutex stageMutex;
+static uint32_t usedStages = 1;
+
+// the last stage looked up by this thread, spans in a loop mostly reopen the same stage
+static thread_local const char* cachedName = nullptr;
+static thread_local int64_t cachedIndex = -1;
+static thread_local uint32_t cachedSlot = 0;
+
+uint32_t stageSlot(const char* name, int64_t index) {
+    if (name == cachedName && index == cachedIndex) {
+        return cachedSlot;
+    }
+    std::lock_guard<std::mutex> lock(stageMutex);
+    uint32_t slot = 1;
+    while (slot < usedStages && !(stageTable[slot].name == name && stageTable[slot].index == index)) {
+        ++slot;
+    }
+    if (slot == usedStages) {
+        if (usedStages == MAX_STAGES) {
+            return 0;
+        }
+        stageTable[slot].index = index;
+        stageTable[slot].name = name;
+        ++usedStages;
+    }
+    cachedName = name;
+    cachedIndex = index;
+    cachedSlot = slot;
+    return slot;
+}
+
+uint32_t stageCount() {
+    std::lock_guard<std::mutex> lock(stageMutex);
+    return usedStages;
+}
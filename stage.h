@@ -0,0 +1,103 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// Pipeline stages for attributing resources. A StageScope makes a stage, named by
+// a static string and, for the "class" category, the class index, the current
+// stage of its thread until the scope ends; memory.cpp charges every allocation to
+// the current stage of the allocating thread and counters.cpp reads the hardware
+// counters on entering and leaving a stage. TRACE_SPAN opens a StageScope, so every
+// traced span is also a stage, and parallelFor carries the stage into its workers.
+// Stages are only kept while stagesEnabled is set; otherwise a StageScope is a
+// single test of the flag, so the plain runs pay nothing for the spans.
+
+static const uint32_t MAX_STAGES = 512;
+
+struct StageStats {
+    const char* name;                     // null for an unused slot
+    int64_t index;                        // class index, -1 for other stages
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> allocatedBytes;
+    std::atomic<int64_t> liveBytes;       // allocated in the stage and not yet freed
+    std::atomic<int64_t> peakLiveBytes;
+    std::atomic<int64_t> peakProcessBytes;  // live bytes of the whole process while the stage was active
+    std::atomic<int64_t> peakRssBytes;      // sampled resident set size while the stage was active
+    std::atomic<int32_t> active;          // threads currently inside the stage
+    std::atomic<uint64_t> calls;          // scopes entered
+    std::atomic<uint64_t> items;          // work items such as the point pairs of a distance loop
+};
+
+// set by memory accounting and the counters, before any thread opens a stage
+extern bool stagesEnabled;
+
+// called on entering and leaving every stage when set, before any thread opens a stage
+typedef void (*StageHook)(uint32_t slot, bool enter);
+extern StageHook stageHook;
+
+// slot 0 collects everything outside a stage; slots past MAX_STAGES fall back to it
+extern StageStats stageTable[MAX_STAGES];
+extern thread_local uint32_t currentStage;
+
+uint32_t stageSlot(const char* name, int64_t index);
+uint32_t stageCount();
+
+inline void countStageItems(uint64_t items) {
+    if (stagesEnabled) {
+        stageTable[currentStage].items.fetch_add(items, std::memory_order_relaxed);
+    }
+}
+
+inline void raiseTo(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+class StageScope {
+public:
+    StageScope(const char* category, const char* name, int64_t index = -1) : open(stagesEnabled), previous(0), slot(0) {
+        if (open) {
+            slot = stageSlot(name, strcmp(category, "class") == 0 ? index : -1);
+            enter();
+        }
+    }
+    // reopens a stage by slot, in a worker thread working for it
+    explicit StageScope(uint32_t slot) : open(stagesEnabled), previous(0), slot(slot) {
+        if (open) {
+            enter();
+        }
+    }
+    ~StageScope() {
+        if (!open) {
+            return;
+        }
+        if (stageHook) {
+            stageHook(slot, false);
+        }
+        stageTable[slot].active.fetch_sub(1, std::memory_order_relaxed);
+        currentStage = previous;
+    }
+
+private:
+    StageScope(const StageScope&);
+    StageScope& operator=(const StageScope&);
+
+    void enter() {
+        previous = currentStage;
+        currentStage = slot;
+        stageTable[slot].active.fetch_add(1, std::memory_order_relaxed);
+        stageTable[slot].calls.fetch_add(1, std::memory_order_relaxed);
+        if (stageHook) {
+            stageHook(slot, true);
+        }
+    }
+
+    bool open;
+    uint32_t previous;
+    uint32_t slot;
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#include "stream.h"
+#include "process.h"
+#include "fit.h"
+#include "trace.h"
+
+// AirQualityUCI marks missing sensor readings with -200
+static const double AIR_QUALITY_MISSING = -200;
+
+// removals from the window between recomputations of its running moments
+static const size_t WINDOW_RECOMPUTE_ROWS = 4096;
+
+// days since 1970-01-01 for a civil date
+static long daysFromCivil(long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+// Read the next row of AirQualityUCI.csv: "dd/mm/yyyy;hh.mm.ss;v;v;...;;" with decimal commas.
+// The header and the empty trailing rows are skipped.
+bool readAirQualityRow(std::istream& in, StreamRow& row) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();  // CRLF line endings
+        }
+        std::stringstream ss(line);
+        std::string date, time, field;
+        std::getline(ss, date, ';');
+        std::getline(ss, time, ';');
+
+        int day, month, year, hour, minute, second;
+        if (sscanf(date.c_str(), "%d/%d/%d", &day, &month, &year) != 3 ||
+            sscanf(time.c_str(), "%d.%d.%d", &hour, &minute, &second) != 3) {
+            continue;  // header or empty row
+        }
+
+        row.label = date + " " + time;
+        row.timestamp = daysFromCivil(year, month, day) * 86400.0 + hour * 3600 + minute * 60 + second;
+        row.features.clear();
+        while (std::getline(ss, field, ';')) {
+            if (field.empty()) {
+                continue;  // trailing separators
+            }
+            std::replace(field.begin(), field.end(), ',', '.');
+            double value = std::stod(field);
+            row.features.push_back(value == AIR_QUALITY_MISSING ? std::numeric_limits<double>::quiet_NaN() : value);
+        }
+        return true;
+    }
+    return false;
+}
+
+// Euclidean distance between two rows scaled by inverse sigmas. Features missing in
+// either row are skipped and the sum is rescaled to the full dimension.
+static double windowDistance(const double* a, const double* b, const std::vector<double>& invSigmas) {
+    double sum = 0.0;
+    size_t used = 0, active = 0;
+    for (size_t i = 0; i < invSigmas.size(); ++i) {
+        if (invSigmas[i] == 0) {
+            continue;
+        }
+        ++active;
+        double diff = (a[i] - b[i]) * invSigmas[i];
+        if (diff == diff) {  // not NaN
+            sum += diff * diff;
+            ++used;
+        }
+    }
+    if (used == 0) {
+        return std::numeric_limits<double>::max();
+    }
+    return std::sqrt(sum * active / used);
+}
+
+SlidingWindow::SlidingWindow(size_t dim, size_t maxRows, double maxSeconds)
+    : dim(dim), maxRows(maxRows), maxSeconds(maxSeconds), capacity(0), head(0), count(0), sigmasDirty(true), removals(0),
+      means(dim, 0.0), deviations(dim, 0.0), present(dim, 0), invSigmas(dim, 0.0) {
+    // a count-based window never grows beyond maxRows, a time-based one doubles on demand
+    capacity = maxRows > 0 ? maxRows : 64;
+    rows.resize(capacity * dim);
+    times.resize(capacity);
+}
+
+void SlidingWindow::grow() {
+    std::vector<double> newRows(2 * capacity * dim);
+    std::vector<double> newTimes(2 * capacity);
+    for (size_t i = 0; i < count; ++i) {
+        size_t slot = (head + i) % capacity;
+        std::copy(&rows[slot * dim], &rows[slot * dim] + dim, &newRows[i * dim]);
+        newTimes[i] = times[slot];
+    }
+    rows.swap(newRows);
+    times.swap(newTimes);
+    capacity *= 2;
+    head = 0;
+}
+
+// Welford's update run backwards: the mean without the row, and the deviations it added
+void SlidingWindow::popFront() {
+    const double* row = &rows[head * dim];
+    for (size_t i = 0; i < dim; ++i) {
+        if (row[i] == row[i]) {
+            if (--present[i] == 0) {
+                means[i] = 0;
+                deviations[i] = 0;
+                continue;
+            }
+            double delta = row[i] - means[i];
+            means[i] -= delta / present[i];
+            deviations[i] = std::max(0.0, deviations[i] - delta * (row[i] - means[i]));
+        }
+    }
+    head = (head + 1) % capacity;
+    --count;
+    sigmasDirty = true;
+    if (++removals == WINDOW_RECOMPUTE_ROWS) {
+        recomputeMoments();
+    }
+}
+
+// the moments of the rows in the window, in two passes
+void SlidingWindow::recomputeMoments() {
+    std::fill(means.begin(), means.end(), 0.0);
+    std::fill(deviations.begin(), deviations.end(), 0.0);
+    std::fill(present.begin(), present.end(), 0);
+    for (size_t r = 0; r < count; ++r) {
+        const double* row = &rows[(head + r) % capacity * dim];
+        for (size_t i = 0; i < dim; ++i) {
+            if (row[i] == row[i]) {
+                means[i] += row[i];
+                ++present[i];
+            }
+        }
+    }
+    for (size_t i = 0; i < dim; ++i) {
+        means[i] = present[i] > 0 ? means[i] / present[i] : 0;
+    }
+    for (size_t r = 0; r < count; ++r) {
+        const double* row = &rows[(head + r) % capacity * dim];
+        for (size_t i = 0; i < dim; ++i) {
+            if (row[i] == row[i]) {
+                deviations[i] += (row[i] - means[i]) * (row[i] - means[i]);
+            }
+        }
+    }
+    removals = 0;
+}
+
+void SlidingWindow::push(double timestamp, const std::vector<double>& row) {
+    if (maxRows > 0 && count == maxRows) {
+        popFront();
+    }
+    if (count == capacity) {
+        grow();
+    }
+    size_t slot = (head + count) % capacity;
+    std::copy(row.begin(), row.end(), &rows[slot * dim]);
+    times[slot] = timestamp;
+    for (size_t i = 0; i < dim; ++i) {
+        if (row[i] == row[i]) {
+            double delta = row[i] - means[i];
+            means[i] += delta / ++present[i];
+            deviations[i] += delta * (row[i] - means[i]);
+        }
+    }
+    ++count;
+    sigmasDirty = true;
+}
+
+void SlidingWindow::expire(double now) {
+    if (maxSeconds <= 0) {
+        return;
+    }
+    while (count > 0 && times[head] < now - maxSeconds) {
+        popFront();
+    }
+}
+
+void SlidingWindow::updateInvSigmas() {
+    for (size_t i = 0; i < dim; ++i) {
+        invSigmas[i] = 0;
+        if (present[i] < 2) {
+            continue;
+        }
+        double variance = deviations[i] / present[i];
+        if (variance > 0) {
+            invSigmas[i] = 1 / std::sqrt(variance);
+        }
+    }
+    sigmasDirty = false;
+}
+
+double SlidingWindow::nearestDistance(const std::vector<double>& row) {
+    if (sigmasDirty) {
+        updateInvSigmas();
+    }
+    double minDistance = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < count; ++i) {
+        size_t slot = (head + i) % capacity;
+        double distance = windowDistance(row.data(), &rows[slot * dim], invSigmas);
+        if (distance < minDistance) {
+            minDistance = distance;
+        }
+    }
+    return minDistance;
+}
+
+void SlidingWindow::snapshot(std::vector<double>& out, std::vector<double>& sigmas) {
+    if (sigmasDirty) {
+        updateInvSigmas();
+    }
+    out.resize(count * dim);
+    for (size_t i = 0; i < count; ++i) {
+        size_t slot = (head + i) % capacity;
+        std::copy(&rows[slot * dim], &rows[slot * dim] + dim, &out[i * dim]);
+    }
+    sigmas = invSigmas;
+}
+
+// the curve the rows are currently scored against
+struct WindowModel {
+    std::vector<double> sortedDistances;
+    FitResult fit;
+    bool hasFit;
+};
+
+// Refits the window curve on a background thread. The scoring thread hands over
+// snapshots; when the worker is busy only the latest snapshot is kept.
+class BackgroundRefitter {
+public:
+    BackgroundRefitter(size_t dim) : dim(dim), pending(false), stopping(false), refits(0) {
+        worker = std::thread(&BackgroundRefitter::run, this);
+    }
+
+    ~BackgroundRefitter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        worker.join();
+    }
+
+    void submit(SlidingWindow& window) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            window.snapshot(pendingRows, pendingInvSigmas);
+            pending = true;
+        }
+        wakeup.notify_one();
+    }
+
+    std::shared_ptr<const WindowModel> current() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return model;
+    }
+
+    size_t refitCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return refits;
+    }
+
+private:
+    void run() {
+        std::vector<double> rows, invSigmas;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return pending || stopping; });
+                if (stopping) {
+                    return;
+                }
+                rows.swap(pendingRows);
+                invSigmas.swap(pendingInvSigmas);
+                pending = false;
+            }
+
+            std::shared_ptr<WindowModel> fitted = refit(rows, invSigmas);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            model = fitted;
+            ++refits;
+        }
+    }
+
+    std::shared_ptr<WindowModel> refit(const std::vector<double>& rows, const std::vector<double>& invSigmas) {
+        TRACE_SPAN("task", "window refit");
+        std::shared_ptr<WindowModel> fitted = std::make_shared<WindowModel>();
+        size_t n = rows.size() / dim;
+
+        // nearest neighbor distance of every window row to the rest of the window.
+        // No distance cutoff here: with a dozen sensor features most distances exceed 1.
+        std::vector<double>& distances = fitted->sortedDistances;
+        for (size_t i = 0; i < n; ++i) {
+            double minDistance = std::numeric_limits<double>::max();
+            for (size_t j = 0; j < n; ++j) {
+                if (i != j) {
+                    minDistance = std::min(minDistance, windowDistance(&rows[i * dim], &rows[j * dim], invSigmas));
+                }
+            }
+            if (minDistance < std::numeric_limits<double>::max()) {
+                distances.push_back(minDistance);
+            }
+        }
+        std::sort(distances.begin(), distances.end());
+        distances.erase(std::unique(distances.begin(), distances.end()), distances.end());
+
+        fitted->hasFit = false;
+        if (distances.size() >= 2) {
+            try {
+                fitted->fit = selectBestFit(fitAllFamilies(distances, ecdfValues(distances.size())));
+                fitted->hasFit = true;
+            } catch (alglib::ap_error alglib_exception) {
+                // keep scoring with the empirical curve
+            }
+        }
+        return fitted;
+    }
+
+    size_t dim;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<double> pendingRows;
+    std::vector<double> pendingInvSigmas;
+    bool pending;
+    bool stopping;
+    size_t refits;
+    std::shared_ptr<const WindowModel> model;
+};
+
+// fraction of window distances at least as large as distance
+static double empiricalPValue(const std::vector<double>& sortedDistances, double distance) {
+    size_t below = std::lower_bound(sortedDistances.begin(), sortedDistances.end(), distance) - sortedDistances.begin();
+    return static_cast<double>(sortedDistances.size() - below + 1) / (sortedDistances.size() + 1);
+}
+
+static void printLatencies(const char* title, std::vector<double>& latencies) {
+    if (latencies.empty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    printf("%s: mean %.2f p50 %.2f p99 %.2f max %.2f\n", title, total / latencies.size(), latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100], latencies.back());
+}
+
+int runStream(const StreamOptions& options) {
+    std::ifstream file(options.filename);
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", options.filename.c_str());
+        return 1;
+    }
+
+    StreamRow row;
+    if (!readAirQualityRow(file, row)) {
+        fprintf(stderr, "No rows in %s\n", options.filename.c_str());
+        return 1;
+    }
+
+    size_t dim = row.features.size();
+    SlidingWindow window(dim, options.windowRows, options.windowSeconds);
+    BackgroundRefitter refitter(dim);
+    std::vector<double> latencies, scoredLatencies;
+    size_t rows = 0, scored = 0, flagged = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    do {
+        if (row.features.size() != dim) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", row.features.size(), dim);
+            return 1;
+        }
+        auto rowStart = std::chrono::steady_clock::now();
+
+        // score the row against the recent past, then let it join the window
+        window.expire(row.timestamp);
+        std::shared_ptr<const WindowModel> model = refitter.current();
+        double distance = 0, pValue = -1;
+        if (model && window.size() > 0) {
+            distance = window.nearestDistance(row.features);
+            pValue = model->hasFit ? fitPValue(model->fit, distance) : empiricalPValue(model->sortedDistances, distance);
+        }
+        window.push(row.timestamp, row.features);
+        if (++rows % options.refitEvery == 0) {
+            refitter.submit(window);
+        }
+
+        auto rowEnd = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::micro>(rowEnd - rowStart).count());
+
+        if (pValue >= 0) {
+            scoredLatencies.push_back(latencies.back());
+            ++scored;
+            bool drift = pValue < options.alpha;
+            flagged += drift;
+            if (drift || options.verbose) {
+                printf("%s distance %g p-value %g%s\n", row.label.c_str(), distance, pValue, drift ? " DRIFT" : "");
+            }
+        }
+    } while (readAirQualityRow(file, row));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Rows: %zu scored: %zu flagged: %zu refits: %zu\n", rows, scored, flagged, refitter.refitCount());
+    printLatencies("Per-row latency (us)", latencies);
+    // rows that arrive before the first curve is fitted are not searched, so the scan shows only here
+    printLatencies("Scored-row latency (us)", scoredLatencies);
+    printf("Ingest rate: %.0f rows/s\n", rows / seconds);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <vector>
+#include <string>
+#include <istream>
+
+struct StreamOptions {
+    std::string filename;
+    size_t windowRows;      // count-based window, the most recent rows kept
+    double windowSeconds;   // time-based window, 0 keeps the count-based window only
+    size_t refitEvery;      // rows between background refits of the window curve
+    double alpha;           // rows with a p-value below alpha are flagged
+    bool verbose;           // print every scored row, not only the flagged ones
+
+    StreamOptions() : windowRows(168), windowSeconds(0), refitEvery(24), alpha(0.01), verbose(false) {}
+};
+
+// one time-stamped row of the stream, missing values are NaN
+struct StreamRow {
+    std::string label;
+    double timestamp;
+    std::vector<double> features;
+};
+
+// Sliding window over the most recent rows, stored in a ring buffer so that
+// expiring the oldest rows only moves the head. Welford's running mean and sum of
+// squared deviations, updated as rows enter and leave, give the window sigma
+// without a pass over the rows; they are recomputed from the rows every 4096
+// removals so that rounding cannot build up over a long stream.
+class SlidingWindow {
+public:
+    SlidingWindow(size_t dim, size_t maxRows, double maxSeconds);
+
+    void push(double timestamp, const std::vector<double>& row);
+    void expire(double now);
+    size_t size() const { return count; }
+
+    // distance from row to its nearest neighbor in the window, in window-normalized units.
+    // A scan of the window, O(rows * dim): the normalization changes with every row that
+    // enters or leaves and missing readings are skipped per pair, which a tree over the
+    // rows could not follow without rebuilding.
+    double nearestDistance(const std::vector<double>& row);
+
+    // copy the window rows (oldest first) and the inverse sigmas used for normalization
+    void snapshot(std::vector<double>& out, std::vector<double>& invSigmas);
+
+private:
+    void grow();
+    void popFront();
+    void updateInvSigmas();
+    void recomputeMoments();
+
+    size_t dim;
+    size_t maxRows;
+    double maxSeconds;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool sigmasDirty;
+    std::vector<double> rows;
+    std::vector<double> times;
+    size_t removals;                 // since the moments were last recomputed
+    std::vector<double> means;
+    std::vector<double> deviations;  // sum of squared deviations from the mean
+    std::vector<size_t> present;
+    std::vector<double> invSigmas;
+};
+
+bool readAirQualityRow(std::istream& in, StreamRow& row);
+
+int runStream(const StreamOptions& options);
+
+#endif
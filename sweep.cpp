@@ -0,0 +1,314 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+
+#include "sweep.h"
+#include "model.h"
+#include "kdtree.h"
+#include "fit.h"
+#include "pool.h"
+#include "trace.h"
+#include "measure.h"
+
+// rows of the neighbor pass handled by one stage
+static const size_t NEIGHBOR_CHUNK_ROWS = 128;
+
+typedef std::chrono::steady_clock Clock;
+
+enum StageKind { INDEX, NEIGHBORS, CURVE, FIT, SCORE, STAGE_KINDS };
+static const char* const STAGE_NAMES[STAGE_KINDS] = {"index", "neighbors", "curve", "fit", "score"};
+
+struct SweepStage {
+    StageKind kind;
+    std::function<void()> run;
+    std::vector<SweepStage*> dependents;
+    std::atomic<size_t> unmet;      // stages this one still waits for
+    double seconds;
+};
+
+struct SweepGraph {
+    std::vector<std::unique_ptr<SweepStage> > stages;
+
+    SweepStage* add(StageKind kind, std::function<void()> run, const std::vector<SweepStage*>& dependencies) {
+        stages.push_back(std::unique_ptr<SweepStage>(new SweepStage()));
+        SweepStage* stage = stages.back().get();
+        stage->kind = kind;
+        stage->run = run;
+        stage->unmet = dependencies.size();
+        stage->seconds = 0;
+        for (SweepStage* dependency : dependencies) {
+            dependency->dependents.push_back(stage);
+        }
+        return stage;
+    }
+};
+
+struct SweepScore {
+    size_t knnCorrect;      // rows whose k-NN vote (without the row itself) is their class
+    size_t pCorrect;        // rows whose own-class p-value beats every other class
+    size_t rejected;        // rows with an own-class p-value below 0.05
+    double ownPValueSum;
+};
+
+static void runStage(TaskPool& pool, SweepStage* stage) {
+    auto start = Clock::now();
+    {
+        TRACE_SPAN("sweep", STAGE_NAMES[stage->kind]);
+        stage->run();
+    }
+    stage->seconds = secondsSince(start);
+    for (SweepStage* dependent : stage->dependents) {
+        if (--dependent->unmet == 0) {
+            pool.submit([&pool, dependent] { runStage(pool, dependent); });
+        }
+    }
+}
+
+static double curvePValue(const std::vector<double>& curve, const CurveFit& fit, double distance) {
+    if (fit.family >= 0) {
+        size_t familyCount;
+        return sigmoidPValue(sigmoidFamilies(familyCount)[fit.family], fit.c, fit.a, distance);
+    }
+    size_t below = std::lower_bound(curve.begin(), curve.end(), distance) - curve.begin();
+    return static_cast<double>(curve.size() - below + 1) / (curve.size() + 1);
+}
+
+int runSweep(const std::string& filename, const TableFormat& format, const SweepOptions& options) {
+    auto start = Clock::now();
+    std::vector<ClassMember> dataset = readTable(filename, format);
+    if (dataset.empty()) {
+        fprintf(stderr, "No rows in %s\n", filename.c_str());
+        return 1;
+    }
+    for (const auto& obj : dataset) {
+        if (obj.features.size() != dataset[0].features.size()) {
+            fprintf(stderr, "Inconsistent feature size: %zu != %zu\n", obj.features.size(), dataset[0].features.size());
+            return 1;
+        }
+    }
+    double parseSeconds = secondsSince(start);
+
+    start = Clock::now();
+    Model model = normalizeModel(dataset, options.threads);
+    dataset.clear();
+    double normalizeSeconds = secondsSince(start);
+
+    size_t n = model.classOffsets.back(), dim = model.dim, classCount = model.classNames.size();
+    size_t maxK = std::min(*std::max_element(options.ks.begin(), options.ks.end()), n - 1);
+    std::vector<uint32_t> rowClasses(n);
+    for (size_t c = 0; c < classCount; ++c) {
+        std::fill(rowClasses.begin() + model.classOffsets[c], rowClasses.begin() + model.classOffsets[c + 1], static_cast<uint32_t>(c));
+    }
+
+    // results of the shared stages
+    std::vector<double> nearest(n * classCount, std::numeric_limits<double>::infinity());  // nearest other row of each class
+    std::vector<uint32_t> knnRows(n * maxK);                                                // K nearest other rows, nearest first
+    size_t curveKinds = options.cutoffs.size() * options.keepDuplicates.size();
+    size_t maskCount = options.familyMasks.size();
+    std::vector<std::vector<double> > curves(curveKinds * classCount);
+    std::vector<CurveFit> fits(curveKinds * maskCount * classCount);
+    size_t configCount = options.ks.size() * curveKinds * maskCount;
+    std::vector<SweepScore> scores(configCount);
+
+    SweepGraph graph;
+
+    // a joint kd-tree for the K nearest rows and a tree per class for the nearest row of each class
+    ModelView view = viewOf(model);
+    KdTree joint;
+    std::vector<KdTree> classTrees(classCount);
+    std::vector<uint64_t> classRange(2 * classCount, 0);
+    std::vector<SweepStage*> indexStages;
+    indexStages.push_back(graph.add(INDEX, [&] { joint = buildKdTree(view, options.leafSize); }, std::vector<SweepStage*>()));
+    for (size_t c = 0; c < classCount; ++c) {
+        indexStages.push_back(graph.add(INDEX, [&, c] {
+            ModelView classView;
+            classView.dim = dim;
+            classView.rows = model.classOffsets[c + 1] - model.classOffsets[c];
+            classView.classCount = 1;
+            classView.features = &model.features[model.classOffsets[c] * dim];
+            classRange[2 * c + 1] = classView.rows;
+            classView.classOffsets = &classRange[2 * c];
+            classTrees[c] = buildKdTree(classView, options.leafSize);
+        }, std::vector<SweepStage*>()));
+    }
+
+    std::vector<SweepStage*> neighborStages;
+    for (size_t begin = 0; begin < n; begin += NEIGHBOR_CHUNK_ROWS) {
+        size_t end = std::min(n, begin + NEIGHBOR_CHUNK_ROWS);
+        neighborStages.push_back(graph.add(NEIGHBORS, [&, begin, end] {
+            size_t count = end - begin, searched = maxK + 1;
+            const double* queries = &model.features[begin * dim];
+            std::vector<FusedScratch> scratch;
+            std::vector<Neighbor> found(count * searched);
+            std::vector<size_t> foundCounts(count);
+
+            // K + 1 nearest rows, then each row without itself, or without the farthest
+            // if rows at distance 0 pushed it out
+            nearestNeighborsGroup(joint, queries, count, searched, scratch, found.data(), foundCounts.data());
+            for (size_t q = 0; q < count; ++q) {
+                const Neighbor* nearestRows = &found[q * searched];
+                size_t self = std::find_if(nearestRows, nearestRows + foundCounts[q],
+                                           [&](const Neighbor& row) { return row.row == begin + q; }) - nearestRows;
+                uint32_t* bestRows = &knnRows[(begin + q) * maxK];
+                for (size_t j = 0, kept = 0; j < foundCounts[q] && kept < maxK; ++j) {
+                    if (j != self) {
+                        bestRows[kept++] = nearestRows[j].row;
+                    }
+                }
+            }
+
+            // the nearest row of each class, the two nearest within the row's own class
+            for (size_t c = 0; c < classCount; ++c) {
+                nearestNeighborsGroup(classTrees[c], queries, count, 2, scratch, found.data(), foundCounts.data());
+                for (size_t q = 0; q < count; ++q) {
+                    size_t i = begin + q;
+                    const Neighbor* nearestRows = &found[q * 2];
+                    // when the row itself is not the first, the first is another row at distance 0
+                    size_t first = rowClasses[i] == c && foundCounts[q] > 0 && nearestRows[0].row == i - model.classOffsets[c];
+                    if (first < foundCounts[q]) {
+                        nearest[i * classCount + c] = nearestRows[first].distance;
+                    }
+                }
+            }
+        }, indexStages));
+    }
+
+    // curve of each class for each (cutoff, duplicate policy), then its fit for each family set
+    std::vector<SweepStage*> curveStages(curves.size());
+    std::vector<SweepStage*> fitStages(fits.size());
+    for (size_t cutoff = 0; cutoff < options.cutoffs.size(); ++cutoff) {
+        for (size_t duplicates = 0; duplicates < options.keepDuplicates.size(); ++duplicates) {
+            size_t curveKind = cutoff * options.keepDuplicates.size() + duplicates;
+            for (size_t c = 0; c < classCount; ++c) {
+                SweepStage* curveStage = curveStages[curveKind * classCount + c] = graph.add(CURVE, [&, cutoff, duplicates, curveKind, c] {
+                    std::vector<double>& curve = curves[curveKind * classCount + c];
+                    for (uint64_t i = model.classOffsets[c]; i < model.classOffsets[c + 1]; ++i) {
+                        if (nearest[i * classCount + c] <= options.cutoffs[cutoff]) {
+                            curve.push_back(nearest[i * classCount + c]);
+                        }
+                    }
+                    std::sort(curve.begin(), curve.end());
+                    if (!options.keepDuplicates[duplicates]) {
+                        curve.erase(std::unique(curve.begin(), curve.end()), curve.end());
+                    }
+                }, neighborStages);
+                for (size_t mask = 0; mask < maskCount; ++mask) {
+                    size_t fitIndex = (curveKind * maskCount + mask) * classCount + c;
+                    fitStages[fitIndex] = graph.add(FIT, [&, curveKind, mask, fitIndex, c] {
+                        fits[fitIndex] = fitClassCurve(curves[curveKind * classCount + c], model.classNames[c], options.familyMasks[mask]);
+                    }, std::vector<SweepStage*>(1, curveStage));
+                }
+            }
+        }
+    }
+
+    // one scoring stage per configuration, after the fits of its curve kind and family set
+    for (size_t config = 0; config < configCount; ++config) {
+        size_t k = std::min(options.ks[config / (curveKinds * maskCount)], maxK);
+        size_t curveKind = config / maskCount % curveKinds;
+        size_t mask = config % maskCount;
+        std::vector<SweepStage*> dependencies(fitStages.begin() + (curveKind * maskCount + mask) * classCount,
+                                              fitStages.begin() + (curveKind * maskCount + mask + 1) * classCount);
+        graph.add(SCORE, [&, config, k, curveKind, mask] {
+            SweepScore score = SweepScore();
+            std::vector<size_t> votes(classCount);
+            for (size_t i = 0; i < n; ++i) {
+                // the vote as in fusedQuery: ties go to the class of the nearer neighbor
+                std::fill(votes.begin(), votes.end(), 0);
+                const uint32_t* neighbors = &knnRows[i * maxK];
+                for (size_t j = 0; j < k; ++j) {
+                    ++votes[rowClasses[neighbors[j]]];
+                }
+                size_t predicted = k > 0 ? rowClasses[neighbors[0]] : 0;
+                for (size_t j = 0; j < k; ++j) {
+                    if (votes[rowClasses[neighbors[j]]] > votes[predicted]) {
+                        predicted = rowClasses[neighbors[j]];
+                    }
+                }
+                score.knnCorrect += predicted == rowClasses[i];
+
+                double own = 0, other = 0;
+                for (size_t c = 0; c < classCount; ++c) {
+                    size_t curve = curveKind * classCount + c;
+                    double p = curvePValue(curves[curve], fits[(curveKind * maskCount + mask) * classCount + c], nearest[i * classCount + c]);
+                    if (c == rowClasses[i]) {
+                        own = p;
+                    } else {
+                        other = std::max(other, p);
+                    }
+                }
+                score.pCorrect += own > other;
+                score.rejected += own < 0.05;
+                score.ownPValueSum += own;
+            }
+            scores[config] = score;
+        }, dependencies);
+    }
+
+    start = Clock::now();
+    {
+        TaskPool pool(options.threads);
+        for (const auto& stage : graph.stages) {
+            if (stage->unmet == 0) {
+                SweepStage* root = stage.get();
+                pool.submit([&pool, root] { runStage(pool, root); });
+            }
+        }
+        pool.wait();
+    }
+    double sweepSeconds = secondsSince(start);
+
+    // an estimate, not a measurement, of what running every configuration on its own would
+    // have cost: each one repeats the parse, normalization, index builds and neighbor pass,
+    // its curves and its fits, at the times they took here
+    double stageSeconds[STAGE_KINDS] = {0, 0, 0, 0, 0};
+    size_t stageCounts[STAGE_KINDS] = {0, 0, 0, 0, 0};
+    for (const auto& stage : graph.stages) {
+        stageSeconds[stage->kind] += stage->seconds;
+        ++stageCounts[stage->kind];
+    }
+    double separateSeconds = 0;
+    for (size_t config = 0; config < configCount; ++config) {
+        size_t curveKind = config / maskCount % curveKinds;
+        size_t mask = config % maskCount;
+        separateSeconds += parseSeconds + normalizeSeconds + stageSeconds[INDEX] + stageSeconds[NEIGHBORS] +
+                           stageSeconds[SCORE] / configCount;
+        for (size_t c = 0; c < classCount; ++c) {
+            separateSeconds += curveStages[curveKind * classCount + c]->seconds;
+            separateSeconds += fitStages[(curveKind * maskCount + mask) * classCount + c]->seconds;
+        }
+    }
+
+    printf("%s: %zu rows, %zu features, %zu classes, %zu configurations, %zu threads\n", filename.c_str(), n, dim, classCount,
+           configCount, options.threads);
+    printf("parse %.3f ms, normalize %.3f ms, sweep %.3f ms\n", parseSeconds * 1e3, normalizeSeconds * 1e3, sweepSeconds * 1e3);
+    for (int kind = 0; kind < STAGE_KINDS; ++kind) {
+        printf("%-9s %5zu stages %10.3f ms\n", STAGE_NAMES[kind], stageCounts[kind], stageSeconds[kind] * 1e3);
+    }
+    double sharedSeconds = parseSeconds + normalizeSeconds;
+    for (int kind = 0; kind < STAGE_KINDS; ++kind) {
+        sharedSeconds += stageSeconds[kind];
+    }
+    printf("stage time %.3f ms shared vs an estimated %.3f ms as separate runs (%.1fx, summed from the shared stage times)\n",
+           sharedSeconds * 1e3, separateSeconds * 1e3, separateSeconds / sharedSeconds);
+    printf("    k   cutoff  duplicates  families          k-NN acc  p acc  mean own p  own p<0.05\n");
+    for (size_t config = 0; config < configCount; ++config) {
+        size_t k = options.ks[config / (curveKinds * maskCount)];
+        size_t curveKind = config / maskCount % curveKinds;
+        size_t mask = config % maskCount;
+        const SweepScore& score = scores[config];
+        printf("%5zu %8g  %-10s  %-16s %9.3f %6.3f %11.3f %11.3f\n", k, options.cutoffs[curveKind / options.keepDuplicates.size()],
+               options.keepDuplicates[curveKind % options.keepDuplicates.size()] ? "keep" : "unique", options.familyNames[mask].c_str(),
+               static_cast<double>(score.knnCorrect) / n, static_cast<double>(score.pCorrect) / n, score.ownPValueSum / n,
+               static_cast<double>(score.rejected) / n);
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "dataset.h"
+
+// the values swept; every combination is one configuration
+struct SweepOptions {
+    std::vector<size_t> ks;               // k of the k-NN vote
+    std::vector<double> cutoffs;          // nearest neighbor distances above the cutoff leave the curve
+    std::vector<bool> keepDuplicates;     // keep repeated distances in the curve instead of removing them
+    std::vector<uint32_t> familyMasks;    // sigmoid families the best fit is chosen from
+    std::vector<std::string> familyNames;
+    size_t threads;
+    size_t leafSize;                      // of the kd-trees of the neighbor pass
+
+    SweepOptions() : threads(1), leafSize(8) {}
+};
+
+// Evaluate every configuration with leave-one-out scoring of the training rows.
+// The configurations are expanded into a DAG of stages (kd-tree builds, neighbor
+// search, per-class curves, per-class fits, scoring) in which each distinct stage
+// appears once: one K-nearest pass over the trees serves every k <= K and every cutoff, a curve serves every family
+// set, and a fit serves every k. The stages run on a work-stealing pool.
+int runSweep(const std::string& filename, const TableFormat& format, const SweepOptions& options);
+
+#endif
@@ -0,0 +1,119 @@
+#ifdef CPV_TRACE
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+#include "trace.h"
+
+// events kept per thread; older events are overwritten
+static const uint64_t TRACE_BUFFER_EVENTS = 1 << 16;
+
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    int64_t arg;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// one per thread, never freed so that the buffers of finished threads can still be written
+struct TraceBuffer {
+    uint32_t tid;
+    uint64_t recorded;
+    std::vector<TraceEvent> events;
+};
+
+#if !defined(__x86_64__) && !defined(__i386__)
+uint64_t traceClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static void writeTrace();
+
+// the clock at startup, to convert clock ticks to microseconds at exit
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<TraceBuffer*> buffers;
+    uint64_t startTicks;
+    std::chrono::steady_clock::time_point startTime;
+
+    TraceRegistry() : startTicks(traceClock()), startTime(std::chrono::steady_clock::now()) {
+        atexit(writeTrace);
+    }
+};
+
+// never destroyed: writeTrace runs at exit, after static destructors registered later
+static TraceRegistry& registry = *new TraceRegistry();
+static thread_local TraceBuffer* localBuffer = nullptr;
+
+void traceRecord(const char* category, const char* name, int64_t arg, uint64_t begin, uint64_t end) {
+    if (localBuffer == nullptr) {
+        localBuffer = new TraceBuffer();
+        localBuffer->recorded = 0;
+        localBuffer->events.resize(TRACE_BUFFER_EVENTS);
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        localBuffer->tid = static_cast<uint32_t>(registry.buffers.size()) + 1;
+        registry.buffers.push_back(localBuffer);
+    }
+    TraceEvent& event = localBuffer->events[localBuffer->recorded++ % TRACE_BUFFER_EVENTS];
+    event.category = category;
+    event.name = name;
+    event.arg = arg;
+    event.begin = begin;
+    event.end = end;
+}
+
+static void writeTrace() {
+    // ticks per microsecond over the whole run, at least 20 ms of it
+    auto elapsed = std::chrono::steady_clock::now() - registry.startTime;
+    if (elapsed < std::chrono::milliseconds(20)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20) - elapsed);
+    }
+    uint64_t ticks = traceClock() - registry.startTicks;
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - registry.startTime).count();
+    double ticksPerMicro = ticks / micros;
+
+    const char* filename = getenv("CPV_TRACE");
+    filename = filename && *filename ? filename : "cpv-trace.json";
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        perror(filename);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    uint64_t written = 0, dropped = 0;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"cpv\"}}");
+    for (TraceBuffer* buffer : registry.buffers) {
+        fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+                buffer->tid, buffer->tid);
+        uint64_t first = buffer->recorded > TRACE_BUFFER_EVENTS ? buffer->recorded - TRACE_BUFFER_EVENTS : 0;
+        dropped += first;
+        for (uint64_t i = first; i < buffer->recorded; ++i) {
+            const TraceEvent& event = buffer->events[i % TRACE_BUFFER_EVENTS];
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                    event.name, event.category, buffer->tid, (event.begin - registry.startTicks) / ticksPerMicro,
+                    (event.end - event.begin) / ticksPerMicro);
+            if (event.arg >= 0) {
+                fprintf(out, ", \"args\": {\"index\": %lld}", static_cast<long long>(event.arg));
+            }
+            fprintf(out, "}");
+            ++written;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    fprintf(stderr, "trace: %llu spans written to %s", static_cast<unsigned long long>(written), filename);
+    if (dropped > 0) {
+        fprintf(stderr, " (%llu older spans overwritten)", static_cast<unsigned long long>(dropped));
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Scoped trace spans. TRACE_SPAN(category, name) records the time from the
+// statement to the end of the enclosing scope into a per-thread ring buffer;
+// category and name must be string literals or other static strings, and the
+// _ARG variant attaches a number such as a class index. Spans are compiled in
+// only with -DCPV_TRACE (make cpv_trace); at exit the buffers are written as
+// Chrome trace-event JSON, viewable in Perfetto or chrome://tracing, to the file
+// named by the CPV_TRACE environment variable or cpv-trace.json. Every span also
+// opens a StageScope of stage.h, so memory and counters are attributed to the same
+// stages the trace shows; without CPV_TRACE and with neither of them on, that is
+// one test of stagesEnabled per span.
+
+#include "stage.h"
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef CPV_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t traceClock() { return __rdtsc(); }
+#else
+uint64_t traceClock();  // steady clock nanoseconds
+#endif
+
+void traceRecord(const char* category, const char* name, int64_t arg, uint64_t begin, uint64_t end);
+
+class TraceSpan {
+public:
+    TraceSpan(const char* category, const char* name, int64_t arg = -1)
+        : category(category), name(name), arg(arg), begin(traceClock()) {}
+    ~TraceSpan() { traceRecord(category, name, arg, begin, traceClock()); }
+
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+
+    const char* category;
+    const char* name;
+    int64_t arg;
+    uint64_t begin;
+};
+
+#define TRACE_SPAN(category, name)                              \
+    StageScope TRACE_CONCAT(stageScope, __LINE__)(category, name);  \
+    TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(category, name)
+#define TRACE_SPAN_ARG(category, name, arg)                                              \
+    StageScope TRACE_CONCAT(stageScope, __LINE__)(category, name, static_cast<int64_t>(arg)); \
+    TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(category, name, static_cast<int64_t>(arg))
+
+#else
+
+#define TRACE_SPAN(category, name) StageScope TRACE_CONCAT(stageScope, __LINE__)(category, name)
+#define TRACE_SPAN_ARG(category, name, arg) StageScope TRACE_CONCAT(stageScope, __LINE__)(category, name, static_cast<int64_t>(arg))
+
+#endif
+
+#endif